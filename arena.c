@@ -0,0 +1,179 @@
+#include "header.h"
+
+/*
+ * Bump allocator used for everything that only lives as long as one command line:
+ * the raw line, the split command strings, token arrays and their strings.
+ * Memory is carved out of a chain of blocks and handed back all at once with arena_reset().
+ */
+
+struct arena line_arena;
+
+/*
+- Allocate a new block able to hold at least `size` bytes.
+- Blocks are never smaller than the arena's block size (ARENA_BLOCK_SIZE unless
+  set) so small lines share one block.
+*/
+static struct arena_block *new_block(struct arena *a, size_t size)
+{
+  size_t least = a->block_size ? a->block_size : ARENA_BLOCK_SIZE;
+  size_t cap = size > least ? size : least;
+  struct arena_block *block = malloc(sizeof(struct arena_block) + cap);
+  if (block == NULL)
+  {
+    perror("arena");
+    exit(EXIT_FAILURE);
+  }
+  block->next = NULL;
+  block->size = cap;
+  block->used = 0;
+  return block;
+}
+
+/*
+- Round the request up to pointer alignment and bump the current block.
+- When the current block is full, move on to the next retained block if it fits,
+  otherwise link a fresh block right after the current one.
+*/
+void *arena_alloc(struct arena *a, size_t size)
+{
+  size = (size + ARENA_ALIGN - 1) & ~(size_t)(ARENA_ALIGN - 1);
+
+  if (a->head == NULL)
+  {
+    a->head = a->cur = new_block(a, size);
+    a->retained = a->head->size;
+    a->blocks++;
+  }
+
+  while (a->cur->size - a->cur->used < size)
+  {
+    struct arena_block *next = a->cur->next;
+    if (next == NULL || next->size < size)
+    {
+      struct arena_block *block = new_block(a, size);
+      block->next = next;
+      a->cur->next = block;
+      a->retained += block->size;
+      a->blocks++;
+      next = block;
+    }
+    next->used = 0;
+    a->cur = next;
+  }
+
+  void *ptr = a->cur->data + a->cur->used;
+  a->cur->used += size;
+  a->last = ptr;
+  a->allocs++;
+  return ptr;
+}
+
+/*
+- Grow an allocation made from the arena.
+- The most recent allocation is extended in place when the block has room,
+  anything else is copied into a new allocation (the old bytes are reclaimed on reset).
+*/
+void *arena_realloc(struct arena *a, void *ptr, size_t old_size, size_t new_size)
+{
+  if (ptr == NULL)
+    return arena_alloc(a, new_size);
+
+  if (ptr == a->last)
+  {
+    size_t offset = (char *)ptr - a->cur->data;
+    size_t need = (new_size + ARENA_ALIGN - 1) & ~(size_t)(ARENA_ALIGN - 1);
+    if (offset + need <= a->cur->size)
+    {
+      a->cur->used = offset + need;
+      return ptr;
+    }
+  }
+
+  void *grown = arena_alloc(a, new_size);
+  memcpy(grown, ptr, old_size < new_size ? old_size : new_size);
+  return grown;
+}
+
+/*
+   Copies the first n bytes of s into the arena and null-terminates it.
+*/
+char *arena_strndup(struct arena *a, const char *s, size_t n)
+{
+  char *copy = arena_alloc(a, n + 1);
+  memcpy(copy, s, n);
+  copy[n] = '\0';
+  return copy;
+}
+
+char *arena_strdup(struct arena *a, const char *s)
+{
+  return arena_strndup(a, s, strlen(s));
+}
+
+/*
+   Records the current top of the arena so a nested user can hand back
+   everything allocated after this point with arena_release().
+*/
+struct arena_mark arena_mark(struct arena *a)
+{
+  struct arena_mark mark = {a->cur, a->cur ? a->cur->used : 0};
+  return mark;
+}
+
+void arena_release(struct arena *a, struct arena_mark mark)
+{
+  if (mark.block == NULL)
+  {
+    arena_reset(a);
+    return;
+  }
+  a->cur = mark.block;
+  a->cur->used = mark.used;
+  a->last = NULL;
+}
+
+/*
+- Hand back every allocation at once by rewinding to the first block.
+- Blocks are kept for the next line; only when an unusually large line pushed the
+  retained size past ARENA_RETAIN_MAX are the extra blocks returned to malloc,
+  so memory stays flat however many lines are run.
+*/
+void arena_reset(struct arena *a)
+{
+  if (a->head == NULL)
+    return;
+
+  if (a->retained > ARENA_RETAIN_MAX)
+  {
+    struct arena_block *block = a->head->next;
+    while (block != NULL)
+    {
+      struct arena_block *next = block->next;
+      free(block);
+      block = next;
+    }
+    a->head->next = NULL;
+    a->retained = a->head->size;
+  }
+
+  a->cur = a->head;
+  a->cur->used = 0;
+  a->last = NULL;
+}
+
+/*
+   Returns every block of the arena to malloc, for an arena that is not used again.
+*/
+void arena_free(struct arena *a)
+{
+  struct arena_block *block = a->head;
+  while (block != NULL)
+  {
+    struct arena_block *next = block->next;
+    free(block);
+    block = next;
+  }
+  a->head = a->cur = NULL;
+  a->last = NULL;
+  a->retained = 0;
+}
@@ -0,0 +1,338 @@
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <spawn.h>
+#include <time.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
+
+/*
+ * End-to-end benchmark for the shell, run with `make bench`. Every case writes a
+ * script into a scratch directory, runs `shell script` (no prompt, stdout to
+ * /dev/null) a number of times, and divides each run's wall time by the work the
+ * script does: commands, pipelines, lines, jobs or MiB piped. One tab-separated
+ * row is printed per case, in microseconds per unit, so lower is always better
+ * and two builds can be compared with diff or a spreadsheet.
+ *
+ *   usage: bench_driver [shell] [case ...]
+ *   BENCH_RUNS  runs per case (default 15)
+ *   BENCH_MB    size of the file piped by the throughput cases (default 64)
+ *   BENCH_FILES files in the directory globbed by the glob cases (default 10000)
+ */
+
+extern char **environ;
+
+static char *shell_path;
+static int runs = 15;
+static int big_mb = 64;
+static int glob_files = 10000;
+
+struct bench_case
+{
+  const char *name;
+  const char *unit;
+  void (*write_script)(FILE *script, const void *arg, int *units);
+  const void *arg;
+};
+
+static double now_us(void)
+{
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec * 1e6 + ts.tv_nsec / 1e3;
+}
+
+static int compare_double(const void *a, const void *b)
+{
+  double x = *(const double *)a, y = *(const double *)b;
+  return (x > y) - (x < y);
+}
+
+/* Nearest-rank percentile of a sorted sample */
+static double percentile(const double *sorted, int n, int pct)
+{
+  int rank = (pct * n + 99) / 100;
+  return sorted[rank > 0 ? rank - 1 : 0];
+}
+
+/*
+   Runs the shell on one script and returns the wall time in microseconds,
+   or -1 if it could not be started or did not exit with status 0.
+*/
+static double run_shell(const char *script)
+{
+  posix_spawn_file_actions_t actions;
+  posix_spawn_file_actions_init(&actions);
+  posix_spawn_file_actions_addopen(&actions, STDIN_FILENO, "/dev/null", O_RDONLY, 0);
+  posix_spawn_file_actions_addopen(&actions, STDOUT_FILENO, "/dev/null", O_WRONLY, 0);
+
+  char *argv[] = {shell_path, (char *)script, NULL};
+  pid_t pid;
+  double start = now_us();
+  int err = posix_spawn(&pid, shell_path, &actions, NULL, argv, environ);
+  posix_spawn_file_actions_destroy(&actions);
+  if (err != 0)
+  {
+    errno = err;
+    perror(shell_path);
+    return -1;
+  }
+
+  int status;
+  while (waitpid(pid, &status, 0) < 0)
+    if (errno != EINTR)
+      return -1;
+  double elapsed = now_us() - start;
+
+  if (!WIFEXITED(status) || WEXITSTATUS(status) != 0)
+    return -1;
+  return elapsed;
+}
+
+static void repeat_line(FILE *script, const char *line, int count, int *units)
+{
+  for (int i = 0; i < count; i++)
+    fprintf(script, "%s\n", line);
+  *units = count;
+}
+
+static void script_empty(FILE *script, const void *arg, int *units)
+{
+  (void)script;
+  (void)arg;
+  *units = 1;
+}
+
+static void script_repeat(FILE *script, const void *arg, int *units)
+{
+  repeat_line(script, arg, 200, units);
+}
+
+static void script_pipeline(FILE *script, const void *arg, int *units)
+{
+  int stages = *(const int *)arg;
+  int lines = stages > 16 ? 10 : 40;
+  for (int i = 0; i < lines; i++)
+  {
+    for (int s = 0; s < stages; s++)
+      fprintf(script, s ? " | true" : "true");
+    fprintf(script, "\n");
+  }
+  *units = lines;
+}
+
+static void script_throughput(FILE *script, const void *arg, int *units)
+{
+  int stages = *(const int *)arg;
+  fprintf(script, "cat big.dat");
+  for (int s = 1; s < stages; s++)
+    fprintf(script, " | cat");
+  fprintf(script, " > /dev/null\n");
+  *units = big_mb;
+}
+
+static void script_feed(FILE *script, const void *arg, int *units)
+{
+  fprintf(script, "%s\n", (const char *)arg);
+  *units = big_mb;
+}
+
+#define LOOP_PASSES 10000
+
+/* A loop whose body runs LOOP_PASSES times, parsed once */
+static void script_loop(FILE *script, const void *arg, int *units)
+{
+  fprintf(script, "for i in {1..%d}; do %s; done\n", LOOP_PASSES, (const char *)arg);
+  *units = LOOP_PASSES;
+}
+
+/* The same body written out LOOP_PASSES times, parsed line by line */
+static void script_unrolled(FILE *script, const void *arg, int *units)
+{
+  for (int i = 0; i < LOOP_PASSES; i++)
+    fprintf(script, "%s\n", (const char *)arg);
+  *units = LOOP_PASSES;
+}
+
+/* A here-document of a few lines, written out for each command */
+static void script_heredoc(FILE *script, const void *arg, int *units)
+{
+  for (int i = 0; i < 200; i++)
+    fprintf(script, "%s <<EOF\nfirst line\nsecond line $HOME\nthird line\nEOF\n", (const char *)arg);
+  *units = 200;
+}
+
+static void script_glob(FILE *script, const void *arg, int *units)
+{
+  repeat_line(script, arg, 20, units);
+}
+
+static const int stages_2 = 2, stages_4 = 4, stages_8 = 8, stages_16 = 16, stages_32 = 32, stages_64 = 64;
+static const int cat_1 = 1, cat_3 = 3, cat_8 = 8;
+
+static const struct bench_case cases[] = {
+    {"startup", "run", script_empty, NULL},
+    {"launch_true", "cmd", script_repeat, "/usr/bin/true"},
+    {"launch_sequence", "line", script_repeat, "/usr/bin/true; /usr/bin/true; /usr/bin/true; /usr/bin/true; /usr/bin/true"},
+    {"builtin_true", "cmd", script_repeat, "true"},
+    {"builtin_sequence", "line", script_repeat, "test 3 -gt 2; [ -f small.dat ]; printf %d\\n 42; echo done; true"},
+    {"builtin_redirect", "cmd", script_repeat, "echo line >> out.dat"},
+    {"loop_body", "pass", script_loop, "if [ 5 -gt 3 ] && true; then :; else false; fi"},
+    {"unrolled_body", "pass", script_unrolled, "if [ 5 -gt 3 ] && true; then :; else false; fi"},
+    {"subst_builtin", "subst", script_repeat, "x=$(echo value)"},
+    {"subst_pwd", "subst", script_repeat, "x=$(pwd)"},
+    {"subst_subshell", "subst", script_repeat, "x=$(echo a; echo b)"},
+    {"subst_external", "subst", script_repeat, "x=$(/usr/bin/true)"},
+    {"pipeline_2", "pipeline", script_pipeline, &stages_2},
+    {"pipeline_4", "pipeline", script_pipeline, &stages_4},
+    {"pipeline_8", "pipeline", script_pipeline, &stages_8},
+    {"pipeline_16", "pipeline", script_pipeline, &stages_16},
+    {"pipeline_32", "pipeline", script_pipeline, &stages_32},
+    {"pipeline_64", "pipeline", script_pipeline, &stages_64},
+    {"throughput_cat_1", "MiB", script_throughput, &cat_1},
+    {"throughput_cat_3", "MiB", script_throughput, &cat_3},
+    {"throughput_cat_8", "MiB", script_throughput, &cat_8},
+    {"throughput_wc", "MiB", script_feed, "cat big.dat | wc -l > /dev/null"},
+    {"throughput_redirect", "MiB", script_feed, "< big.dat | wc -l > /dev/null"},
+    {"throughput_pipesize", "MiB", script_feed, "pipesize=1M cat big.dat | cat | cat > /dev/null"},
+    {"redirect_in", "cmd", script_repeat, "/usr/bin/true < small.dat"},
+    {"redirect_out", "cmd", script_repeat, "/usr/bin/true > out.dat"},
+    {"redirect_append", "cmd", script_repeat, "/usr/bin/true >> out.dat"},
+    {"redirect_in_out", "cmd", script_repeat, "/usr/bin/true < small.dat > out.dat"},
+    {"redirect_heredoc", "cmd", script_heredoc, "/usr/bin/true"},
+    {"redirect_herestring", "cmd", script_repeat, "/usr/bin/true <<< word"},
+    {"glob_all", "line", script_glob, "true files/*"},
+    {"glob_pattern", "line", script_glob, "true files/*7*"},
+    {"glob_nomatch", "line", script_glob, "true files/*.none"},
+    {"background_fanout", "job", script_repeat, "true &"},
+};
+
+/*
+- Write the case's script, run it `runs` times and print one row of statistics.
+- A case whose runs fail is reported with a `failed` row instead of numbers.
+*/
+static void run_case(const struct bench_case *c)
+{
+  char script_name[64];
+  int units = 1;
+  snprintf(script_name, sizeof(script_name), "%s.sh", c->name);
+
+  FILE *script = fopen(script_name, "w");
+  if (script == NULL)
+  {
+    perror(script_name);
+    exit(EXIT_FAILURE);
+  }
+  c->write_script(script, c->arg, &units);
+  fclose(script);
+
+  double *samples = malloc(sizeof(double) * runs);
+  run_shell(script_name); // warm the page cache and the PATH lookups
+  for (int i = 0; i < runs; i++)
+  {
+    double elapsed = run_shell(script_name);
+    if (elapsed < 0)
+    {
+      printf("%s\t%s\tfailed\n", c->name, c->unit);
+      fflush(stdout);
+      free(samples);
+      return;
+    }
+    samples[i] = elapsed / units;
+  }
+
+  qsort(samples, runs, sizeof(double), compare_double);
+  printf("%s\tus/%s\t%.2f\t%.2f\t%.2f\t%.2f\t%.2f\t%d\n", c->name, c->unit,
+         percentile(samples, runs, 50), percentile(samples, runs, 90), percentile(samples, runs, 99),
+         samples[0], samples[runs - 1], runs);
+  fflush(stdout);
+  free(samples);
+}
+
+/*
+   Creates the input files the cases read: a small file for redirections,
+   a large one for throughput, and a directory full of files for globbing.
+*/
+static void make_fixtures(void)
+{
+  FILE *f = fopen("small.dat", "w");
+  if (f == NULL)
+  {
+    perror("small.dat");
+    exit(EXIT_FAILURE);
+  }
+  fprintf(f, "small\n");
+  fclose(f);
+
+  static char block[1 << 20];
+  memset(block, 'x', sizeof(block));
+  for (size_t i = 63; i < sizeof(block); i += 64)
+    block[i] = '\n';
+  f = fopen("big.dat", "w");
+  if (f == NULL)
+  {
+    perror("big.dat");
+    exit(EXIT_FAILURE);
+  }
+  for (int i = 0; i < big_mb; i++)
+    fwrite(block, 1, sizeof(block), f);
+  fclose(f);
+
+  mkdir("files", 0755);
+  for (int i = 0; i < glob_files; i++)
+  {
+    char name[64];
+    snprintf(name, sizeof(name), "files/f%06d.txt", i);
+    int fd = open(name, O_WRONLY | O_CREAT, 0644);
+    if (fd >= 0)
+      close(fd);
+  }
+}
+
+static int env_int(const char *name, int fallback)
+{
+  const char *value = getenv(name);
+  int n = value ? atoi(value) : 0;
+  return n > 0 ? n : fallback;
+}
+
+int main(int argc, char **argv)
+{
+  runs = env_int("BENCH_RUNS", runs);
+  big_mb = env_int("BENCH_MB", big_mb);
+  glob_files = env_int("BENCH_FILES", glob_files);
+
+  shell_path = realpath(argc > 1 ? argv[1] : "./shell", NULL);
+  if (shell_path == NULL)
+  {
+    perror(argc > 1 ? argv[1] : "./shell");
+    return EXIT_FAILURE;
+  }
+
+  char dir[] = "/tmp/shell-bench.XXXXXX";
+  if (mkdtemp(dir) == NULL || chdir(dir) < 0)
+  {
+    perror("bench directory");
+    return EXIT_FAILURE;
+  }
+  make_fixtures();
+
+  printf("# case\tunit\tmedian\tp90\tp99\tmin\tmax\truns\n");
+  for (size_t i = 0; i < sizeof(cases) / sizeof(cases[0]); i++)
+  {
+    int selected = argc <= 2;
+    for (int a = 2; a < argc && !selected; a++)
+      selected = strcmp(argv[a], cases[i].name) == 0;
+    if (selected)
+      run_case(&cases[i]);
+  }
+
+  char cmd[PATH_MAX + 16];
+  snprintf(cmd, sizeof(cmd), "rm -rf '%s'", dir);
+  return system(cmd) == 0 ? EXIT_SUCCESS : EXIT_FAILURE;
+}
@@ -0,0 +1,323 @@
+#include "header.h"
+#include <time.h>
+
+/*
+ * In-process benchmark of the command line parser, run with `make bench-parser`.
+ * It links parser.c and arena.c directly and feeds them a corpus of realistic and
+ * adversarial lines, the same way the shell loop does: parse_line(), optionally
+ * expand_words() on every simple command, then arena_reset(). For each corpus entry
+ * it prints ns per line, MB/s of input, arena allocations and bytes per line, and
+ * how many blocks the arena had to take from malloc per line (0 once warmed up).
+ *
+ *   usage: bench_parser [corpus-file]
+ *   A corpus file adds one more entry whose lines are parsed in turn.
+ *   BENCH_MS    minimum time per sample in milliseconds (default 100)
+ *   BENCH_RUNS  samples per entry, the median is reported (default 5)
+ */
+
+struct corpus
+{
+  const char *name;
+  char **lines;
+  int num_lines;
+  size_t bytes;
+};
+
+/* The corpus has no command substitution: the parser links without the rest of the shell */
+char *command_output(char *command)
+{
+  (void)command;
+  return arena_strdup(&line_arena, "");
+}
+
+static struct corpus corpora[16];
+static int num_corpora;
+
+/* Growable string used to generate the synthetic lines */
+struct text
+{
+  char *buf;
+  size_t len, cap;
+};
+
+static void text_add(struct text *t, const char *s)
+{
+  size_t n = strlen(s);
+  if (t->len + n + 1 > t->cap)
+  {
+    t->cap = (t->len + n + 1) * 2;
+    t->buf = realloc(t->buf, t->cap);
+    if (t->buf == NULL)
+    {
+      perror("bench_parser");
+      exit(EXIT_FAILURE);
+    }
+  }
+  memcpy(t->buf + t->len, s, n + 1);
+  t->len += n;
+}
+
+static void add_corpus(const char *name, char **lines, int num_lines)
+{
+  struct corpus *c = &corpora[num_corpora++];
+  c->name = name;
+  c->lines = lines;
+  c->num_lines = num_lines;
+  c->bytes = 0;
+  for (int i = 0; i < num_lines; i++)
+    c->bytes += strlen(lines[i]);
+}
+
+static void add_line(const char *name, char *line)
+{
+  char **lines = malloc(sizeof(char *));
+  lines[0] = line;
+  add_corpus(name, lines, 1);
+}
+
+/* A line made of `count` copies of `piece` followed by `tail` */
+static char *repeat(const char *piece, int count, const char *tail)
+{
+  struct text t = {0};
+  for (int i = 0; i < count; i++)
+    text_add(&t, piece);
+  text_add(&t, tail);
+  return t.buf;
+}
+
+static char *realistic[] = {
+    "ls -la",
+    "cd ..",
+    "grep -n main *.c",
+    "cat README.md | grep shell | wc -l",
+    "make clean; make -j8 > build.log",
+    "sort < names.txt | uniq -c | sort -rn | head -20 > top.txt",
+    "tar czf backup.tgz docs src &",
+    "find . -name f1?.txt | xargs wc -c >> sizes.log",
+    "ps aux | grep sleep | grep -v grep | awk {print} ; echo done",
+    "sleep 10 & sleep 20 & echo started",
+};
+
+static void build_corpus(void)
+{
+  add_corpus("realistic", realistic, sizeof(realistic) / sizeof(realistic[0]));
+  add_line("simple", strdup("ls -la /tmp"));
+  add_line("pipeline_64", repeat("grep pattern file.txt | ", 63, "cat"));
+  add_line("segments_200", repeat("echo x ; sleep 0 & ", 100, ""));
+  add_line("redirects_mixed", repeat("cmd < in.txt > out.txt >> log.txt ", 50, ""));
+  add_line("globs_heavy", repeat("*.txt f1?.txt dir/* ", 10, ""));
+  add_line("operators_dense", repeat("a|b;c&d>e<f>>g;", 200, ""));
+  add_line("blanks_heavy", repeat(" \t  ls   \t -l  \t ;  ", 100, ""));
+  add_line("word_4k", repeat("abcdefghijklmnop", 256, ""));
+}
+
+/*
+   Reads a corpus file, one command line per line, keeping the newline as
+   read_command_line() does.
+*/
+static void load_corpus_file(const char *path)
+{
+  FILE *f = fopen(path, "r");
+  if (f == NULL)
+  {
+    perror(path);
+    exit(EXIT_FAILURE);
+  }
+
+  char **lines = NULL;
+  int count = 0, capacity = 0;
+  char *line = NULL;
+  size_t line_cap = 0;
+  while (getline(&line, &line_cap, f) > 0)
+  {
+    if (count == capacity)
+    {
+      capacity = capacity ? capacity * 2 : 64;
+      lines = realloc(lines, sizeof(char *) * capacity);
+    }
+    lines[count++] = strdup(line);
+  }
+  free(line);
+  fclose(f);
+  if (count > 0)
+    add_corpus("file", lines, count);
+}
+
+/*
+   Creates a scratch directory with files for the glob patterns of the corpus,
+   so expansion results do not depend on where the benchmark is run.
+*/
+static char fixture_dir[] = "/tmp/parser-bench.XXXXXX";
+
+static void make_glob_fixture(void)
+{
+  char *dir = fixture_dir;
+  if (mkdtemp(dir) == NULL || chdir(dir) < 0)
+  {
+    perror("bench directory");
+    exit(EXIT_FAILURE);
+  }
+  mkdir("dir", 0755);
+  for (int i = 0; i < 200; i++)
+  {
+    char name[32];
+    snprintf(name, sizeof(name), i % 2 ? "f%d.txt" : "dir/f%d.c", i);
+    int fd = open(name, O_WRONLY | O_CREAT, 0644);
+    if (fd >= 0)
+      close(fd);
+  }
+}
+
+static double now_ns(void)
+{
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec * 1e9 + ts.tv_nsec;
+}
+
+static int compare_double(const void *a, const void *b)
+{
+  double x = *(const double *)a, y = *(const double *)b;
+  return (x > y) - (x < y);
+}
+
+/* Builds the argument vector of every simple command in a sequence, compound commands included */
+static void expand_sequence(struct sequence *seq)
+{
+  for (int i = 0; i < seq->num_commands; i++)
+  {
+    struct command *cmd = &seq->commands[i];
+    struct sequence *parts[] = {cmd->cond, cmd->body, cmd->otherwise};
+    int argc;
+    if (cmd->pipeline != NULL)
+      for (int c = 0; c < cmd->pipeline->num_cmds; c++)
+        expand_words(&cmd->pipeline->cmds[c], &argc);
+    for (struct command *side = cmd->left; side != NULL; side = side == cmd->left ? cmd->right : NULL)
+    {
+      struct sequence one = {1, side};
+      expand_sequence(&one);
+    }
+    if (cmd->words != NULL)
+      expand_words(cmd->words, &argc);
+    for (size_t p = 0; p < sizeof(parts) / sizeof(parts[0]); p++)
+      if (parts[p] != NULL)
+        expand_sequence(parts[p]);
+    for (int it = 0; it < cmd->num_items; it++)
+      expand_sequence(cmd->items[it].body);
+  }
+}
+
+/*
+- Parse one line like the shell loop does, leaving its memory in the line arena.
+- With `expand`, also build the argument vector of every simple command.
+- Return 0 if the line has a syntax error.
+*/
+static int parse_only(char *line, int expand)
+{
+  struct sequence *seq = parse_line(line);
+  if (seq != NULL && expand)
+    expand_sequence(seq);
+  return seq != NULL;
+}
+
+static int parse_once(char *line, int expand)
+{
+  int ok = parse_only(line, expand);
+  arena_reset(&line_arena);
+  return ok;
+}
+
+/* Bytes the arena hands out for one parse of the line */
+static size_t arena_bytes(char *line, int expand)
+{
+  size_t used = 0;
+  parse_only(line, expand);
+  for (struct arena_block *b = line_arena.head; b != NULL; b = b->next)
+  {
+    used += b->used;
+    if (b == line_arena.cur)
+      break;
+  }
+  arena_reset(&line_arena);
+  return used;
+}
+
+static void run_corpus(struct corpus *c, int expand, double min_ns, int runs)
+{
+  for (int i = 0; i < c->num_lines; i++)
+    if (!parse_once(c->lines[i], expand))
+    {
+      printf("%s\t%s\tsyntax error in line %d\n", c->name, expand ? "parse+expand" : "parse", i + 1);
+      return;
+    }
+
+  // calibrate the number of passes over the corpus so one sample takes min_ns
+  long passes = 1;
+  while (1)
+  {
+    double start = now_ns();
+    for (long p = 0; p < passes; p++)
+      for (int i = 0; i < c->num_lines; i++)
+        parse_once(c->lines[i], expand);
+    if (now_ns() - start >= min_ns / 4)
+      break;
+    passes *= 2;
+  }
+  passes *= 4;
+
+  double *samples = malloc(sizeof(double) * runs);
+  size_t allocs = line_arena.allocs, blocks = line_arena.blocks;
+  for (int r = 0; r < runs; r++)
+  {
+    double start = now_ns();
+    for (long p = 0; p < passes; p++)
+      for (int i = 0; i < c->num_lines; i++)
+        parse_once(c->lines[i], expand);
+    samples[r] = (now_ns() - start) / ((double)passes * c->num_lines);
+  }
+  double lines_run = (double)runs * passes * c->num_lines;
+  double allocs_per_line = (line_arena.allocs - allocs) / lines_run;
+  double blocks_per_line = (line_arena.blocks - blocks) / lines_run;
+
+  size_t bytes = 0;
+  for (int i = 0; i < c->num_lines; i++)
+    bytes += arena_bytes(c->lines[i], expand);
+
+  qsort(samples, runs, sizeof(double), compare_double);
+  double ns = samples[runs / 2];
+  double avg_len = (double)c->bytes / c->num_lines;
+  printf("%s\t%s\t%d\t%.0f\t%.1f\t%.1f\t%.1f\t%zu\t%.4f\n", c->name, expand ? "parse+expand" : "parse",
+         c->num_lines, avg_len, ns, avg_len / ns * 1e3, allocs_per_line, bytes / c->num_lines, blocks_per_line);
+  fflush(stdout);
+  free(samples);
+}
+
+static int env_int(const char *name, int fallback)
+{
+  const char *value = getenv(name);
+  int n = value ? atoi(value) : 0;
+  return n > 0 ? n : fallback;
+}
+
+int main(int argc, char **argv)
+{
+  double min_ns = env_int("BENCH_MS", 100) * 1e6;
+  int runs = env_int("BENCH_RUNS", 5);
+
+  vars_init(); // $NAME in the corpus expands as in the shell
+  build_corpus();
+  if (argc > 1)
+    load_corpus_file(argv[1]);
+  make_glob_fixture();
+
+  printf("# corpus\tphase\tlines\tbytes/line\tns/line\tMB/s\tallocs/line\tarena_bytes/line\tmallocs/line\n");
+  for (int i = 0; i < num_corpora; i++)
+  {
+    run_corpus(&corpora[i], 0, min_ns, runs);
+    run_corpus(&corpora[i], 1, min_ns, runs);
+  }
+
+  char cmd[PATH_MAX + 16];
+  snprintf(cmd, sizeof(cmd), "rm -rf '%s'", fixture_dir);
+  return system(cmd) == 0 ? EXIT_SUCCESS : EXIT_FAILURE;
+}
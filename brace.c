@@ -0,0 +1,218 @@
+#include "header.h"
+
+/*
+ * Brace expansion, done on each word before wildcards. `pre{a,b}post` becomes one
+ * word per alternative, and `{1..10}`, `{01..10}`, `{10..1..3}` or `{a..e}` one word
+ * per value of the sequence, left to right as in bash. Braces nest and every brace
+ * of a word is expanded, so `{a,b}{1,2}` gives four words. A brace holding neither
+ * a ',' nor a valid sequence, or written after '$', is left as it is.
+ */
+
+struct word_list
+{
+  char **words;
+  int count, capacity;
+};
+
+static void add_word(struct word_list *list, char *word)
+{
+  if (list->count == list->capacity)
+  {
+    int grown = list->capacity ? list->capacity * 2 : 8;
+    list->words = arena_realloc(&line_arena, list->words, sizeof(char *) * list->capacity,
+                                sizeof(char *) * grown);
+    list->capacity = grown;
+  }
+  list->words[list->count++] = word;
+}
+
+/* Index of the '}' closing the '{' at open, or -1 */
+static int find_close(const char *word, int open)
+{
+  int depth = 0;
+  for (int i = open; word[i]; i++)
+  {
+    if (word[i] == '\\' && word[i + 1])
+      i++;
+    else if (word[i] == '{')
+      depth++;
+    else if (word[i] == '}' && --depth == 0)
+      return i;
+  }
+  return -1;
+}
+
+/* Parses a whole integer of a sequence, returning 0 if s[0, len) is not one */
+static int parse_number(const char *s, int len, long *value)
+{
+  int i = (len > 0 && (s[0] == '-' || s[0] == '+'));
+  if (i == len)
+    return 0;
+  for (int j = i; j < len; j++)
+    if (s[j] < '0' || s[j] > '9')
+      return 0;
+  *value = strtol(s, NULL, 10);
+  return 1;
+}
+
+/* Zero padding asked for by an endpoint such as 01 or -007, 0 if none */
+static int padded_width(const char *s, int len)
+{
+  int sign = (s[0] == '-' || s[0] == '+');
+  return (len - sign > 1 && s[sign] == '0') ? len : 0;
+}
+
+static void expand_from(char *word, int from, struct word_list *out);
+
+/* Joins prefix, middle and suffix in the arena and expands what follows the prefix */
+static void expand_joined(const char *prefix, int prefix_len, const char *middle, int middle_len,
+                          const char *suffix, struct word_list *out)
+{
+  int suffix_len = strlen(suffix);
+  char *word = arena_alloc(&line_arena, prefix_len + middle_len + suffix_len + 1);
+  memcpy(word, prefix, prefix_len);
+  memcpy(word + prefix_len, middle, middle_len);
+  memcpy(word + prefix_len + middle_len, suffix, suffix_len + 1);
+  expand_from(word, prefix_len, out);
+}
+
+/*
+- Expand the sequence x..y or x..y..step held in body[0, len), writing each value
+  between prefix and suffix into the list.
+- Return 0 if the body is not a sequence.
+*/
+static int expand_sequence(const char *body, int len, const char *prefix, int prefix_len,
+                           const char *suffix, struct word_list *out)
+{
+  const char *dots = NULL, *dots2 = NULL;
+  for (int i = 0; i + 1 < len; i++)
+    if (body[i] == '.' && body[i + 1] == '.')
+    {
+      if (dots == NULL)
+        dots = body + i;
+      else if (dots2 == NULL && body + i >= dots + 3)
+        dots2 = body + i;
+      i++;
+    }
+  if (dots == NULL)
+    return 0;
+
+  const char *from = body, *to = dots + 2;
+  int from_len = dots - body;
+  int to_len = (dots2 ? dots2 : body + len) - to;
+  long step = 1;
+  if (dots2 != NULL && !parse_number(dots2 + 2, body + len - dots2 - 2, &step))
+    return 0;
+  // the distance between values, unsigned so that no range near LONG_MIN or LONG_MAX overflows
+  unsigned long stride = step < 0 ? 0 - (unsigned long)step : (unsigned long)step;
+  if (stride == 0)
+    stride = 1;
+
+  long first, last;
+  char text[32];
+  if (parse_number(from, from_len, &first) && parse_number(to, to_len, &last))
+  {
+    int width = padded_width(from, from_len);
+    if (padded_width(to, to_len) > width)
+      width = padded_width(to, to_len);
+    int up = first <= last;
+    for (long v = first;; v = (long)(up ? (unsigned long)v + stride : (unsigned long)v - stride))
+    {
+      int n = width ? snprintf(text, sizeof(text), "%0*ld", width, v)
+                    : snprintf(text, sizeof(text), "%ld", v);
+      expand_joined(prefix, prefix_len, text, n, suffix, out);
+      if ((up ? (unsigned long)last - (unsigned long)v : (unsigned long)v - (unsigned long)last) < stride)
+        break; // the next step would pass the end
+    }
+    return 1;
+  }
+  if (from_len == 1 && to_len == 1)
+  {
+    int a = (unsigned char)from[0], b = (unsigned char)to[0];
+    for (int c = a;; c += a <= b ? (int)stride : -(int)stride)
+    {
+      text[0] = (char)c;
+      expand_joined(prefix, prefix_len, text, 1, suffix, out);
+      if ((unsigned long)(a <= b ? b - c : c - b) < stride)
+        break;
+    }
+    return 1;
+  }
+  return 0;
+}
+
+/*
+- Expand the first expandable brace of word at or after from, then the rest of
+  each result; add the word itself when no brace is left to expand.
+*/
+static void expand_from(char *word, int from, struct word_list *out)
+{
+  for (int open = from; word[open]; open++)
+  {
+    if (word[open] == '\\' && word[open + 1])
+    {
+      open++;
+      continue;
+    }
+    if (word[open] != '{' || (open > 0 && word[open - 1] == '$'))
+      continue;
+    int close = find_close(word, open);
+    if (close < 0)
+      break;
+
+    const char *body = word + open + 1, *suffix = word + close + 1;
+    int body_len = close - open - 1;
+
+    // the body's top-level commas split it into alternatives
+    int commas = 0, level = 0;
+    for (int i = 0; i < body_len; i++)
+    {
+      if (body[i] == '\\' && i + 1 < body_len)
+        i++;
+      else if (body[i] == '{')
+        level++;
+      else if (body[i] == '}')
+        level--;
+      else if (body[i] == ',' && level == 0)
+        commas++;
+    }
+
+    if (commas > 0)
+    {
+      int start = 0;
+      level = 0;
+      for (int i = 0; i <= body_len; i++)
+      {
+        if (i < body_len && body[i] == '\\' && i + 1 < body_len)
+          i++;
+        else if (i < body_len && body[i] == '{')
+          level++;
+        else if (i < body_len && body[i] == '}')
+          level--;
+        else if (i == body_len || (body[i] == ',' && level == 0))
+        {
+          expand_joined(word, open, body + start, i - start, suffix, out);
+          start = i + 1;
+        }
+      }
+      return;
+    }
+    if (expand_sequence(body, body_len, word, open, suffix, out))
+      return;
+  }
+  if (word[0] != '\0')
+    add_word(out, word); // an empty alternative leaves no word, as in bash
+}
+
+/*
+- Expand the braces of a word into the words they stand for, in the line arena.
+- Store them in *words and return their number, 1 with the word itself if it has no brace to expand.
+- Words left empty are dropped, so the number can be 0.
+*/
+int expand_braces(char *word, char ***words)
+{
+  struct word_list out = {0};
+  expand_from(word, 0, &out);
+  *words = out.words;
+  return out.count;
+}
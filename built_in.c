@@ -7,42 +7,103 @@ void change_prompt(char *new_prompt)
 {
   if (new_prompt != NULL)
   {
-    strncpy(prompt, new_prompt, MAX_BUF_LEN - 1);
-    prompt[MAX_BUF_LEN - 1] = '\0';
+    free(prompt);
+    prompt = strdup(new_prompt);
   }
 }
 
 /*
-   Prints the current working directory if no additional arguments are given;
-   otherwise, executes the command with the provided tokens.
+   Prints the current working directory, in the shell itself so that $(pwd) needs
+   no process. Returns 2 for an unknown option.
 */
-void pwd(char **cmd_tokens)
+int pwd(char **cmd_tokens)
+{
+  // the shell keeps no logical path of its own, so -L and -P both print the real one
+  for (int i = 1; cmd_tokens[i] != NULL && cmd_tokens[i][0] == '-'; i++)
+    if (strcmp(cmd_tokens[i], "-L") != 0 && strcmp(cmd_tokens[i], "-P") != 0)
+    {
+      fprintf(stderr, "pwd: %s: invalid option\n", cmd_tokens[i]);
+      return 2;
+    }
+
+  char *pwd_dir = getcwd(NULL, 0);
+  if (pwd_dir == NULL)
+  {
+    perror("pwd");
+    return 1;
+  }
+  printf("%s\n", pwd_dir);
+  free(pwd_dir);
+  return 0;
+}
+
+/*
+   Sets shell options given as name=value, or prints them all when called without arguments.
+   Options: launch=spawn|fork selects how external commands are started,
+   histsize=N how many commands history keeps.
+   Returns 0 on success, -1 for an unknown option or value.
+*/
+int set_option(char **cmd_tokens)
 {
-  char pwd_dir[MAX_BUF_LEN];
-  getcwd(pwd_dir, MAX_BUF_LEN - 1);
   if (cmd_tokens[1] == NULL)
-    printf("%s\n", pwd_dir);
-  else
-    execute_command(cmd_tokens);
+  {
+    printf("launch=%s\n", launch_mode_name());
+    printf("histsize=%d\n", history_size);
+    if (pipe_size == 0)
+      printf("pipesize=default\n");
+    else
+      printf("pipesize=%d\n", pipe_size);
+    return 0;
+  }
+
+  int ret = 0;
+  for (int i = 1; cmd_tokens[i] != NULL; i++)
+  {
+    char *value = strchr(cmd_tokens[i], '=');
+    if (value != NULL && strncmp(cmd_tokens[i], "launch=", 7) == 0)
+    {
+      if (set_launch_mode(value + 1) == 0)
+        continue;
+    }
+    else if (value != NULL && strncmp(cmd_tokens[i], "histsize=", 9) == 0)
+    {
+      if (set_history_size(value + 1) == 0)
+        continue;
+    }
+    else if (value != NULL && strncmp(cmd_tokens[i], "pipesize=", 9) == 0)
+    {
+      if (set_pipe_size(value + 1) == 0)
+        continue;
+    }
+    fprintf(stderr, "set: invalid option: %s\n", cmd_tokens[i]);
+    ret = -1;
+  }
+  return ret;
 }
 
 /*
  * Changes the directory based on command tokens, defaulting to base if none or "~" is given.
  * Updates the current directory path; returns 0 on success, -1 on failure.
  */
-int cd(char **cmd_tokens, char *cwd, char *base_dir)
+int cd(char **cmd_tokens, char **cwd, char *base_dir)
 {
   if (cmd_tokens[1] == NULL || strcmp(cmd_tokens[1], "~\0") == 0 || strcmp(cmd_tokens[1], "~/\0") == 0)
   {
     chdir(base_dir);
-    strcpy(cwd, base_dir);
-    update_cwd_relative(cwd);
+    free(*cwd);
+    *cwd = strdup(base_dir);
+    update_cwd_relative(*cwd);
     return 0;
   }
   else if (chdir(cmd_tokens[1]) == 0)
   {
-    getcwd(cwd, MAX_BUF_LEN);
-    update_cwd_relative(cwd);
+    char *dir = getcwd(NULL, 0);
+    if (dir != NULL)
+    {
+      free(*cwd);
+      *cwd = dir;
+      update_cwd_relative(*cwd);
+    }
     return 0;
   }
   else
@@ -52,54 +113,205 @@ int cd(char **cmd_tokens, char *cwd, char *base_dir)
   }
 }
 
-int history_index = 0;
-int history_count = 0;
+/* -------------------------------------------------------------------*/
 
 /*
-   Adds a command to the history, updating the index and count,
-   and ensuring the command is null-terminated.
+   The builtins run in the shell itself. Each one gets the command's words and its
+   redirections, which run_builtin() applies around it unless the builtin handles
+   them on its own, and returns the command's exit status.
 */
-void add_to_history(char *cmd)
+
+static int history_run(char **cmd_tokens, struct redirect *redirects)
 {
-  strncpy(history[history_index], cmd, MAX_BUF_LEN - 1);
-  history[history_index][MAX_BUF_LEN - 1] = '\0';
+  (void)redirects;
+  print_history(cmd_tokens);
+  return 0;
+}
 
-  history_index = (history_index + 1) % MAX_HISTORY;
-  if (history_count < MAX_HISTORY)
-  {
-    history_count++;
-  }
+static int cd_run(char **cmd_tokens, struct redirect *redirects)
+{
+  (void)redirects;
+  return cd(cmd_tokens, &cwd, base_dir) == 0 ? 0 : 1;
+}
+
+static int pwd_run(char **cmd_tokens, struct redirect *redirects)
+{
+  (void)redirects;
+  return pwd(cmd_tokens);
 }
 
+static int prompt_run(char **cmd_tokens, struct redirect *redirects)
+{
+  (void)redirects;
+  change_prompt(cmd_tokens[1]);
+  return 0;
+}
+
+static int set_run(char **cmd_tokens, struct redirect *redirects)
+{
+  (void)redirects;
+  return set_option(cmd_tokens) == 0 ? 0 : 1;
+}
+
+static int exit_run(char **cmd_tokens, struct redirect *redirects)
+{
+  (void)redirects;
+  exit(cmd_tokens[1] != NULL ? atoi(cmd_tokens[1]) & 0xff : last_status); // flushes builtin output still buffered in stdout
+}
+
+#define ARGV_ONLY(name)                                              \
+  static int name##_run(char **cmd_tokens, struct redirect *redirects) \
+  {                                                                  \
+    (void)redirects;                                                 \
+    return name(cmd_tokens);                                         \
+  }
+
+ARGV_ONLY(hash_builtin)
+ARGV_ONLY(jobstats_builtin)
+ARGV_ONLY(jobs_builtin)
+ARGV_ONLY(fg_builtin)
+ARGV_ONLY(bg_builtin)
+ARGV_ONLY(kill_builtin)
+ARGV_ONLY(wait_builtin)
+ARGV_ONLY(echo_builtin)
+ARGV_ONLY(printf_builtin)
+ARGV_ONLY(test_builtin)
+ARGV_ONLY(bracket_builtin)
+ARGV_ONLY(true_builtin)
+ARGV_ONLY(false_builtin)
+ARGV_ONLY(export_builtin)
+ARGV_ONLY(unset_builtin)
+
+static const struct builtin builtins[] = {
+    {"history", history_run, BUILTIN_PURE},
+    {"cd", cd_run, 0},
+    {"pwd", pwd_run, BUILTIN_PURE},
+    {"prompt", prompt_run, 0},
+    {"set", set_run, 0},
+    {"hash", hash_builtin_run, 0},
+    {"jobstats", jobstats_builtin_run, 0},
+    {"parallel", parallel_builtin, BUILTIN_OWN_REDIRECTS},
+    {"jobs", jobs_builtin_run, 0},
+    {"fg", fg_builtin_run, 0},
+    {"bg", bg_builtin_run, 0},
+    {"kill", kill_builtin_run, 0},
+    {"wait", wait_builtin_run, 0},
+    {"cat", cat_builtin, BUILTIN_OWN_REDIRECTS},
+    {"exit", exit_run, 0},
+    {"echo", echo_builtin_run, BUILTIN_PURE},
+    {"printf", printf_builtin_run, BUILTIN_PURE},
+    {"test", test_builtin_run, BUILTIN_PURE},
+    {"[", bracket_builtin_run, BUILTIN_PURE},
+    {"true", true_builtin_run, BUILTIN_PURE},
+    {"false", false_builtin_run, BUILTIN_PURE},
+    {":", true_builtin_run, BUILTIN_PURE},
+    {"export", export_builtin_run, 0},
+    {"unset", unset_builtin_run, 0},
+};
+
 /*
-   Prints the command history in order, starting from the oldest command.
+   A perfect hash of the builtin names, from their first and last characters and
+   their length, picked so that no two names share a slot: a builtin added with a
+   colliding name is a duplicate case below and fails to compile. Another name in a
+   builtin's slot is told apart by the final strcmp().
 */
-void print_history(void)
+#define BUILTIN_SLOT(first, last, len) ((((unsigned)(first)) * 35 + ((unsigned)(last)) * 19 + (len) * 3) & 63)
+
+/*
+- Find the builtin named name.
+- Return NULL if there is none, the command is then looked up in PATH.
+*/
+const struct builtin *find_builtin(const char *name)
 {
-  printf("\nCommand History:\n");
+  size_t len = strlen(name);
+  if (len == 0)
+    return NULL;
 
-  int start = (history_count < MAX_HISTORY) ? 0 : history_index;
-  for (int i = 0; i < history_count && i < MAX_HISTORY; i++)
+  int index;
+  switch (BUILTIN_SLOT(name[0], name[len - 1], len))
   {
-    int index = (start + i) % MAX_HISTORY;
-    printf("%d: %s", i + 1, history[index]);
+  case BUILTIN_SLOT('h', 'y', 7): index = 0; break;  // history
+  case BUILTIN_SLOT('c', 'd', 2): index = 1; break;  // cd
+  case BUILTIN_SLOT('p', 'd', 3): index = 2; break;  // pwd
+  case BUILTIN_SLOT('p', 't', 6): index = 3; break;  // prompt
+  case BUILTIN_SLOT('s', 't', 3): index = 4; break;  // set
+  case BUILTIN_SLOT('h', 'h', 4): index = 5; break;  // hash
+  case BUILTIN_SLOT('j', 's', 8): index = 6; break;  // jobstats
+  case BUILTIN_SLOT('p', 'l', 8): index = 7; break;  // parallel
+  case BUILTIN_SLOT('j', 's', 4): index = 8; break;  // jobs
+  case BUILTIN_SLOT('f', 'g', 2): index = 9; break;  // fg
+  case BUILTIN_SLOT('b', 'g', 2): index = 10; break; // bg
+  case BUILTIN_SLOT('k', 'l', 4): index = 11; break; // kill
+  case BUILTIN_SLOT('w', 't', 4): index = 12; break; // wait
+  case BUILTIN_SLOT('c', 't', 3): index = 13; break; // cat
+  case BUILTIN_SLOT('e', 't', 4): index = 14; break; // exit
+  case BUILTIN_SLOT('e', 'o', 4): index = 15; break; // echo
+  case BUILTIN_SLOT('p', 'f', 6): index = 16; break; // printf
+  case BUILTIN_SLOT('t', 't', 4): index = 17; break; // test
+  case BUILTIN_SLOT('[', '[', 1): index = 18; break; // [
+  case BUILTIN_SLOT('t', 'e', 4): index = 19; break; // true
+  case BUILTIN_SLOT('f', 'e', 5): index = 20; break; // false
+  case BUILTIN_SLOT(':', ':', 1): index = 21; break; // :
+  case BUILTIN_SLOT('e', 't', 6): index = 22; break; // export
+  case BUILTIN_SLOT('u', 't', 5): index = 23; break; // unset
+  default:
+    return NULL;
+  }
+  return strcmp(builtins[index].name, name) == 0 ? &builtins[index] : NULL;
+}
+
+/* Saves fd where restore_fd() can put it back, or marks it to be closed if it was not open */
+static int save_fd(int fd)
+{
+  return fcntl(fd, F_DUPFD_CLOEXEC, 10);
+}
+
+static void restore_fd(int saved, int fd)
+{
+  if (saved < 0)
+    close(fd);
+  else
+  {
+    dup2(saved, fd);
+    close(saved);
   }
 }
 
 /*
-   Searches the command history in reverse to find the most recent command
-   starting with the given prefix. Returns the command or NULL if not found.
+- Run a builtin in the shell, without forking: redirections are applied to the
+  shell's own stdin and stdout, which are put back afterwards.
+- Its output is flushed when it returns, so it keeps its place among the output of
+  the commands around it and its own messages on stderr.
+- Return the builtin's exit status, 1 if a redirection failed.
 */
-char *find_command_by_prefix(char *prefix)
+int run_builtin(const struct builtin *b, char **cmd_tokens, struct redirect *redirects)
 {
-  size_t prefix_len = strlen(prefix);
-  for (int i = history_count - 1; i >= 0; i--)
+  if (redirects == NULL || (b->flags & BUILTIN_OWN_REDIRECTS))
   {
-    int index = (history_index - 1 - i + MAX_HISTORY) % MAX_HISTORY;
-    if (strncmp(history[index], prefix, prefix_len) == 0)
-    {
-      return history[index];
-    }
+    int status = b->run(cmd_tokens, redirects);
+    fflush(stdout);
+    return status;
+  }
+
+  int save_in = 0, save_out = 0;
+  for (struct redirect *redir = redirects; redir != NULL; redir = redir->next)
+  {
+    if (redir->type == REDIR_INPUT || redir->type == REDIR_HERE_DOC || redir->type == REDIR_HERE_STRING)
+      save_in = 1;
+    else
+      save_out = 1;
   }
-  return NULL;
+
+  fflush(stdout);
+  int saved_in = save_in ? save_fd(STDIN_FILENO) : -1;
+  int saved_out = save_out ? save_fd(STDOUT_FILENO) : -1;
+
+  int status = apply_redirects(redirects) < 0 ? 1 : b->run(cmd_tokens, redirects);
+
+  fflush(stdout);
+  if (save_in)
+    restore_fd(saved_in, STDIN_FILENO);
+  if (save_out)
+    restore_fd(saved_out, STDOUT_FILENO);
+  return status;
 }
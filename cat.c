@@ -0,0 +1,399 @@
+#include "header.h"
+#include <sys/time.h>
+#ifdef __linux__
+#include <sys/sendfile.h>
+#endif
+
+/*
+ * The builtin `cat`, and the pipeline fast path built on it. A pipeline whose
+ * first stage only reads files, `cat file... | ...` or `< file | ...`, gets no
+ * process for that stage: the shell starts the other stages and copies the files
+ * into the first pipe itself, with splice() on Linux, so the data never passes
+ * through user space. A plain `cat file... [> out]` runs in the shell the same way,
+ * with sendfile(). Other systems, and inputs the kernel cannot splice, fall back
+ * to read() and write().
+ *
+ * The copy blocks like cat's would, and an interval timer breaks it every
+ * STALL_CHECK_MS to look at the job. If the stages reading the pipe are stopped
+ * (Ctrl-Z), the shell hands the rest of the copy to a stopped child that joins the
+ * job, so the job can be continued with fg or bg like any other.
+ */
+
+#define COPY_CHUNK (1 << 20)  // bytes asked of one splice() or sendfile()
+#define COPY_BUFFER (1 << 17) // read() and write() fallback
+#define STALL_CHECK_MS 100    // how often a copy into a pipeline checks whether its readers are stopped
+
+enum copy_result
+{
+  COPY_DONE,
+  COPY_ERROR,       // errno tells which
+  COPY_INTERRUPTED, // Ctrl-C is pending
+  COPY_STOPPED      // the job reading the pipe is stopped
+};
+
+/* Whether some process of the job is stopped; the stop stays to be collected by wait */
+static int job_is_stopped(struct job *job)
+{
+  for (process_info *p = process_at(job->first_proc); p != NULL; p = process_at(p->next_in_job))
+  {
+    siginfo_t info;
+    info.si_pid = 0;
+    if (waitid(P_PID, p->pid, &info, WSTOPPED | WNOHANG | WNOWAIT) == 0 && info.si_pid != 0 &&
+        info.si_code == CLD_STOPPED)
+      return 1;
+  }
+  return 0;
+}
+
+/*
+- Decide what a copy does after a call was interrupted by the stall timer.
+- Return COPY_DONE to go on.
+*/
+static enum copy_result after_interrupt(struct job *job)
+{
+  if (interrupt_pending())
+    return COPY_INTERRUPTED;
+  if (job != NULL && job_is_stopped(job))
+    return COPY_STOPPED;
+  return COPY_DONE;
+}
+
+static enum copy_result write_all(int out, const char *buf, ssize_t len, struct job *job)
+{
+  while (len > 0)
+  {
+    ssize_t n = write(out, buf, len);
+    if (n > 0)
+    {
+      buf += n;
+      len -= n;
+    }
+    else if (errno != EINTR)
+      return COPY_ERROR;
+    else
+    {
+      enum copy_result r = after_interrupt(job);
+      if (r != COPY_DONE)
+        return r;
+    }
+  }
+  return COPY_DONE;
+}
+
+/*
+- Copy in to out until the end of in: splice() when out is a pipe, else sendfile(),
+  else read() and write().
+- A job reading out is checked for stops whenever the stall timer interrupts a call.
+*/
+static enum copy_result copy_fd(int in, int out, struct job *job)
+{
+#ifdef __linux__
+  struct stat st;
+  int to_pipe = fstat(out, &st) == 0 && S_ISFIFO(st.st_mode);
+  while (1)
+  {
+    ssize_t n = to_pipe ? splice(in, NULL, out, NULL, COPY_CHUNK, SPLICE_F_MOVE | SPLICE_F_MORE)
+                        : sendfile(out, in, NULL, COPY_CHUNK);
+    if (n == 0)
+      return COPY_DONE;
+    if (n > 0)
+    {
+      if (interrupt_pending())
+        return COPY_INTERRUPTED;
+      continue;
+    }
+    if (errno == EINVAL || errno == ENOSYS)
+      break; // the kernel cannot move this input; nothing was copied by the failed call
+    if (errno != EINTR)
+      return COPY_ERROR;
+    enum copy_result r = after_interrupt(job);
+    if (r != COPY_DONE)
+      return r;
+  }
+#endif
+
+  static char buf[COPY_BUFFER];
+  while (1)
+  {
+    ssize_t n = read(in, buf, sizeof(buf));
+    if (n == 0)
+      return COPY_DONE;
+    if (n < 0)
+    {
+      if (errno != EINTR)
+        return COPY_ERROR;
+      enum copy_result r = after_interrupt(job);
+      if (r != COPY_DONE)
+        return r;
+      continue;
+    }
+    enum copy_result r = write_all(out, buf, n, job);
+    if (r != COPY_DONE)
+      return r;
+    if (interrupt_pending())
+      return COPY_INTERRUPTED;
+  }
+}
+
+/*
+- Finish a copy into the pipe of a stopped job in a child that joins the job,
+  stopped as well, and continues with it.
+- The child copies the rest of the current input, then the files left.
+*/
+static void hand_over_copy(struct job *job, int in, char **files_left, int out)
+{
+  fflush(stdout);
+  pid_t pid = fork();
+  if (pid < 0)
+  {
+    perror("cat");
+    return;
+  }
+  if (pid == 0)
+  {
+    if (job_control)
+      setpgid(0, job->pgid);
+    sigset_t empty;
+    sigemptyset(&empty);
+    int defaults[] = {SIGINT, SIGQUIT, SIGTSTP, SIGTTIN, SIGTTOU, SIGCHLD, SIGPIPE, SIGALRM};
+    for (size_t i = 0; i < sizeof(defaults) / sizeof(defaults[0]); i++)
+      signal(defaults[i], SIG_DFL);
+    sigprocmask(SIG_SETMASK, &empty, NULL);
+
+    int failed = copy_fd(in, out, NULL) == COPY_ERROR;
+    close(in);
+    for (; *files_left != NULL; files_left++)
+    {
+      in = open(*files_left, O_RDONLY);
+      if (in < 0 || copy_fd(in, out, NULL) == COPY_ERROR)
+      {
+        fprintf(stderr, "cat: %s: %s\n", *files_left, strerror(errno));
+        failed = 1;
+      }
+      if (in >= 0)
+        close(in);
+    }
+    _exit(failed);
+  }
+
+  if (job_control)
+    setpgid(pid, job->pgid);
+  kill(pid, SIGSTOP);
+
+  // it joins the job without becoming its last stage
+  pid_t last_pid = job->last_pid;
+  add_process(pid, job->id, "cat");
+  job->last_pid = last_pid;
+}
+
+static void stall_tick(int signum)
+{
+  (void)signum;
+}
+
+/*
+- Copy files to out in order, naming the ones that cannot be read on stderr
+  ("cat: name: error", or "name: error" for a redirection).
+- A file that is the output file itself is skipped with an error, as cat does:
+  appending it to itself would never reach its end.
+- job is the job reading out, when out is the shell's end of its pipe.
+- Return 0 if every file was copied, 1 if some could not be, 130 on Ctrl-C.
+*/
+static int copy_files(char **files, int as_redirect, int out, struct job *job)
+{
+  struct sigaction ignore, saved_pipe, tick, saved_alarm;
+  memset(&ignore, 0, sizeof(ignore));
+  ignore.sa_handler = SIG_IGN;
+  sigaction(SIGPIPE, &ignore, &saved_pipe); // a reader gone shows up as EPIPE
+
+  // the stall timer: without SA_RESTART its signal makes a blocked call return EINTR
+  struct itimerval every = {{0, STALL_CHECK_MS * 1000}, {0, STALL_CHECK_MS * 1000}}, off = {{0, 0}, {0, 0}};
+  if (job != NULL)
+  {
+    memset(&tick, 0, sizeof(tick));
+    tick.sa_handler = stall_tick;
+    sigemptyset(&tick.sa_mask);
+    sigaction(SIGALRM, &tick, &saved_alarm);
+    setitimer(ITIMER_REAL, &every, NULL);
+  }
+
+  struct stat out_st, in_st;
+  int out_regular = fstat(out, &out_st) == 0 && S_ISREG(out_st.st_mode);
+
+  int status = 0;
+  for (int i = 0; files[i] != NULL; i++)
+  {
+    int in = open(files[i], O_RDONLY | O_CLOEXEC);
+    if (in >= 0 && out_regular && fstat(in, &in_st) == 0 && in_st.st_dev == out_st.st_dev &&
+        in_st.st_ino == out_st.st_ino)
+    {
+      fprintf(stderr, "%s%s: input file is output file\n", as_redirect ? "" : "cat: ", files[i]);
+      status = 1;
+      close(in);
+      continue;
+    }
+    enum copy_result r = in < 0 ? COPY_ERROR : copy_fd(in, out, job);
+    if (r == COPY_STOPPED)
+    {
+      hand_over_copy(job, in, files + i + 1, out);
+      close(in);
+      break;
+    }
+    if (r == COPY_ERROR && errno == EPIPE)
+    {
+      close(in);
+      break; // the reader is gone, as cat would die of SIGPIPE
+    }
+    if (r == COPY_ERROR)
+    {
+      fprintf(stderr, "%s%s: %s\n", as_redirect ? "" : "cat: ", files[i], strerror(errno));
+      status = 1;
+    }
+    if (in >= 0)
+      close(in);
+    if (r == COPY_INTERRUPTED)
+    {
+      status = 128 + SIGINT;
+      break;
+    }
+  }
+
+  if (job != NULL)
+  {
+    setitimer(ITIMER_REAL, &off, NULL);
+    sigaction(SIGALRM, &saved_alarm, NULL);
+  }
+  sigaction(SIGPIPE, &saved_pipe, NULL);
+  return status;
+}
+
+/*
+- Return the files a command only copies to its stdout, NULL-terminated, or NULL if
+  it does anything else.
+- That is `cat` with file names and no option, or `cat` or no command at all with
+  only input redirections (the last one is read). *as_redirect tells which.
+- Output redirections are allowed only if with_output is set; a here-document
+  is for the real cat.
+*/
+static char **copied_files(char **cmd_tokens, int tokens, struct redirect *redirects, int with_output,
+                           int *as_redirect)
+{
+  if (tokens > 0 && strcmp(cmd_tokens[0], "cat") != 0)
+    return NULL;
+  for (int i = 1; i < tokens; i++)
+    if (cmd_tokens[i][0] == '-')
+      return NULL; // an option, or stdin as "-"
+
+  struct redirect *input = NULL;
+  for (struct redirect *redir = redirects; redir != NULL; redir = redir->next)
+  {
+    if (redir->type == REDIR_INPUT)
+      input = redir;
+    else if (redir->type == REDIR_HERE_DOC || redir->type == REDIR_HERE_STRING || !with_output)
+      return NULL;
+  }
+
+  *as_redirect = tokens <= 1;
+  if (tokens > 1)
+    return input == NULL ? cmd_tokens + 1 : NULL;
+  if (input == NULL)
+    return NULL; // it would read the terminal
+  char **files = arena_alloc(&line_arena, sizeof(char *) * 2);
+  files[0] = input->file;
+  files[1] = NULL;
+  return files;
+}
+
+/*
+- Tell from its words as written whether a stage can be one copied_files() takes:
+  `cat` or no command, and no command substitution, which would run again when
+  launch_pipeline() expands a stage turned down here.
+*/
+static int may_copy(struct simple_command *cmd)
+{
+  if (cmd->argc > 0 && strcmp(cmd->argv[0], "cat") != 0)
+    return 0;
+  for (int i = 1; i < cmd->argc; i++)
+    if (strstr(cmd->argv[i], "$(") != NULL || strchr(cmd->argv[i], '`') != NULL)
+      return 0;
+  return 1;
+}
+
+/*
+- Run a pipeline whose first stage only copies files into it: start the other
+  stages on the read end of a pipe and copy the files into the write end here.
+- Return the number of processes started as launch_pipeline() does, or -1 if the
+  first stage is not such a stage and nothing was started.
+*/
+int launch_fed_pipeline(struct pipeline *pl, pid_t *pids, int *job_id)
+{
+  if (!may_copy(&pl->cmds[0]))
+    return -1;
+
+  int tokens, as_redirect;
+  char **cmd_tokens = expand_words(&pl->cmds[0], &tokens);
+  char **files = copied_files(cmd_tokens, tokens, pl->cmds[0].redirects, 0, &as_redirect);
+  if (files == NULL)
+    return -1;
+
+  int fds[2];
+  if (make_pipe(fds) < 0)
+  {
+    perror("Pipe not opened!\n");
+    return -1;
+  }
+
+  struct pipeline rest = *pl;
+  rest.cmds++;
+  rest.num_cmds--;
+  int started = launch_pipeline(&rest, fds[0], -1, pids, job_id);
+  close(fds[0]);
+
+  if (started > 0)
+    copy_files(files, as_redirect, fds[1], find_job(*job_id));
+  close(fds[1]); // end of input for the first stage left
+  return started;
+}
+
+/*
+- cat file... [> out], or cat < file [> out]: copy the files to stdout or the
+  output file in the shell.
+- Anything else (options, no file, reading stdin) runs the real cat.
+- Return the exit status.
+*/
+int cat_builtin(char **cmd_tokens, struct redirect *redirects)
+{
+  int tokens = 0;
+  while (cmd_tokens[tokens] != NULL)
+    tokens++;
+
+  int as_redirect;
+  char **files = copied_files(cmd_tokens, tokens, redirects, 1, &as_redirect);
+  if (files == NULL)
+  {
+    int status = execute_command(cmd_tokens, redirects, 0);
+    return status < 0 ? 127 : status; // the real cat could not be started
+  }
+
+  int out = STDOUT_FILENO;
+  for (struct redirect *redir = redirects; redir != NULL; redir = redir->next)
+  {
+    if (redir->type == REDIR_INPUT)
+      continue;
+    if (out != STDOUT_FILENO)
+      close(out);
+    int flags = O_CREAT | O_WRONLY | O_CLOEXEC | (redir->type == REDIR_APPEND ? O_APPEND : O_TRUNC);
+    out = open(redir->file, flags, S_IRWXU);
+    if (out < 0)
+    {
+      perror(redir->file);
+      return 1;
+    }
+  }
+
+  fflush(stdout);
+  int status = copy_files(files, as_redirect, out, NULL);
+  if (out != STDOUT_FILENO)
+    close(out);
+  return status;
+}
@@ -0,0 +1,283 @@
+#include "header.h"
+
+/*
+ * Runs the command tree the parser builds: and-or lists, `!`, and the compound
+ * commands if, while, until, for and case. The tree of a line is built once and
+ * stays in the line arena while the line runs, so a loop body is never lexed or
+ * parsed again: each pass only expands its words. What a pass allocates (argument
+ * vectors, expansions) is handed back at its end, so a long loop runs in constant
+ * memory.
+ *
+ * Every command sets last_status, the value of $?. A compound command or an
+ * and-or list ended by '&' runs in a forked copy of the shell, as one job.
+ */
+
+int interrupted;  // Ctrl-C: the rest of the command tree is skipped
+static int depth; // run_command() calls in progress
+
+/*
+- Whether Ctrl-C interrupted the command tree: the shell got it, or the command
+  it was running died of it. Loops check at every pass.
+- At the prompt, a Ctrl-C the shell got is taken here, as the foreground command's.
+  Elsewhere it is left for the event loop, which ends the shell.
+*/
+int check_interrupt(void)
+{
+  if (interrupt_pending())
+  {
+    if (interactive)
+    {
+      sigset_t set;
+      int signum;
+      sigemptyset(&set);
+      sigaddset(&set, SIGINT);
+      sigwait(&set, &signum);
+    }
+    last_status = 128 + SIGINT;
+    interrupted = 1;
+  }
+  return interrupted;
+}
+
+/*
+- Run each command of a sequence in turn.
+- Return the exit status of the last one, 0 for an empty sequence.
+*/
+int run_sequence(struct sequence *seq)
+{
+  if (seq->num_commands == 0)
+    last_status = 0;
+  for (int i = 0; i < seq->num_commands && !interrupted; i++)
+    run_command(&seq->commands[i]);
+  return last_status;
+}
+
+/*
+- Expand the word of a case command and run the commands of the first item with
+  a matching pattern.
+- The status is that of the commands run, 0 if no pattern matched.
+*/
+static void run_case(struct command *cmd)
+{
+  int tokens;
+  char **words = expand_words(cmd->words, &tokens);
+  const char *word = tokens > 0 ? words[0] : "";
+
+  for (int i = 0; i < cmd->num_items; i++)
+  {
+    struct case_item *item = &cmd->items[i];
+    for (int p = 0; p < item->num_patterns; p++)
+    {
+      struct glob_pattern *pat = item->compiled[p];
+      if (pat == NULL)
+      {
+        struct simple_command pattern = {1, &item->patterns[p], NULL};
+        char **expanded = expand_words(&pattern, &tokens);
+        pat = glob_compile_string(tokens > 0 ? expanded[0] : "");
+      }
+      if (glob_match(pat, word))
+      {
+        run_sequence(item->body);
+        return;
+      }
+    }
+  }
+  last_status = 0;
+}
+
+/*
+- Run the body of a for loop once per word of its list, with the variable set to
+  the word. The words are expanded once, before the first pass.
+- The status is that of the last pass, 0 if there was none, 130 if interrupted.
+*/
+static void run_for(struct command *cmd)
+{
+  int tokens;
+  char **words = expand_words(cmd->words, &tokens);
+  int status = 0;
+
+  for (int i = 0; i < tokens; i++)
+  {
+    struct arena_mark mark = arena_mark(&line_arena);
+    var_set(cmd->name, words[i], 0);
+    status = run_sequence(cmd->body);
+    arena_release(&line_arena, mark);
+    if (check_interrupt())
+      return;
+  }
+  last_status = status;
+}
+
+/*
+- Run a while or until loop: the condition, then the body while the condition
+  succeeds (while) or fails (until).
+- The status is that of the last pass of the body, 0 if it never ran, 130 if
+  interrupted.
+*/
+static void run_loop(struct command *cmd)
+{
+  int status = 0;
+  while (1)
+  {
+    struct arena_mark mark = arena_mark(&line_arena);
+    run_sequence(cmd->cond);
+    int go_on = (last_status == 0) == (cmd->type == CMD_WHILE);
+    if (go_on && !check_interrupt())
+      status = run_sequence(cmd->body);
+    arena_release(&line_arena, mark);
+    if (check_interrupt())
+      return;
+    if (!go_on)
+      break;
+  }
+  last_status = status;
+}
+
+/*
+- Fork a copy of the shell, in process group pgid (0 for a new one) and with in_fd
+  and out_fd, if not -1, as its stdin and stdout.
+- The copy has no job control of its own: what it runs stays in its group.
+- Return the pid of the copy in the shell, 0 in the copy, or -1.
+*/
+static pid_t start_subshell(pid_t pgid, int in_fd, int out_fd)
+{
+  fflush(stdout);
+  pid_t pid = fork();
+  if (pid < 0)
+  {
+    perror("fork");
+    return -1;
+  }
+  if (pid > 0)
+  {
+    if (job_control)
+      setpgid(pid, pgid);
+    return pid;
+  }
+
+  if (job_control)
+    setpgid(0, pgid);
+  interactive = job_control = 0;
+
+  sigset_t empty;
+  sigemptyset(&empty);
+  int defaults[] = {SIGINT, SIGQUIT, SIGTSTP, SIGTTIN, SIGTTOU, SIGCHLD};
+  for (size_t i = 0; i < sizeof(defaults) / sizeof(defaults[0]); i++)
+    signal(defaults[i], SIG_DFL);
+  sigprocmask(SIG_SETMASK, &empty, NULL);
+
+  if (in_fd >= 0)
+    dup2(in_fd, STDIN_FILENO);
+  if (out_fd >= 0)
+    dup2(out_fd, STDOUT_FILENO);
+  return 0;
+}
+
+/*
+- Start a copy of the shell that runs cmd and exits with its status (see
+  start_subshell() for the arguments).
+- Return the pid of the copy, or -1.
+*/
+pid_t fork_subshell(struct command *cmd, pid_t pgid, int in_fd, int out_fd)
+{
+  pid_t pid = start_subshell(pgid, in_fd, out_fd);
+  if (pid != 0)
+    return pid;
+
+  cmd->background = 0;
+  run_command(cmd);
+  fflush(stdout);
+  _exit(last_status);
+}
+
+/* As fork_subshell(), for a whole sequence of commands */
+pid_t fork_sequence(struct sequence *seq, pid_t pgid, int in_fd, int out_fd)
+{
+  pid_t pid = start_subshell(pgid, in_fd, out_fd);
+  if (pid != 0)
+    return pid;
+
+  run_sequence(seq);
+  fflush(stdout);
+  _exit(last_status);
+}
+
+/* Runs a command ended by '&' that is not a plain pipeline, as a job of its own */
+static void run_in_background(struct command *cmd)
+{
+  pid_t pid = fork_subshell(cmd, 0, -1, -1);
+  if (pid < 0)
+  {
+    last_status = 1;
+    return;
+  }
+
+  int job_id = add_job(cmd->text);
+  add_process(pid, job_id, cmd->text);
+  struct job *job = find_job(job_id);
+  set_job_background(job, 1);
+  printf("\n[%d] %d\n", number_job(job), pid);
+  watch_process(pid);
+  last_status = 0;
+}
+
+/*
+- Run one command of the tree and set last_status to its exit status.
+- A pipeline ended by '&' is started in the background by run_pipeline(), any
+  other command ended by '&' in a copy of the shell.
+- After a Ctrl-C, nothing more runs until the command the shell loop started is over.
+- Return the status.
+*/
+int run_command(struct command *cmd)
+{
+  if (depth == 0)
+    interrupted = 0;
+  if (interrupted)
+    return last_status;
+  if (cmd->background && cmd->type != CMD_PIPELINE)
+  {
+    run_in_background(cmd);
+    return last_status;
+  }
+
+  depth++;
+  switch (cmd->type)
+  {
+  case CMD_PIPELINE:
+    last_status = run_pipeline(cmd->pipeline);
+    if (last_status == 128 + SIGINT)
+      interrupted = 1;
+    break;
+  case CMD_AND:
+    if (run_command(cmd->left) == 0)
+      run_command(cmd->right);
+    break;
+  case CMD_OR:
+    if (run_command(cmd->left) != 0)
+      run_command(cmd->right);
+    break;
+  case CMD_NOT:
+    last_status = !run_command(cmd->left);
+    break;
+  case CMD_IF:
+    if (run_sequence(cmd->cond) == 0)
+      run_sequence(cmd->body);
+    else if (cmd->otherwise != NULL)
+      run_sequence(cmd->otherwise);
+    else
+      last_status = 0;
+    break;
+  case CMD_WHILE:
+  case CMD_UNTIL:
+    run_loop(cmd);
+    break;
+  case CMD_FOR:
+    run_for(cmd);
+    break;
+  case CMD_CASE:
+    run_case(cmd);
+    break;
+  }
+  depth--;
+  return last_status;
+}
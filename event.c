@@ -0,0 +1,379 @@
+#include "header.h"
+#include <stdarg.h>
+#include <stdint.h>
+#ifdef __linux__
+#include <sys/epoll.h>
+#include <sys/signalfd.h>
+#include <sys/syscall.h>
+#endif
+#include <poll.h>
+
+/*
+ * Event loop between commands. SIGCHLD and SIGINT stay blocked in the shell and are
+ * read as events (a signalfd on Linux, a self-pipe elsewhere) next to stdin and a
+ * pidfd per background process. Children are reaped here, in normal context, and
+ * their notifications are collected and printed in one batch before the next prompt.
+ */
+
+#define MAX_EVENTS 64
+
+enum
+{
+  EV_INPUT,
+  EV_SIGNAL,
+  EV_PIDFD
+};
+
+static char *notify_buf; // batched job notifications
+static size_t notify_len, notify_cap;
+static int input_fd = -1, input_pollable;
+
+#ifdef __linux__
+static int epoll_fd = -1, signal_fd = -1;
+#else
+static int signal_pipe[2] = {-1, -1};
+#endif
+
+/*
+   Appends a formatted job notification to the batch printed by report_jobs().
+*/
+static void notify(const char *fmt, ...)
+{
+  va_list ap;
+  va_start(ap, fmt);
+  int len = vsnprintf(NULL, 0, fmt, ap);
+  va_end(ap);
+  if (len < 0)
+    return;
+
+  if (notify_len + len + 1 > notify_cap)
+  {
+    size_t cap = notify_cap ? notify_cap : 256;
+    while (cap < notify_len + len + 1)
+      cap *= 2;
+    char *grown = realloc(notify_buf, cap);
+    if (grown == NULL)
+      return;
+    notify_buf = grown;
+    notify_cap = cap;
+  }
+
+  va_start(ap, fmt);
+  vsnprintf(notify_buf + notify_len, notify_cap - notify_len, fmt, ap);
+  va_end(ap);
+  notify_len += len;
+}
+
+/*
+   Prints every notification collected since the last call with a single write.
+*/
+void report_jobs(void)
+{
+  if (notify_len == 0)
+    return;
+  fflush(stdout);
+  fwrite(notify_buf, 1, notify_len, stdout);
+  fflush(stdout);
+  notify_len = 0;
+}
+
+/*
+   Drops a child that exited or was killed: closes its pidfd, which also takes it
+   out of the event set, keeps its status for its job and its resource usage.
+*/
+void finish_process(int pid, int status, const struct rusage *ru)
+{
+  process_info *proc = find_process(pid);
+  if (proc == NULL)
+    return;
+  if (proc->pidfd >= 0)
+    close(proc->pidfd);
+  set_exit_status(pid, status);
+  account_process(pid, ru);
+  remove_process(pid);
+}
+
+/*
+- Record what happened to one child of the job table.
+- A stopped child stays in the table, marked stopped; an exited or killed one is
+  removed.
+*/
+static void reap_status(int pid, int status, struct rusage *ru)
+{
+  process_info *proc = find_process(pid);
+  if (proc == NULL)
+    return;
+
+  if (WIFSTOPPED(status))
+  {
+    set_stopped(pid, 1);
+    notify("\n%s with pid %d has stopped!\n", proc->name, proc->pid);
+    return;
+  }
+
+  struct job *job = find_job(proc->job_id);
+  if (job != NULL && job->parallel_slot >= 0)
+    parallel_reaped(job->parallel_slot, pid, status); // `parallel` reports its own jobs
+  else if (WIFEXITED(status)) /* returns true if the child terminated normally */
+    notify("\n%s with pid %d exited normally\n", proc->name, proc->pid);
+  else if (WIFSIGNALED(status)) /* returns true if the child process was terminated by a signal */
+    notify("\n%s with pid %d has exited with signal\n", proc->name, proc->pid);
+
+  finish_process(pid, status, ru);
+}
+
+/*
+   Reaps every child that has exited or stopped, without blocking,
+   keeping the resource usage of those that exited.
+*/
+void reap_children(void)
+{
+  int status, pid;
+  struct rusage ru;
+  while ((pid = wait4(-1, &status, WNOHANG | WUNTRACED, &ru)) > 0)
+    reap_status(pid, status, &ru);
+}
+
+/*
+   Watches a background process through a pidfd, so its exit wakes the event loop
+   directly. Without pidfd support the SIGCHLD event still covers it.
+*/
+void watch_process(int pid)
+{
+#if defined(__linux__) && defined(SYS_pidfd_open)
+  process_info *proc = find_process(pid);
+  if (proc == NULL || epoll_fd < 0)
+    return;
+
+  int fd = syscall(SYS_pidfd_open, pid, 0);
+  if (fd < 0)
+    return;
+
+  struct epoll_event ev;
+  ev.events = EPOLLIN;
+  ev.data.u64 = ((uint64_t)pid << 2) | EV_PIDFD;
+  if (epoll_ctl(epoll_fd, EPOLL_CTL_ADD, fd, &ev) < 0)
+  {
+    close(fd);
+    return;
+  }
+  fcntl(fd, F_SETFD, FD_CLOEXEC);
+  proc->pidfd = fd;
+#else
+  (void)pid;
+#endif
+}
+
+#ifndef __linux__
+/* Only forwards the signal number to the loop, which is async-signal-safe */
+static void forward_signal(int signum)
+{
+  char c = (char)signum;
+  int saved = errno;
+  write(signal_pipe[1], &c, 1);
+  errno = saved;
+}
+#endif
+
+/*
+- Block SIGCHLD and SIGINT and turn them into events:
+  a signalfd on Linux, a handler writing to a self-pipe elsewhere.
+*/
+void event_setup(void)
+{
+  sigset_t set;
+  sigemptyset(&set);
+  sigaddset(&set, SIGCHLD);
+  sigaddset(&set, SIGINT);
+
+#ifdef __linux__
+  // a blocked signal with the default action is queued for the signalfd instead of being dropped
+  signal(SIGINT, SIG_DFL);
+  sigprocmask(SIG_BLOCK, &set, NULL);
+
+  epoll_fd = epoll_create1(EPOLL_CLOEXEC);
+  signal_fd = signalfd(-1, &set, SFD_NONBLOCK | SFD_CLOEXEC);
+  if (epoll_fd < 0 || signal_fd < 0)
+  {
+    perror("event loop");
+    exit(EXIT_FAILURE);
+  }
+
+  struct epoll_event ev;
+  ev.events = EPOLLIN;
+  ev.data.u64 = EV_SIGNAL;
+  epoll_ctl(epoll_fd, EPOLL_CTL_ADD, signal_fd, &ev);
+#else
+  struct sigaction sa;
+
+  if (pipe(signal_pipe) < 0)
+  {
+    perror("event loop");
+    exit(EXIT_FAILURE);
+  }
+  for (int i = 0; i < 2; i++)
+  {
+    fcntl(signal_pipe[i], F_SETFL, O_NONBLOCK);
+    fcntl(signal_pipe[i], F_SETFD, FD_CLOEXEC);
+  }
+
+  memset(&sa, 0, sizeof(sa));
+  sa.sa_handler = forward_signal;
+  sa.sa_flags = SA_RESTART;
+  sigemptyset(&sa.sa_mask);
+  sigaction(SIGCHLD, &sa, NULL);
+  sigaction(SIGINT, &sa, NULL);
+#endif
+}
+
+/*
+   Watches the command input as well, when it can be polled (terminals and pipes,
+   not regular files or a -c string, which are always ready).
+*/
+void event_watch_input(int fd)
+{
+  input_fd = fd;
+  if (fd < 0)
+    return;
+#ifdef __linux__
+  struct epoll_event ev;
+  ev.events = EPOLLIN;
+  ev.data.u64 = EV_INPUT;
+  input_pollable = (epoll_ctl(epoll_fd, EPOLL_CTL_ADD, fd, &ev) == 0);
+#else
+  struct stat st;
+  input_pollable = (fstat(fd, &st) == 0 && !S_ISREG(st.st_mode));
+#endif
+}
+
+/*
+- Handle the pending signals: SIGCHLD reaps children, SIGINT at the prompt
+  starts a fresh prompt line. Return 1 if SIGINT was seen.
+*/
+static int handle_signals(void)
+{
+  int interrupted = 0, child = 0;
+#ifdef __linux__
+  struct signalfd_siginfo info[16];
+  ssize_t n;
+  while ((n = read(signal_fd, info, sizeof(info))) > 0)
+    for (size_t i = 0; i < (size_t)n / sizeof(info[0]); i++)
+    {
+      if (info[i].ssi_signo == SIGINT)
+        interrupted = 1;
+      else
+        child = 1;
+    }
+#else
+  char sigs[64];
+  ssize_t n;
+  while ((n = read(signal_pipe[0], sigs, sizeof(sigs))) > 0)
+    for (ssize_t i = 0; i < n; i++)
+    {
+      if (sigs[i] == SIGINT)
+        interrupted = 1;
+      else
+        child = 1;
+    }
+#endif
+  if (child)
+    reap_children();
+  return interrupted;
+}
+
+/*
+- Wait up to timeout_ms (-1 forever, 0 just poll) and handle one batch of events.
+- Return 1 if the command input became readable, 2 if SIGINT arrived, 0 otherwise.
+*/
+int process_events(int timeout_ms)
+{
+  int ready = 0;
+#ifdef __linux__
+  struct epoll_event events[MAX_EVENTS];
+  int n = epoll_wait(epoll_fd, events, MAX_EVENTS, timeout_ms);
+
+  for (int i = 0; i < n; i++)
+  {
+    uint64_t data = events[i].data.u64;
+    if ((data & 3) == EV_INPUT)
+      ready = 1;
+    else if ((data & 3) == EV_SIGNAL)
+    {
+      if (handle_signals())
+        ready = 2;
+    }
+    else
+    {
+      int status, pid = (int)(data >> 2);
+      struct rusage ru;
+      if (wait4(pid, &status, WNOHANG, &ru) > 0)
+        reap_status(pid, status, &ru);
+    }
+  }
+#else
+  struct pollfd fds[2] = {{signal_pipe[0], POLLIN, 0}, {input_fd, POLLIN, 0}};
+  int n = poll(fds, input_pollable ? 2 : 1, timeout_ms);
+
+  if (n > 0 && (fds[0].revents & POLLIN) && handle_signals())
+    ready = 2;
+  if (n > 0 && input_pollable && fds[1].revents)
+    ready = ready ? ready : 1;
+#endif
+  report_jobs();
+  return ready;
+}
+
+/*
+   A Ctrl-C not handled yet, left pending for the event loop. Lets work the shell
+   does itself, such as a copy or a loop, stop early.
+*/
+int interrupt_pending(void)
+{
+  sigset_t set;
+  sigpending(&set);
+  return sigismember(&set, SIGINT);
+}
+
+/*
+- Block until a child exits or stops, or SIGINT arrives, and reap what is ready.
+- Used while the shell itself waits on children, as `parallel` does.
+- Return 1 if SIGINT arrived.
+*/
+int wait_child_event(void)
+{
+#ifdef __linux__
+  struct pollfd pfd = {signal_fd, POLLIN, 0};
+#else
+  struct pollfd pfd = {signal_pipe[0], POLLIN, 0};
+#endif
+  while (poll(&pfd, 1, -1) < 0 && errno == EINTR)
+    ;
+  int interrupted = handle_signals();
+  report_jobs();
+  return interrupted;
+}
+
+/*
+- Block until a command line can be read, handling child exits meanwhile.
+- Input already sitting in the line buffer, or input that cannot be polled,
+  only gets a non-blocking pass over pending events.
+- Ctrl-C at the prompt prints a fresh prompt; it ends a non-interactive shell.
+*/
+void wait_for_input(void)
+{
+  int block = !input_buffered() && input_pollable && input_source_fd() >= 0;
+
+  while (1)
+  {
+    int ready = process_events(block ? -1 : 0);
+    if (ready == 2 && !interactive)
+      exit(128 + SIGINT);
+    if (ready == 2)
+    {
+      printf("\n%s ", prompt);
+      fflush(stdout);
+    }
+    if (ready == 1 || !block)
+      return;
+  }
+}
@@ -1,281 +1,332 @@
 #include "header.h"
 
 /*
-- Forks a child process to execute a command using execvp.
-- In the child process, sets process group ID, handles I/O redirection, and restores default signal handlers.
+- Starts a child process for the command through launch_process (posix_spawn or fork).
+- The child gets its own process group, I/O redirection, and default signal handlers.
 - For foreground processes, the parent waits for completion and manages terminal control.
 - For background processes, the parent continues execution and adds the process to the job list.
+- Return the exit code of a foreground command, 0 for a background one.
 */
-int execute_command(char **cmd_tokens)
+int execute_command(char **cmd_tokens, struct redirect *redirects, int background)
 {
-  pid_t pid;
-  pid = fork();
+  struct launch spec = {.argv = cmd_tokens, .redirects = redirects, .pgid = 0,
+                        .in_fd = -1, .out_fd = -1, .close_fd = -1, .foreground = background == 0};
+  pid_t pid = launch_process(&spec);
   if (pid < 0)
-  {
-    perror("Child Process not created\n");
     return -1;
-  }
-  else if (pid == 0)
-  {
-    int fin, fout;
-    setpgid(pid, pid); // Set the process group id to the process id
 
-    if (input_redi) // Handle input redirect
-    {
-      fin = open_input_file();
-      if (fin == -1)
-        _exit(-1);
-    }
+  char *name = cmd_tokens[0] ? cmd_tokens[0] : "";
 
-    if (output_redi) // Handle output redirect
-    {
-      fout = open_output_file();
-      if (fout == -1)
-        _exit(-1);
-    }
+  // the job is shown by its whole command line, the process by its program
+  size_t len = 1;
+  for (int i = 0; cmd_tokens[i] != NULL; i++)
+    len += strlen(cmd_tokens[i]) + 1;
+  char *line = arena_alloc(&line_arena, len), *end = line;
+  *end = '\0';
+  for (int i = 0; cmd_tokens[i] != NULL; i++)
+    end += sprintf(end, i ? " %s" : "%s", cmd_tokens[i]);
 
-    // Assign terminal control to process if it's not running in the background
-    if (is_background == 0)
-      tcsetpgrp(shell, getpid());
-
-    // Restore default signal handlers in the child process
-    signal(SIGINT, SIG_DFL);
-    signal(SIGQUIT, SIG_DFL);
-    signal(SIGTSTP, SIG_DFL);
-    signal(SIGTTIN, SIG_DFL);
-    signal(SIGTTOU, SIG_DFL);
-    signal(SIGCHLD, SIG_DFL);
-
-    // Execute command
-    int ret;
-    if ((ret = execvp(cmd_tokens[0], cmd_tokens)) < 0)
-    {
-      perror("Error executing command!\n");
-      _exit(-1);
-    }
-    _exit(0);
-  }
+  int job_id = add_job(line);
+  add_process(pid, job_id, name); // Add proc. to the job table
 
-  if (is_background == 0)
+  if (background == 0)
+    return wait_foreground(find_job(job_id)); // gives it the terminal while it runs
+  else
   {
-    // Assign terminal control to the child process
-    tcsetpgrp(shell, pid);
-    add_process(pid, cmd_tokens[0]);
+    struct job *job = find_job(job_id);
+    set_job_background(job, 1);
+    printf("\n[%d] %d\n", number_job(job), pid); // Print job information of background processes
+    watch_process(pid);
+    return 0;
+  }
+}
 
-    int status;
-    fgpid = pid;
-    waitpid(pid, &status, WUNTRACED); // Wait for this process
+int pipe_size; // capacity given to the pipes the shell creates, 0 for the system's default
 
-    // if the process was stopped by a signal
-    if (!WIFSTOPPED(status))
-      remove_process(pid);
+/*
+- Parse a pipe size: bytes, or with a K, M or G suffix; "default" or 0 for the
+  system's default.
+- Clamp it to /proc/sys/fs/pipe-max-size, the most an unprivileged process may ask for.
+- Return the size, or -1 if value is not one.
+*/
+static int parse_pipe_size(const char *value)
+{
+  if (strcmp(value, "default") == 0)
+    return 0;
 
-    else
-      fprintf(stderr, "\n%s with pid %d has stopped!\n", cmd_tokens[0], pid);
+  char *end;
+  long long size = strtoll(value, &end, 10);
+  if (end == value || size < 0)
+    return -1;
+  if (*end == 'k' || *end == 'K')
+    size <<= 10, end++;
+  else if (*end == 'm' || *end == 'M')
+    size <<= 20, end++;
+  else if (*end == 'g' || *end == 'G')
+    size <<= 30, end++;
+  if (*end != '\0')
+    return -1;
 
-    // Return terminal control to the shell
-    tcsetpgrp(shell, my_pgid);
-    return 0;
-  }
-  else
+  long long max = INT_MAX;
+  FILE *f = fopen("/proc/sys/fs/pipe-max-size", "r");
+  if (f != NULL)
   {
-    printf("\n[%d] %d\n", job_num, pid); // Print job information of background processes
-    add_process(pid, cmd_tokens[0]);     // Add proc. to the process list
-    return 0;
+    if (fscanf(f, "%lld", &max) != 1)
+      max = INT_MAX;
+    fclose(f);
   }
+  return size > max ? (int)max : (int)size;
 }
 
 /*
-Adds a process to the job table with its pid, name, and marks it as active.
+   Parses the value of `set pipesize=...`. Returns 0 on success, -1 for a bad size.
 */
-void add_process(int pid, char *name)
+int set_pipe_size(const char *value)
 {
-  table[job_num].pid = pid;
-  table[job_num].name = strdup(name);
-  table[job_num].active = 1;
-  job_num++;
+  int size = parse_pipe_size(value);
+  if (size < 0)
+    return -1;
+  pipe_size = size;
+  return 0;
 }
 
 /*
-Deactivates a process in the job table by setting its active status to 0 using its pid.
+- Create a pipe with close-on-exec ends for a pipeline, given pipe_size bytes when set.
+- A size the system refuses leaves the default; return -1 only if there is no pipe.
 */
-void remove_process(int pid)
+int make_pipe(int fds[2])
 {
-  int i;
-  for (i = 0; i < job_num; i++)
-  {
-    if (table[i].pid == pid)
-    {
-      table[i].active = 0;
-      break;
-    }
-  }
+  if (pipe(fds) < 0)
+    return -1;
+  fcntl(fds[0], F_SETFD, FD_CLOEXEC);
+  fcntl(fds[1], F_SETFD, FD_CLOEXEC);
+#ifdef F_SETPIPE_SZ
+  if (pipe_size > 0)
+    fcntl(fds[1], F_SETPIPE_SZ, pipe_size);
+#endif
+  return 0;
 }
 
 /*
-- Process tokens to identify and execute commands.
-- Handle built-in commands like history, cd, pwd, prompt, and exit.
-- Execute commands by prefix or in the background if specified.
-- Free command tokens after execution.
+- Run one parsed pipeline: a single command directly, several through pipes.
+- A leading `time` keyword times the whole pipeline, `profile` also measures the
+  flow between its stages.
+- A leading `pipesize=SIZE` sets the size of its pipes, as `set pipesize=` does for all.
+- Return its exit status, 0 if it was started in the background.
 */
-void handle_normal_command(int tokens, char **cmd_tokens)
+int run_pipeline(struct pipeline *pl)
 {
-  if (tokens > 0)
+  struct simple_command *first = &pl->cmds[0];
+  if (first->argc > 0 && strncmp(first->argv[0], "pipesize=", 9) == 0)
   {
-    if (strcmp(cmd_tokens[0], "history\0") == 0)
-      print_history();
-    else if (cmd_tokens[0][0] == '!')
+    int size = parse_pipe_size(first->argv[0] + 9);
+    if (size < 0)
     {
-      char *prefix = cmd_tokens[0] + 1;
-      char *found_cmd = find_command_by_prefix(prefix);
-      if (found_cmd)
-      {
-        int j;
-        char **cmd_tokens = malloc((sizeof(char) * MAX_BUF_LEN) * MAX_BUF_LEN);
-
-        for (j = 0; j < MAX_BUF_LEN; j++)
-          cmd_tokens[j] = NULL;
-
-        parse_command(strdup(found_cmd), cmd_tokens);
-        execute_command(cmd_tokens);
-      }
+      fprintf(stderr, "pipesize: invalid size: %s\n", first->argv[0] + 9);
+      return 2;
     }
-    else if (strcmp(cmd_tokens[tokens - 1], "&\0") == 0)
+    first->argc--;
+    first->argv++;
+    int status = 0;
+    if (first->argc > 0 || pl->num_cmds > 1 || first->redirects != NULL)
     {
-      cmd_tokens[tokens - 1] = NULL;
-      is_background = 1;
-      execute_command(cmd_tokens); // for running background process
+      int saved = pipe_size;
+      pipe_size = size;
+      status = run_pipeline(pl);
+      pipe_size = saved;
     }
-    else if (strcmp(cmd_tokens[0], "cd\0") == 0)
-      cd(cmd_tokens, cwd, base_dir);
-    else if (strcmp(cmd_tokens[0], "pwd\0") == 0)
-      pwd(cmd_tokens);
-    else if (strcmp(cmd_tokens[0], "prompt\0") == 0)
-      change_prompt(cmd_tokens[1]);
-    else if (strcmp(cmd_tokens[0], "exit\0") == 0)
-      _exit(0);
-    else
-      execute_command(cmd_tokens);
+    first->argc++; // a loop runs the pipeline again
+    first->argv--;
+    return status;
   }
-  free(cmd_tokens);
+  else if (first->argc > 0 && (strcmp(first->argv[0], "time") == 0 || strcmp(first->argv[0], "profile") == 0))
+    return time_pipeline(pl);
+  else if (pl->num_cmds == 1)
+    return handle_normal_command(&pl->cmds[0], pl->background);
+  else
+    return handle_piping_and_redirect(pl);
+}
+
+/* The status of a command that could not be started is 127, as for one not found */
+static int launch_status(int code)
+{
+  return code < 0 ? 127 : code;
 }
 
 /*
-- Parse the command for piping and set up necessary pipes.
-- Fork processes for each command segment, setting process group IDs.
-- Restore default signals in child processes.
-- Handle input/output redirection and pipe connections.
-- Execute each command segment with execvp.
-- Close all pipe file descriptors after use.
-- Wait for foreground processes to complete and manage terminal control.
+- Run a command from its expanded words.
+- Run builtins in the shell, found through find_builtin(); in the background they
+  run as external commands.
+- Execute commands by prefix or in the background if specified.
+- Return the exit status, 0 for a command started in the background.
 */
-void handle_piping_and_redirect(char *cmd)
+static int run_words(char **cmd_tokens, int tokens, struct redirect *redirects, int background)
 {
-  pipe_num = 0;
-  int pid, pgid, fin, fout;
-  int i, status;
-
-  parse_for_piping(cmd);
-
-  size_t num_pipes = (size_t)(2 * (pipe_num - 1));
+  const struct builtin *b;
 
-  int *pipes = (int *)malloc(sizeof(int) * num_pipes);
-
-  // Create the necessary pipes for inter-process communication
-  for (i = 0; i < 2 * pipe_num - 3; i += 2) // pipes creataion
+  if (tokens == 0)
+    return launch_status(execute_command(cmd_tokens, redirects, background)); // only redirections
+  else if (cmd_tokens[0][0] == '!')
   {
-    if (pipe(pipes + i) < 0)
+    char *prefix = cmd_tokens[0] + 1;
+    char *found_cmd = find_command_by_prefix(prefix);
+
+    // re-run the found command through the parser; never recall another recall
+    if (found_cmd && found_cmd[0] != '!')
     {
-      perror("Pipe not opened!\n");
-      return;
+      struct sequence *seq = parse_line(found_cmd);
+      return seq != NULL ? run_sequence(seq) : 2;
     }
+    return 1;
   }
+  else if (background)
+    return launch_status(execute_command(cmd_tokens, redirects, background)); // for running background process
+  else if ((b = find_builtin(cmd_tokens[0])) != NULL)
+    return run_builtin(b, cmd_tokens, redirects);
+  else
+    return launch_status(execute_command(cmd_tokens, redirects, background));
+}
 
-  for (i = 0; i < pipe_num; i++)
+/*
+- Expand the command's words into tokens and run it with run_words().
+- Leading assignments NAME=value set shell variables when they are the whole
+  command, else they are exported to the command for its run only. The words
+  are expanded before, as in sh: `X=1 echo $X` prints the X from before.
+- Command tokens live in the line arena and are released with it.
+- Return the exit status, 0 for a command started in the background.
+*/
+int handle_normal_command(struct simple_command *cmd, int background)
+{
+  int assignments = count_assignments(cmd);
+  struct simple_command rest = {cmd->argc - assignments, cmd->argv + assignments, cmd->redirects};
+  int tokens;
+  char **cmd_tokens = expand_words(&rest, &tokens);
+  if (interrupted)
+    return last_status; // Ctrl-C in a command substitution
+
+  if (assignments == 0)
+    return run_words(cmd_tokens, tokens, cmd->redirects, background);
+  if (rest.argc == 0)
   {
-    char **cmd_tokens = malloc((sizeof(char) * MAX_BUF_LEN) * MAX_BUF_LEN); // Allocate memory for command tokens
+    // the status is that of the last command substitution in the values, as in x=$(cmd)
+    substitution_status = -1;
+    assign_words(cmd->argv, assignments, NULL);
+    if (cmd->redirects != NULL)
+      return run_words(cmd_tokens, 0, cmd->redirects, background);
+    return substitution_status < 0 ? 0 : substitution_status;
+  }
 
-    parse_for_redirect(strdup(pipe_cmds[i]), cmd_tokens);
-    // int tokens = parse_for_redirect(strdup(pipe_cmds[i]), cmd_tokens);
+  struct saved_variable *saved;
+  assign_words(cmd->argv, assignments, &saved);
+  int status = run_words(cmd_tokens, tokens, cmd->redirects, background);
+  restore_assignments(saved);
+  return status;
+}
 
-    is_background = 0;
-    pid = fork();
-    if (i < pipe_num - 1)
-      add_process(pid, cmd_tokens[0]); // Add the process to the process list
+/*
+- Launch a process for each command of the pipeline, all in the group of the first one,
+  without waiting for them.
+- Create each pipe just before the stage that writes it, so the shell only ever
+  holds the read end feeding the next stage.
+- in_fd feeds the first stage and out_fd takes the output of the last one, -1 to
+  inherit the shell's; both stay open in the shell.
+- The child connects pipe ends first, then applies the stage's own redirections so they take priority.
+- Store the pids of the processes started in pids (room for every stage) and the job id in *job_id.
+- Return the number of processes started; a stage that fails to start is skipped.
+*/
+int launch_pipeline(struct pipeline *pl, int in_fd, int out_fd, pid_t *pids, int *job_id)
+{
+  int pid, pgid = 0;
+  int prev_read = in_fd, fds[2];
+  int num_cmds = pl->num_cmds;
+  int started = 0;
 
-    if (pid != 0)
+  for (int i = 0; i < num_cmds; i++)
+  {
+    // a stage's own assignments are in the environment of its process only
+    struct simple_command stage = pl->cmds[i];
+    struct saved_variable *saved = NULL;
+    int assignments = count_assignments(&stage);
+    stage.argc -= assignments;
+    stage.argv += assignments;
+
+    int tokens;
+    char **cmd_tokens = expand_words(&stage, &tokens);
+    if (interrupted)
+      break; // Ctrl-C in a command substitution
+    if (assignments > 0)
+      assign_words(pl->cmds[i].argv, assignments, &saved);
+    int last = (i == num_cmds - 1);
+
+    if (!last && make_pipe(fds) < 0)
     {
-      if (i == 0)
-        pgid = pid;
-      setpgid(pid, pgid); // Assign the process group ID to the current process
+      perror("Pipe not opened!\n");
+      if (saved != NULL)
+        restore_assignments(saved);
+      break;
     }
-    if (pid < 0)
+
+    struct launch spec = {.argv = cmd_tokens, .redirects = pl->cmds[i].redirects, .pgid = pgid,
+                          .in_fd = prev_read, .out_fd = last ? out_fd : fds[1], .close_fd = last ? -1 : fds[0],
+                          .foreground = pgid == 0 && !pl->background};
+    pid = launch_process(&spec);
+    if (saved != NULL)
+      restore_assignments(saved);
+
+    if (prev_read >= 0 && prev_read != in_fd)
+      close(prev_read);
+    prev_read = -1;
+    if (!last)
     {
-      perror("Fork Error!\n");
+      close(fds[1]);
+      prev_read = profiling ? start_relay(fds[0], i) : fds[0];
     }
-    else if (pid == 0)
+
+    if (pid < 0)
+      continue; // the stage failed to start, the rest of the pipeline still runs
+
+    if (pgid == 0)
     {
-      // Restore default signals in child process
-      signal(SIGINT, SIG_DFL);
-      signal(SIGQUIT, SIG_DFL);
-      signal(SIGTSTP, SIG_DFL);
-      signal(SIGTTIN, SIG_DFL);
-      signal(SIGTTOU, SIG_DFL);
-      signal(SIGCHLD, SIG_DFL);
-
-      // output redirection or pipe output
-      if (output_redi)
-      {
-        fout = open_output_file();
-        printf("fout %d\n", fout);
-      }
-      else if (i < pipe_num - 1)
-        dup2(pipes[2 * i + 1], 1);
-
-      // input redirection or pipe input
-      if (input_redi)
-      {
-        fin = open_input_file();
-        printf("fin %d\n", fin);
-      }
-
-      else if (i > 0)
-        dup2(pipes[2 * i - 2], 0);
-
-      // Close all pipe file descriptors in child process
-      int j;
-      for (j = 0; j < 2 * pipe_num - 2; j++)
-        close(pipes[j]);
-
-      // Execute command
-      if (execvp(cmd_tokens[0], cmd_tokens) < 0)
-      {
-        perror("Execvp error!\n");
-        _exit(-1);
-      }
+      pgid = pid;
+      *job_id = add_job(pl->text); // the job exists once its first process does
     }
+    add_process(pid, *job_id, tokens ? cmd_tokens[0] : ""); // Add the process to the job table
+    pids[started++] = pid;
   }
 
-  // Close all pipe file descriptors in the parent process
-  for (i = 0; i < 2 * pipe_num - 2; i++)
-    close(pipes[i]);
-
-  if (is_background == 0)
-  {
-    // Assign terminal to the process group
-    tcsetpgrp(shell, pgid);
-
-    for (i = 0; i < pipe_num; i++)
-    {
+  if (prev_read >= 0 && prev_read != in_fd)
+    close(prev_read);
+  return started;
+}
 
-      // Wait for each process in the pipeline
-      int cpid = waitpid(-pgid, &status, WUNTRACED);
+/*
+- Run a pipeline of several commands through launch_pipeline().
+- In the foreground, a first stage that only copies files into the pipeline is done
+  by the shell itself, without a process (see cat.c), unless it is being profiled.
+- Wait for foreground pipelines to complete and manage terminal control.
+- Return the exit status of the last stage, 0 for a background pipeline.
+*/
+int handle_piping_and_redirect(struct pipeline *pl)
+{
+  int i, job_id = 0;
+  pid_t *pids = arena_alloc(&line_arena, sizeof(pid_t) * pl->num_cmds);
+  int started = (pl->background || profiling) ? -1 : launch_fed_pipeline(pl, pids, &job_id);
+  if (started < 0)
+    started = launch_pipeline(pl, -1, -1, pids, &job_id);
 
-      if (!WIFSTOPPED(status))
-        remove_process(cpid);
-    }
+  if (started == 0)
+    return 127;
 
-    // Return control back to shell
-    tcsetpgrp(shell, my_pgid);
+  if (pl->background)
+  {
+    struct job *job = find_job(job_id);
+    set_job_background(job, 1);
+    printf("\n[%d] %d\n", number_job(job), pids[0]); // Print job information of background pipelines
+    for (i = 0; i < started; i++)
+      watch_process(pids[i]);
+    return 0;
   }
+
+  // Wait for every process with the terminal given to the pipeline's group
+  return wait_foreground(find_job(job_id));
 }
@@ -0,0 +1,665 @@
+#include "header.h"
+#include <dirent.h>
+#include <pwd.h>
+#ifdef __linux__
+#include <sys/inotify.h>
+#endif
+
+/*
+ * Wildcard expansion against cached directory listings. The first expansion in a
+ * directory reads it once with readdir(); later ones match the remembered, sorted
+ * names in-process, so `ls *.log` in a loop over a large directory costs no system
+ * call beyond draining the change queue. A listing is dropped when the directory
+ * changes: on Linux each cached directory has an inotify watch whose events are
+ * drained before every expansion, elsewhere (or when a watch cannot be added) the
+ * directory's mtime and inode are compared on every use.
+ *
+ * Patterns are split at '/' and each component with a wildcard is compiled once
+ * into a small matcher supporting '*', '?', '[...]' and '\' escapes. Results follow
+ * glob(): names starting with '.' need a '.' in the pattern, a leading ~ or ~user
+ * is expanded, and the matches are sorted.
+ */
+
+struct dir_entry
+{
+  char *name;
+  unsigned char is_dir;
+};
+
+struct dir_listing
+{
+  char *path;               // absolute path, the cache key
+  struct dir_entry *entries; // sorted by name
+  char *names;              // one block holding every name
+  int count;
+  int wd;                   // inotify watch, -1 when checked by mtime
+  dev_t dev;
+  ino_t ino;
+  struct timespec mtime;
+  int valid;
+};
+
+static struct dir_listing **listings;
+static int num_listings, listings_capacity;
+static int *listing_index; // open addressing on the path hash, -1 empty
+static size_t index_capacity;
+static int inotify_fd = -2; // -2 until first use, -1 if unavailable
+
+/* ---------------------------------------------------------------- matcher */
+
+enum match_op
+{
+  OP_CHAR,  // one literal byte
+  OP_ANY,   // ?
+  OP_STAR,  // *
+  OP_CLASS  // [...]
+};
+
+struct match_step
+{
+  enum match_op op;
+  unsigned char c;
+  unsigned char set[32]; // bitmap of the bytes a class accepts
+};
+
+struct glob_pattern
+{
+  struct match_step *steps;
+  int num_steps;
+  int dot_ok; // the pattern itself starts with '.', so hidden names may match
+};
+
+static int has_wildcard(const char *s, size_t len)
+{
+  for (size_t i = 0; i < len; i++)
+  {
+    if (s[i] == '\\' && i + 1 < len)
+      i++;
+    else if (s[i] == '*' || s[i] == '?' || s[i] == '[')
+      return 1;
+  }
+  return 0;
+}
+
+/*
+- Compile one path component into match steps, in the line arena.
+- A '[' without a closing ']' is an ordinary character, as in glob().
+*/
+struct glob_pattern *glob_compile(const char *s, size_t len)
+{
+  struct glob_pattern *pat = arena_alloc(&line_arena, sizeof(struct glob_pattern));
+  pat->steps = arena_alloc(&line_arena, sizeof(struct match_step) * (len + 1));
+  pat->num_steps = 0;
+  pat->dot_ok = (len > 0 && s[0] == '.');
+
+  for (size_t i = 0; i < len; i++)
+  {
+    struct match_step *step = &pat->steps[pat->num_steps];
+    step->op = OP_CHAR;
+    step->c = (unsigned char)s[i];
+
+    if (s[i] == '*')
+    {
+      if (pat->num_steps > 0 && pat->steps[pat->num_steps - 1].op == OP_STAR)
+        continue; // ** within a component is the same as *
+      step->op = OP_STAR;
+    }
+    else if (s[i] == '?')
+      step->op = OP_ANY;
+    else if (s[i] == '\\' && i + 1 < len)
+      step->c = (unsigned char)s[++i];
+    else if (s[i] == '[')
+    {
+      size_t j = i + 1;
+      int negate = (j < len && (s[j] == '!' || s[j] == '^'));
+      if (negate)
+        j++;
+      size_t first = j;
+      while (j < len && (s[j] != ']' || j == first))
+        j++;
+      if (j < len)
+      {
+        memset(step->set, 0, sizeof(step->set));
+        for (size_t k = first; k < j; k++)
+        {
+          unsigned char lo = (unsigned char)s[k], hi = lo;
+          if (k + 2 < j && s[k + 1] == '-')
+          {
+            hi = (unsigned char)s[k + 2];
+            k += 2;
+          }
+          for (int c = lo; c <= hi; c++)
+            step->set[c >> 3] |= 1 << (c & 7);
+        }
+        if (negate)
+          for (int b = 0; b < 32; b++)
+            step->set[b] = ~step->set[b];
+        step->op = OP_CLASS;
+        i = j;
+      }
+    }
+    pat->num_steps++;
+  }
+  return pat;
+}
+
+/*
+   Compiles a whole string as one pattern, for `case`: a leading '.' needs no
+   explicit match and '/' is an ordinary character.
+*/
+struct glob_pattern *glob_compile_string(const char *s)
+{
+  struct glob_pattern *pat = glob_compile(s, strlen(s));
+  pat->dot_ok = 1;
+  return pat;
+}
+
+static int step_matches(const struct match_step *step, unsigned char c)
+{
+  switch (step->op)
+  {
+  case OP_CHAR:
+    return step->c == c;
+  case OP_CLASS:
+    return step->set[c >> 3] & (1 << (c & 7));
+  default:
+    return 1;
+  }
+}
+
+/*
+   Matches a name against a compiled component. On a mismatch after a '*', the
+   '*' takes one more byte and matching resumes there, so no state is saved
+   beyond the last star. Only reads the pattern, so walker threads share it.
+*/
+int glob_match(const struct glob_pattern *pat, const char *name)
+{
+  if (name[0] == '.' && !pat->dot_ok)
+    return 0;
+
+  int s = 0, star = -1;
+  const char *n = name, *star_name = NULL;
+  while (*n)
+  {
+    if (s < pat->num_steps && pat->steps[s].op == OP_STAR)
+    {
+      star = s++;
+      star_name = n;
+    }
+    else if (s < pat->num_steps && step_matches(&pat->steps[s], (unsigned char)*n))
+    {
+      s++;
+      n++;
+    }
+    else if (star >= 0)
+    {
+      s = star + 1;
+      n = ++star_name;
+    }
+    else
+      return 0;
+  }
+  while (s < pat->num_steps && pat->steps[s].op == OP_STAR)
+    s++;
+  return s == pat->num_steps;
+}
+
+/* ---------------------------------------------------------------- listings */
+
+static void free_listing(struct dir_listing *l)
+{
+  free(l->entries);
+  free(l->names);
+  free(l->path);
+  free(l);
+}
+
+/*
+   Forgets every listing and its watch, when the cache is full.
+*/
+static void clear_listings(void)
+{
+  for (int i = 0; i < num_listings; i++)
+  {
+#ifdef __linux__
+    if (listings[i]->wd >= 0)
+      inotify_rm_watch(inotify_fd, listings[i]->wd);
+#endif
+    free_listing(listings[i]);
+  }
+  num_listings = 0;
+  for (size_t i = 0; i < index_capacity; i++)
+    listing_index[i] = -1;
+}
+
+/*
+   Drops listings whose directories changed, from the queued inotify events.
+   Events come in runs for one directory, so only a change of watch is looked up.
+*/
+static void drain_changes(void)
+{
+#ifdef __linux__
+  if (inotify_fd == -2)
+    inotify_fd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+  if (inotify_fd < 0)
+    return;
+
+  char buf[16384] __attribute__((aligned(__alignof__(struct inotify_event))));
+  ssize_t n;
+  int last_wd = -1;
+  while ((n = read(inotify_fd, buf, sizeof(buf))) > 0)
+    for (char *p = buf; p < buf + n;)
+    {
+      struct inotify_event *ev = (struct inotify_event *)p;
+      p += sizeof(struct inotify_event) + ev->len;
+      if (ev->wd == last_wd && !(ev->mask & IN_Q_OVERFLOW))
+        continue;
+      last_wd = ev->wd;
+      for (int i = 0; i < num_listings; i++)
+        if ((ev->mask & IN_Q_OVERFLOW) || listings[i]->wd == ev->wd)
+          listings[i]->valid = 0;
+    }
+#else
+  inotify_fd = -1;
+#endif
+}
+
+static int compare_entries(const void *a, const void *b)
+{
+  return strcmp(((const struct dir_entry *)a)->name, ((const struct dir_entry *)b)->name);
+}
+
+static struct timespec stat_mtime(const struct stat *st)
+{
+#ifdef __APPLE__
+  return st->st_mtimespec;
+#else
+  return st->st_mtim;
+#endif
+}
+
+/*
+- Read a directory into a listing: names sorted, and which of them are directories
+  (following symbolic links, as glob() does). Any earlier names are replaced.
+- The directory is watched with inotify before it is read, so no change made while
+  reading is missed; a directory replaced by another gets its watch moved.
+- Return -1 if it cannot be read.
+*/
+static int load_listing(struct dir_listing *l)
+{
+  struct stat st;
+  DIR *dir = opendir(l->path);
+  if (dir == NULL)
+    return -1;
+  if (fstat(dirfd(dir), &st) < 0)
+  {
+    closedir(dir);
+    return -1;
+  }
+
+#ifdef __linux__
+  if (inotify_fd >= 0 && (l->wd < 0 || st.st_dev != l->dev || st.st_ino != l->ino))
+  {
+    if (l->wd >= 0)
+      inotify_rm_watch(inotify_fd, l->wd);
+    l->wd = inotify_add_watch(inotify_fd, l->path, IN_CREATE | IN_DELETE | IN_MOVED_FROM | IN_MOVED_TO |
+                                                       IN_DELETE_SELF | IN_MOVE_SELF | IN_ONLYDIR);
+  }
+#endif
+  l->dev = st.st_dev;
+  l->ino = st.st_ino;
+  l->mtime = stat_mtime(&st);
+
+  int capacity = 64, count = 0;
+  size_t names_len = 0, names_cap = 4096;
+  size_t *offsets = malloc(sizeof(size_t) * capacity);
+  unsigned char *types = malloc(capacity);
+  char *names = malloc(names_cap);
+
+  struct dirent *ent;
+  while ((ent = readdir(dir)) != NULL)
+  {
+    if (strcmp(ent->d_name, ".") == 0 || strcmp(ent->d_name, "..") == 0)
+      continue;
+    size_t len = strlen(ent->d_name) + 1;
+    if (count == capacity)
+    {
+      capacity *= 2;
+      offsets = realloc(offsets, sizeof(size_t) * capacity);
+      types = realloc(types, capacity);
+    }
+    if (names_len + len > names_cap)
+    {
+      while (names_len + len > names_cap)
+        names_cap *= 2;
+      names = realloc(names, names_cap);
+    }
+    memcpy(names + names_len, ent->d_name, len);
+    offsets[count] = names_len;
+    types[count++] = ent->d_type;
+    names_len += len;
+  }
+
+  // the name block has stopped moving: point the entries into it, then sort them
+  struct dir_entry *entries = malloc(sizeof(struct dir_entry) * (count ? count : 1));
+  for (int i = 0; i < count; i++)
+  {
+    struct dir_entry *e = &entries[i];
+    e->name = names + offsets[i];
+    e->is_dir = types[i] == DT_DIR;
+    if (types[i] == DT_UNKNOWN || types[i] == DT_LNK)
+    {
+      struct stat entry_st;
+      e->is_dir = fstatat(dirfd(dir), e->name, &entry_st, 0) == 0 && S_ISDIR(entry_st.st_mode);
+    }
+  }
+  qsort(entries, count, sizeof(struct dir_entry), compare_entries);
+
+  free(offsets);
+  free(types);
+  closedir(dir);
+  free(l->entries);
+  free(l->names);
+  l->entries = entries;
+  l->names = names;
+  l->count = count;
+  l->valid = 1;
+  return 0;
+}
+
+static size_t hash_path(const char *path)
+{
+  size_t h = 2166136261u; // FNV-1a
+  for (; *path; path++)
+    h = (h ^ (unsigned char)*path) * 16777619u;
+  return h;
+}
+
+/* The index bucket of path: its listing's slot, or an empty bucket */
+static size_t find_bucket(const char *path)
+{
+  size_t i = hash_path(path) & (index_capacity - 1);
+  while (listing_index[i] >= 0 && strcmp(listings[listing_index[i]]->path, path) != 0)
+    i = (i + 1) & (index_capacity - 1);
+  return i;
+}
+
+/*
+- Return the listing of a directory, from the cache when it is still current.
+- Without an inotify watch, a listing is current while the directory's inode and mtime are unchanged.
+- The cache is emptied once it holds GLOB_CACHE_MAX directories.
+- Return NULL if the directory cannot be read.
+*/
+static struct dir_listing *get_listing(const char *path)
+{
+  if (index_capacity == 0)
+  {
+    index_capacity = 2 * GLOB_CACHE_MAX;
+    listing_index = malloc(sizeof(int) * index_capacity);
+    for (size_t i = 0; i < index_capacity; i++)
+      listing_index[i] = -1;
+  }
+
+  size_t bucket = find_bucket(path);
+  int slot = listing_index[bucket];
+  if (slot >= 0)
+  {
+    struct dir_listing *l = listings[slot];
+    if (l->valid && l->wd < 0)
+    {
+      struct stat st;
+      struct timespec mtime;
+      if (stat(path, &st) < 0)
+        l->valid = 0;
+      else
+      {
+        mtime = stat_mtime(&st);
+        l->valid = st.st_dev == l->dev && st.st_ino == l->ino &&
+                   mtime.tv_sec == l->mtime.tv_sec && mtime.tv_nsec == l->mtime.tv_nsec;
+      }
+    }
+    if (l->valid || load_listing(l) == 0)
+      return l;
+    return NULL; // stays invalid, read again next time
+  }
+
+  if (num_listings == GLOB_CACHE_MAX)
+  {
+    clear_listings();
+    bucket = find_bucket(path);
+  }
+
+  struct dir_listing *l = calloc(1, sizeof(struct dir_listing));
+  l->path = strdup(path);
+  l->wd = -1;
+  if (load_listing(l) < 0)
+  {
+#ifdef __linux__
+    if (l->wd >= 0)
+      inotify_rm_watch(inotify_fd, l->wd);
+#endif
+    free_listing(l);
+    return NULL;
+  }
+  if (num_listings == listings_capacity)
+  {
+    listings_capacity = listings_capacity ? listings_capacity * 2 : 64;
+    listings = realloc(listings, sizeof(struct dir_listing *) * listings_capacity);
+  }
+  listings[num_listings] = l;
+  listing_index[bucket] = num_listings++;
+  return l;
+}
+
+/* The entry called name in a listing, or NULL */
+static struct dir_entry *find_entry(struct dir_listing *l, const char *name)
+{
+  struct dir_entry key = {(char *)name, 0};
+  return bsearch(&key, l->entries, l->count, sizeof(struct dir_entry), compare_entries);
+}
+
+/* ---------------------------------------------------------------- expansion */
+
+struct glob_paths
+{
+  struct glob_path *paths;
+  int count, capacity;
+};
+
+static char *join_path(const char *dir, const char *name)
+{
+  size_t dir_len = strlen(dir), name_len = strlen(name);
+  int slash = dir_len > 0 && dir[dir_len - 1] != '/';
+  char *joined = arena_alloc(&line_arena, dir_len + slash + name_len + 1);
+  memcpy(joined, dir, dir_len);
+  if (slash)
+    joined[dir_len] = '/';
+  memcpy(joined + dir_len + slash, name, name_len + 1);
+  return joined;
+}
+
+static void push_path(struct glob_paths *list, char *shown, char *abs)
+{
+  if (list->count == list->capacity)
+  {
+    int grown = list->capacity ? list->capacity * 2 : 16;
+    list->paths = arena_realloc(&line_arena, list->paths, sizeof(struct glob_path) * list->capacity,
+                                sizeof(struct glob_path) * grown);
+    list->capacity = grown;
+  }
+  list->paths[list->count].shown = shown;
+  list->paths[list->count].abs = abs;
+  list->count++;
+}
+
+static void add_path(struct glob_paths *list, const char *shown_dir, const char *abs_dir, const char *name)
+{
+  push_path(list, join_path(shown_dir, name), join_path(abs_dir, name));
+}
+
+/* Copies a literal component without its backslash escapes */
+static char *unescape(const char *s, size_t len)
+{
+  char *out = arena_alloc(&line_arena, len + 1), *o = out;
+  for (size_t i = 0; i < len; i++)
+  {
+    if (s[i] == '\\' && i + 1 < len)
+      i++;
+    *o++ = s[i];
+  }
+  *o = '\0';
+  return out;
+}
+
+/*
+   Replaces a leading ~ or ~user with the home directory, like GLOB_TILDE.
+*/
+static const char *expand_tilde(const char *pattern)
+{
+  if (pattern[0] != '~')
+    return pattern;
+
+  const char *rest = strchr(pattern, '/');
+  size_t name_len = rest ? (size_t)(rest - pattern - 1) : strlen(pattern + 1);
+  const char *home = NULL;
+  if (name_len == 0)
+    home = var_get("HOME");
+  if (home == NULL)
+  {
+    char *user = arena_strndup(&line_arena, pattern + 1, name_len);
+    struct passwd *pw = name_len ? getpwnam(user) : getpwuid(getuid());
+    if (pw == NULL)
+      return pattern;
+    home = pw->pw_dir;
+  }
+
+  size_t home_len = strlen(home);
+  const char *tail = rest ? rest : "";
+  char *expanded = arena_alloc(&line_arena, home_len + strlen(tail) + 1);
+  memcpy(expanded, home, home_len);
+  strcpy(expanded + home_len, tail);
+  return expanded;
+}
+
+static const char *skip_slashes(const char *s)
+{
+  while (*s == '/')
+    s++;
+  return s;
+}
+
+static int compare_strings(const void *a, const void *b)
+{
+  return strcmp(*(char *const *)a, *(char *const *)b);
+}
+
+/*
+- Expand a wildcard pattern against the cached listings, one path component at a time.
+- A wildcard component keeps the matching names of every directory reached so far,
+  a literal one keeps the directories that contain it. All but the last component
+  must name directories, and a trailing '/' asks for directories only.
+- A `**` component matches any number of directories: the component after it is
+  matched over the whole trees below by glob_walk(), without the cache.
+- Store the sorted matches, in the line arena, in *matches and return their number.
+*/
+int glob_cached(const char *token, char ***matches)
+{
+  const char *pattern = expand_tilde(token);
+  size_t len = strlen(pattern);
+  int dirs_only = len > 0 && pattern[len - 1] == '/';
+
+  drain_changes();
+
+  struct glob_paths cur = {0}, next;
+  cur.paths = arena_alloc(&line_arena, sizeof(struct glob_path));
+  cur.count = cur.capacity = 1;
+  if (pattern[0] == '/')
+  {
+    cur.paths[0].shown = "/";
+    cur.paths[0].abs = "/";
+  }
+  else
+  {
+    char *here = getcwd(NULL, 0);
+    cur.paths[0].shown = "";
+    cur.paths[0].abs = arena_strdup(&line_arena, here ? here : ".");
+    free(here);
+  }
+
+  const char *p = pattern;
+  while (*p == '/')
+    p++;
+  while (*p && cur.count > 0)
+  {
+    const char *end = strchr(p, '/');
+    size_t comp_len = end ? (size_t)(end - p) : strlen(p);
+    const char *after = skip_slashes(p + comp_len);
+    int last = (*after == '\0');
+    int need_dir = !last || dirs_only;
+
+    memset(&next, 0, sizeof(next));
+    if (comp_len == 2 && p[0] == '*' && p[1] == '*')
+    {
+      // `**` is any number of directories: walk the trees below, matching the
+      // component after it (or taking everything if it ends the pattern)
+      while (strncmp(after, "**", 2) == 0 && (after[2] == '/' || after[2] == '\0'))
+        after = skip_slashes(after + 2);
+      struct glob_pattern *pat = NULL;
+      need_dir = dirs_only;
+      if (*after != '\0')
+      {
+        end = strchr(after, '/');
+        comp_len = end ? (size_t)(end - after) : strlen(after);
+        pat = glob_compile(after, comp_len);
+        after = skip_slashes(after + comp_len);
+        need_dir = *after != '\0' || dirs_only;
+      }
+      struct glob_path *below;
+      int num_below = glob_walk(cur.paths, cur.count, pat, need_dir, &below);
+      for (int i = 0; pat == NULL && i < cur.count; i++)
+        if (cur.paths[i].shown[0] != '\0')
+          add_path(&next, cur.paths[i].shown, cur.paths[i].abs, ""); // `dir/**` is dir/ too
+      for (int i = 0; i < num_below; i++)
+        push_path(&next, below[i].shown, below[i].abs);
+    }
+    else if (!has_wildcard(p, comp_len))
+    {
+      char *name = unescape(p, comp_len);
+      for (int i = 0; i < cur.count; i++)
+      {
+        struct dir_listing *l = get_listing(cur.paths[i].abs);
+        struct dir_entry *e = l ? find_entry(l, name) : NULL;
+        struct stat st;
+        int exists = e ? (!need_dir || e->is_dir)
+                       : (l == NULL && stat(join_path(cur.paths[i].abs, name), &st) == 0 &&
+                          (!need_dir || S_ISDIR(st.st_mode)));
+        if (exists)
+          add_path(&next, cur.paths[i].shown, cur.paths[i].abs, name);
+      }
+    }
+    else
+    {
+      struct glob_pattern *pat = glob_compile(p, comp_len);
+      for (int i = 0; i < cur.count; i++)
+      {
+        struct dir_listing *l = get_listing(cur.paths[i].abs);
+        for (int k = 0; l != NULL && k < l->count; k++)
+          if ((!need_dir || l->entries[k].is_dir) && glob_match(pat, l->entries[k].name))
+            add_path(&next, cur.paths[i].shown, cur.paths[i].abs, l->entries[k].name);
+      }
+    }
+    cur = next;
+    p = after;
+  }
+
+  char **found = arena_alloc(&line_arena, sizeof(char *) * (cur.count + 1));
+  for (int i = 0; i < cur.count; i++)
+    found[i] = dirs_only ? join_path(cur.paths[i].shown, "") : cur.paths[i].shown;
+  int sorted = 1;
+  for (int i = 1; i < cur.count && sorted; i++)
+    sorted = strcmp(found[i - 1], found[i]) <= 0;
+  if (!sorted)
+    qsort(found, cur.count, sizeof(char *), compare_strings);
+  *matches = found;
+  return cur.count;
+}
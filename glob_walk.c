@@ -0,0 +1,259 @@
+#include "header.h"
+#include <dirent.h>
+#include <pthread.h>
+#include <sched.h>
+#include <stdatomic.h>
+#include <time.h>
+
+/*
+ * The directory walk behind `**`. A small pool of threads, one per core up to
+ * GLOB_WALK_THREADS, reads the tree below the given directories. Each thread keeps
+ * a queue of directories still to read: it takes its own newest one (staying deep
+ * in one subtree) and, with nothing left, steals the oldest one of another thread,
+ * which is usually the root of a large unread subtree. The walk ends when no
+ * directory is queued or being read.
+ *
+ * Every thread collects its matches in its own arena and sorts them before it
+ * stops; the sorted runs are then merged into the line arena. Hidden directories
+ * and symbolic links to directories are not descended into, as in bash.
+ */
+
+struct walk_task
+{
+  const char *abs, *shown;
+};
+
+struct walker
+{
+  pthread_t thread;
+  pthread_mutex_t lock;    // guards the queue, which other walkers steal from
+  struct walk_task *queue; // [head, tail) still to read, the owner takes from the tail
+  int head, tail, capacity;
+  struct arena arena;      // paths found by this walker
+  struct glob_path *found;
+  int num_found, found_capacity;
+};
+
+static struct walker walkers[GLOB_WALK_THREADS];
+static int num_walkers;
+static atomic_int pending; // directories queued or being read
+static const struct glob_pattern *walk_pattern;
+static int walk_dirs_only;
+
+static void *walk_alloc(void *ptr, size_t size)
+{
+  ptr = realloc(ptr, size);
+  if (ptr == NULL)
+  {
+    perror("glob");
+    exit(EXIT_FAILURE);
+  }
+  return ptr;
+}
+
+static void push_task(struct walker *w, const char *abs, const char *shown)
+{
+  atomic_fetch_add(&pending, 1);
+  pthread_mutex_lock(&w->lock);
+  if (w->tail == w->capacity)
+  {
+    // slide the stolen slots back before growing
+    memmove(w->queue, w->queue + w->head, sizeof(struct walk_task) * (w->tail - w->head));
+    w->tail -= w->head;
+    w->head = 0;
+    if (w->tail >= w->capacity / 2)
+    {
+      w->capacity = w->capacity ? w->capacity * 2 : 64;
+      w->queue = walk_alloc(w->queue, sizeof(struct walk_task) * w->capacity);
+    }
+  }
+  w->queue[w->tail].abs = abs;
+  w->queue[w->tail].shown = shown;
+  w->tail++;
+  pthread_mutex_unlock(&w->lock);
+}
+
+/* Takes the newest task of the walker's own queue, or the oldest of a victim's */
+static int take_task(struct walker *w, int own, struct walk_task *task)
+{
+  int taken = 0;
+  pthread_mutex_lock(&w->lock);
+  if (w->head < w->tail)
+  {
+    *task = own ? w->queue[--w->tail] : w->queue[w->head++];
+    taken = 1;
+  }
+  if (w->head == w->tail)
+    w->head = w->tail = 0;
+  pthread_mutex_unlock(&w->lock);
+  return taken;
+}
+
+static char *walk_join(struct arena *a, const char *dir, const char *name)
+{
+  size_t dir_len = strlen(dir), name_len = strlen(name);
+  int slash = dir_len > 0 && dir[dir_len - 1] != '/';
+  char *joined = arena_alloc(a, dir_len + slash + name_len + 1);
+  memcpy(joined, dir, dir_len);
+  if (slash)
+    joined[dir_len] = '/';
+  memcpy(joined + dir_len + slash, name, name_len + 1);
+  return joined;
+}
+
+static void add_found(struct walker *w, const char *abs, const char *shown)
+{
+  if (w->num_found == w->found_capacity)
+  {
+    w->found_capacity = w->found_capacity ? w->found_capacity * 2 : 256;
+    w->found = walk_alloc(w->found, sizeof(struct glob_path) * w->found_capacity);
+  }
+  w->found[w->num_found].abs = (char *)abs;
+  w->found[w->num_found].shown = (char *)shown;
+  w->num_found++;
+}
+
+/*
+- Read one directory: keep the entries that match, queue the subdirectories.
+- Without a pattern every visible entry matches; with one, hidden entries match
+  only if the pattern starts with '.'.
+*/
+static void walk_directory(struct walker *w, struct walk_task task)
+{
+  DIR *dir = opendir(task.abs);
+  if (dir == NULL)
+    return;
+
+  struct dirent *ent;
+  while ((ent = readdir(dir)) != NULL)
+  {
+    const char *name = ent->d_name;
+    if (name[0] == '.' && (name[1] == '\0' || (name[1] == '.' && name[2] == '\0')))
+      continue;
+
+    struct stat st;
+    int type = ent->d_type;
+    if (type == DT_UNKNOWN && fstatat(dirfd(dir), name, &st, AT_SYMLINK_NOFOLLOW) == 0)
+      type = S_ISDIR(st.st_mode) ? DT_DIR : S_ISLNK(st.st_mode) ? DT_LNK : DT_REG;
+
+    int matches = walk_pattern ? glob_match(walk_pattern, name) : name[0] != '.';
+    int descend = type == DT_DIR && name[0] != '.';
+    if (matches && walk_dirs_only && type != DT_DIR)
+      matches = type == DT_LNK && fstatat(dirfd(dir), name, &st, 0) == 0 && S_ISDIR(st.st_mode);
+    if (!matches && !descend)
+      continue;
+
+    const char *abs = walk_join(&w->arena, task.abs, name);
+    const char *shown = walk_join(&w->arena, task.shown, name);
+    if (matches)
+      add_found(w, abs, shown);
+    if (descend)
+      push_task(w, abs, shown);
+  }
+  closedir(dir);
+}
+
+static int compare_found(const void *a, const void *b)
+{
+  return strcmp(((const struct glob_path *)a)->shown, ((const struct glob_path *)b)->shown);
+}
+
+/*
+   Reads directories until none is queued or being read anywhere, then sorts
+   what this walker found.
+*/
+static void *walker_main(void *arg)
+{
+  struct walker *w = arg;
+  int self = w - walkers, idle = 0;
+  struct walk_task task;
+
+  while (atomic_load(&pending) > 0)
+  {
+    int taken = take_task(w, 1, &task);
+    for (int i = 1; !taken && i < num_walkers; i++)
+      taken = take_task(&walkers[(self + i) % num_walkers], 0, &task);
+
+    if (taken)
+    {
+      walk_directory(w, task);
+      atomic_fetch_sub(&pending, 1);
+      idle = 0;
+    }
+    else if (++idle < 64)
+      sched_yield();
+    else
+    {
+      struct timespec pause = {0, 50000};
+      nanosleep(&pause, NULL); // another walker is reading a directory that may hold more
+    }
+  }
+
+  qsort(w->found, w->num_found, sizeof(struct glob_path), compare_found);
+  return NULL;
+}
+
+static int walk_threads(void)
+{
+  long cores = sysconf(_SC_NPROCESSORS_ONLN);
+  if (cores < 1)
+    return 1;
+  return cores < GLOB_WALK_THREADS ? cores : GLOB_WALK_THREADS;
+}
+
+/*
+- Walk the trees below the given directories in parallel.
+- Keep every entry whose name matches pat (every visible entry if pat is NULL),
+  only directories if dirs_only is set.
+- Store the matches, sorted by their shown path and copied into the line arena, in
+  *found and return their number.
+*/
+int glob_walk(const struct glob_path *roots, int num_roots, const struct glob_pattern *pat, int dirs_only,
+              struct glob_path **found)
+{
+  if (num_walkers == 0)
+  {
+    num_walkers = walk_threads();
+    for (int i = 0; i < num_walkers; i++)
+      pthread_mutex_init(&walkers[i].lock, NULL);
+  }
+  for (int i = 0; i < num_walkers; i++)
+  {
+    arena_reset(&walkers[i].arena);
+    walkers[i].num_found = 0;
+  }
+  walk_pattern = pat;
+  walk_dirs_only = dirs_only;
+  for (int i = 0; i < num_roots; i++)
+    push_task(&walkers[i % num_walkers], roots[i].abs, roots[i].shown);
+
+  // the calling thread is walker 0; a walker that cannot be started is left out
+  int started = 1;
+  for (int i = 1; i < num_walkers; i++)
+    if (pthread_create(&walkers[i].thread, NULL, walker_main, &walkers[i]) != 0)
+      break;
+    else
+      started++;
+  walker_main(&walkers[0]);
+  for (int i = 1; i < started; i++)
+    pthread_join(walkers[i].thread, NULL);
+
+  // merge the sorted runs, copying the paths out of the walkers' arenas
+  int total = 0, pos[GLOB_WALK_THREADS] = {0};
+  for (int i = 0; i < num_walkers; i++)
+    total += walkers[i].num_found;
+  struct glob_path *merged = arena_alloc(&line_arena, sizeof(struct glob_path) * (total ? total : 1));
+  for (int n = 0; n < total; n++)
+  {
+    int best = -1;
+    for (int i = 0; i < num_walkers; i++)
+      if (pos[i] < walkers[i].num_found &&
+          (best < 0 || compare_found(&walkers[i].found[pos[i]], &walkers[best].found[pos[best]]) < 0))
+        best = i;
+    struct glob_path *p = &walkers[best].found[pos[best]++];
+    merged[n].abs = arena_strdup(&line_arena, p->abs);
+    merged[n].shown = arena_strdup(&line_arena, p->shown);
+  }
+  *found = merged;
+  return total;
+}
@@ -0,0 +1,288 @@
+#include "header.h"
+
+/*
+ * Remembers where each external command was found on $PATH, so a launch costs one
+ * table lookup instead of an execve attempt per PATH directory. Entries are filled
+ * on first use, the whole table is dropped when PATH changes, and a single entry
+ * is dropped when executing its path fails with ENOENT.
+ */
+
+struct hash_entry
+{
+  char *name;
+  char *path;
+  int hits;
+  int pinned; // set with `hash -p`, not resolved from PATH
+  struct hash_entry *next;
+};
+
+static struct hash_entry **buckets;
+static size_t num_buckets, num_entries;
+static char *cached_path_var; // PATH the entries were resolved against
+
+static size_t hash_name(const char *name)
+{
+  size_t h = 2166136261u; // FNV-1a
+  for (; *name; name++)
+    h = (h ^ (unsigned char)*name) * 16777619u;
+  return h;
+}
+
+static void free_entry(struct hash_entry *entry)
+{
+  free(entry->name);
+  free(entry->path);
+  free(entry);
+}
+
+/*
+   Drops every remembered command (hash -r).
+*/
+void path_cache_clear(void)
+{
+  for (size_t i = 0; i < num_buckets; i++)
+  {
+    struct hash_entry *entry = buckets[i];
+    while (entry != NULL)
+    {
+      struct hash_entry *next = entry->next;
+      free_entry(entry);
+      entry = next;
+    }
+    buckets[i] = NULL;
+  }
+  num_entries = 0;
+}
+
+/*
+   Clears the table if PATH is no longer what the entries were resolved against.
+*/
+static void check_path_var(void)
+{
+  const char *path_var = var_get("PATH");
+  if (path_var == NULL)
+    path_var = "";
+
+  if (cached_path_var != NULL && strcmp(cached_path_var, path_var) == 0)
+    return;
+
+  path_cache_clear();
+  free(cached_path_var);
+  cached_path_var = strdup(path_var);
+}
+
+static struct hash_entry **find_slot(const char *name)
+{
+  struct hash_entry **slot = &buckets[hash_name(name) & (num_buckets - 1)];
+  while (*slot != NULL && strcmp((*slot)->name, name) != 0)
+    slot = &(*slot)->next;
+  return slot;
+}
+
+/*
+   Doubles the bucket array once the chains average more than one entry.
+*/
+static void grow_buckets(void)
+{
+  size_t new_count = num_buckets ? num_buckets * 2 : 64;
+  struct hash_entry **new_buckets = calloc(new_count, sizeof(struct hash_entry *));
+  if (new_buckets == NULL)
+    return; // keep using the longer chains
+
+  for (size_t i = 0; i < num_buckets; i++)
+  {
+    struct hash_entry *entry = buckets[i];
+    while (entry != NULL)
+    {
+      struct hash_entry *next = entry->next;
+      size_t b = hash_name(entry->name) & (new_count - 1);
+      entry->next = new_buckets[b];
+      new_buckets[b] = entry;
+      entry = next;
+    }
+  }
+  free(buckets);
+  buckets = new_buckets;
+  num_buckets = new_count;
+}
+
+static struct hash_entry *insert_entry(const char *name, const char *path, int pinned)
+{
+  if (num_entries >= num_buckets)
+    grow_buckets();
+
+  struct hash_entry **slot = find_slot(name);
+  if (*slot != NULL)
+  {
+    free((*slot)->path);
+    (*slot)->path = strdup(path);
+    (*slot)->pinned = pinned;
+    return *slot;
+  }
+
+  struct hash_entry *entry = malloc(sizeof(struct hash_entry));
+  entry->name = strdup(name);
+  entry->path = strdup(path);
+  entry->hits = 0;
+  entry->pinned = pinned;
+  entry->next = NULL;
+  *slot = entry;
+  num_entries++;
+  return entry;
+}
+
+/*
+- Walk $PATH like execvp: an empty component means the current directory,
+  the first regular file we may execute wins.
+- Return the full path in a static buffer, or NULL if the command is not found.
+*/
+static char *search_path(const char *name)
+{
+  static char full[PATH_MAX];
+  const char *dir = cached_path_var;
+  size_t name_len = strlen(name);
+
+  while (1)
+  {
+    const char *end = strchr(dir, ':');
+    size_t dir_len = end ? (size_t)(end - dir) : strlen(dir);
+
+    if (dir_len + name_len + 2 <= sizeof(full))
+    {
+      if (dir_len == 0)
+        memcpy(full, name, name_len + 1);
+      else
+      {
+        memcpy(full, dir, dir_len);
+        full[dir_len] = '/';
+        memcpy(full + dir_len + 1, name, name_len + 1);
+      }
+
+      struct stat st;
+      if (access(full, X_OK) == 0 && stat(full, &st) == 0 && S_ISREG(st.st_mode))
+        return full;
+    }
+
+    if (end == NULL)
+      return NULL;
+    dir = end + 1;
+  }
+}
+
+/*
+- Resolve a command name to the path to execute.
+- Names containing '/' are used as given and never cached.
+- Return the path, or NULL if the command is not on PATH.
+*/
+const char *path_lookup(const char *name)
+{
+  if (strchr(name, '/') != NULL)
+    return name;
+
+  if (num_buckets == 0)
+    grow_buckets();
+  check_path_var();
+
+  struct hash_entry *entry = *find_slot(name);
+  if (entry == NULL)
+  {
+    char *found = search_path(name);
+    if (found == NULL)
+      return NULL;
+    entry = insert_entry(name, found, 0);
+  }
+  entry->hits++;
+  return entry->path;
+}
+
+/*
+   Drops one command, e.g. after its remembered path stopped existing.
+*/
+void path_forget(const char *name)
+{
+  if (num_buckets == 0)
+    return;
+
+  struct hash_entry **slot = find_slot(name);
+  if (*slot != NULL)
+  {
+    struct hash_entry *entry = *slot;
+    *slot = entry->next;
+    free_entry(entry);
+    num_entries--;
+  }
+}
+
+/*
+   Lists remembered commands with their hit counts, in the style of `hash` in sh.
+*/
+static void print_hash_table(void)
+{
+  if (num_entries == 0)
+  {
+    printf("hash: hash table empty\n");
+    return;
+  }
+
+  printf("hits\tcommand\n");
+  for (size_t i = 0; i < num_buckets; i++)
+    for (struct hash_entry *entry = buckets[i]; entry != NULL; entry = entry->next)
+      printf("%4d%s\t%s\n", entry->hits, entry->pinned ? "*" : " ", entry->path);
+}
+
+/*
+- `hash`             list remembered commands
+- `hash -r`          forget all remembered commands
+- `hash -p path name` remember name as path without searching PATH
+- `hash name ...`    look names up now, warming the table
+- Return 0 on success, 1 if a name could not be found, 2 if the usage is wrong.
+*/
+int hash_builtin(char **cmd_tokens)
+{
+  if (num_buckets == 0)
+    grow_buckets();
+  check_path_var();
+
+  if (cmd_tokens[1] == NULL)
+  {
+    print_hash_table();
+    return 0;
+  }
+
+  if (strcmp(cmd_tokens[1], "-r") == 0)
+  {
+    path_cache_clear();
+    return 0;
+  }
+
+  if (strcmp(cmd_tokens[1], "-p") == 0)
+  {
+    if (cmd_tokens[2] == NULL || cmd_tokens[3] == NULL)
+    {
+      fprintf(stderr, "hash: usage: hash [-r] [-p path name] [name ...]\n");
+      return 2;
+    }
+    insert_entry(cmd_tokens[3], cmd_tokens[2], 1);
+    return 0;
+  }
+
+  int ret = 0;
+  for (int i = 1; cmd_tokens[i] != NULL; i++)
+  {
+    if (strchr(cmd_tokens[i], '/') != NULL)
+      continue;
+    struct hash_entry *entry = *find_slot(cmd_tokens[i]);
+    if (entry == NULL)
+    {
+      char *found = search_path(cmd_tokens[i]);
+      if (found != NULL)
+        insert_entry(cmd_tokens[i], found, 0);
+      else
+      {
+        fprintf(stderr, "hash: %s: not found\n", cmd_tokens[i]);
+        ret = 1;
+      }
+    }
+  }
+  return ret;
+}
@@ -1,46 +1,359 @@
+#define _GNU_SOURCE
 #include <signal.h>
 #include <stdlib.h>
 #include <stdio.h>
 #include <unistd.h>
 #include <string.h>
-#include <glob.h>
+#include <stddef.h>
+#include <limits.h>
 #include <errno.h>
 #include <fcntl.h>
 #include <sys/stat.h>
 #include <sys/types.h>
-#define MAX_BUF_LEN 1024
+#include <sys/wait.h>
+#include <sys/resource.h>
 #define CMD_DELIMS " \t\n"
-#define MAX_HISTORY 10
+#define MAX_HISTORY 10        // commands `history` prints by default
+#define HISTORY_SIZE 100000   // commands kept for `history` and `!prefix`
+#define HISTORY_TAIL_MAX 1024 // commands added before the prefix index is rebuilt
+#define GLOB_CACHE_MAX 4096   // directory listings kept for wildcard expansion
+#define GLOB_WALK_THREADS 8   // most threads walking the tree for `**`
+#define PARALLEL_HELD_MAX 256 // finished `parallel -k` outputs waiting for an earlier job
+#define PARALLEL_ARENA_BLOCK (4 * 1024) // first block of the arena of one `parallel` job slot
+#define JOB_DONE_MAX 256 // ended background jobs kept for `wait` and `wait -n`
+#define INPUT_BLOCK_SIZE (64 * 1024)
+#define ARENA_BLOCK_SIZE (64 * 1024)
+#define ARENA_RETAIN_MAX (1024 * 1024)
+#define ARENA_ALIGN sizeof(void *)
+
+/* -------------------------------------------------------------------*/
+
+struct arena_block
+{
+  struct arena_block *next;
+  size_t size, used;
+  char data[];
+};
+
+struct arena
+{
+  struct arena_block *head, *cur;
+  void *last; // most recent allocation, can be grown in place
+  size_t retained;
+  size_t allocs, blocks; // running counts of allocations and of blocks taken from malloc
+  size_t block_size;     // least size of a block, ARENA_BLOCK_SIZE when 0
+};
+
+struct arena_mark
+{
+  struct arena_block *block;
+  size_t used;
+};
+
+extern struct arena line_arena; // per command line, reset after the line runs
+
+void *arena_alloc(struct arena *a, size_t size);
+void *arena_realloc(struct arena *a, void *ptr, size_t old_size, size_t new_size);
+char *arena_strdup(struct arena *a, const char *s);
+char *arena_strndup(struct arena *a, const char *s, size_t n);
+struct arena_mark arena_mark(struct arena *a);
+void arena_release(struct arena *a, struct arena_mark mark);
+void arena_reset(struct arena *a);
+void arena_free(struct arena *a);
+
+/* -------------------------------------------------------------------*/
+
+enum token_type
+{
+  TOK_WORD,
+  TOK_SEMI,      // ;
+  TOK_AMP,       // &
+  TOK_PIPE,      // |
+  TOK_LESS,      // <
+  TOK_GREAT,     // >
+  TOK_DGREAT,    // >>
+  TOK_DLESS,     // <<
+  TOK_DLESSDASH, // <<-
+  TOK_TLESS,     // <<<
+  TOK_AND_IF,    // &&
+  TOK_OR_IF,     // ||
+  TOK_DSEMI,     // ;;
+  TOK_END
+};
+
+struct token
+{
+  enum token_type type;
+  char *word;     // text of a TOK_WORD
+  int start, end; // byte span in the command line
+};
+
+enum redirect_type
+{
+  REDIR_INPUT,
+  REDIR_OUTPUT,
+  REDIR_APPEND,
+  REDIR_HERE_DOC,   // <<word: the lines after the command, up to word
+  REDIR_HERE_STRING // <<<word
+};
+
+#define HERE_LITERAL 1    // the delimiter was quoted: the lines are not expanded
+#define HERE_STRIP_TABS 2 // <<-: leading tabs are removed from the lines
+
+struct redirect
+{
+  enum redirect_type type;
+  char *file;     // the file; for a here-document its delimiter, for a here-string the word
+  char *text;     // here-document: its lines, read after the command line (NULL until then)
+  int here_flags; // HERE_LITERAL, HERE_STRIP_TABS
+  struct redirect *next;
+};
+
+struct simple_command
+{
+  int argc;
+  char **argv; // words before expansion, NULL-terminated
+  struct redirect *redirects; // in source order
+};
+
+struct pipeline
+{
+  int num_cmds;
+  struct simple_command *cmds;
+  int background;
+  char *text; // source text, for history
+};
+
+enum command_type
+{
+  CMD_PIPELINE,
+  CMD_AND, // left && right
+  CMD_OR,  // left || right
+  CMD_NOT, // ! left
+  CMD_IF,
+  CMD_WHILE,
+  CMD_UNTIL,
+  CMD_FOR,
+  CMD_CASE
+};
+
+struct case_item
+{
+  int num_patterns;
+  char **patterns;
+  struct glob_pattern **compiled; // compiled once by the parser, NULL for a pattern to expand ('$', '`')
+  struct sequence *body;
+};
+
+/*
+   One command of a sequence, as a tree built once by the parser and run as many
+   times as a loop needs; only the words are expanded again at each run.
+*/
+struct command
+{
+  enum command_type type;
+  int background; // ended by '&'
+  char *text;     // source text, for history and job names
+  struct pipeline *pipeline;                 // CMD_PIPELINE
+  struct command *left, *right;              // CMD_AND, CMD_OR; CMD_NOT has only left
+  struct sequence *cond, *body, *otherwise;  // if (otherwise holds elif/else), while, until; for and case use body
+  char *name;                                // for: the variable
+  struct simple_command *words;              // for: the list after `in`; case: the word
+  int num_items;                             // case
+  struct case_item *items;
+};
+
+struct sequence
+{
+  int num_commands;
+  struct command *commands;
+};
+
+enum launch_mode
+{
+  LAUNCH_SPAWN, // posix_spawn, no page table copy
+  LAUNCH_FORK   // fork + exec
+};
+
+struct launch
+{
+  char **argv;
+  struct redirect *redirects;
+  pid_t pgid;        // process group to join, 0 to lead a new one
+  int in_fd, out_fd; // pipe ends for stdin/stdout, -1 to inherit
+  int close_fd;      // pipe end the child must not keep, -1 if none
+  int foreground;    // give the child the terminal
+  const char *path;  // resolved executable, filled in by launch_process
+};
+
+extern enum launch_mode launch_mode;
+
+pid_t launch_process(struct launch *spec);
+int set_launch_mode(const char *value);
+const char *launch_mode_name(void);
+
+const char *path_lookup(const char *name);
+void path_forget(const char *name);
+void path_cache_clear(void);
+int hash_builtin(char **cmd_tokens);
 
 /* -------------------------------------------------------------------*/
 
 void setup(void);
-void handle_signal(int signum);
 
+void event_setup(void);
+void event_watch_input(int fd);
+void wait_for_input(void);
+int interrupt_pending(void);
+int process_events(int timeout_ms);
+void reap_children(void);
+void report_jobs(void);
+void watch_process(int pid);
+int wait_child_event(void);
+
+void input_open(int fd);
+void input_open_terminal(int fd);
+void input_start_line(void);
+void input_open_script(int fd);
+void input_open_string(const char *cmds);
+int input_source_fd(void);
+int input_buffered(void);
 char *read_command_line(void);
-int parse_command_line(char *cmd, char **cmds);
-int parse_command(char *cmd, char **cmd_tokens);
-void parse_for_piping(char *cmd);
-int expand_wildcard_token(char *token, char **expanded_tokens, int start_index);
-int parse_for_redirect(char *cmd, char **cmd_tokens);
-int execute_command(char **cmd_tokens);
-
-int is_piping(char *cmd);
-void handle_piping_and_redirect(char *cmd);
-void handle_normal_command(int tokens, char **cmd_tokens);
-void add_process(int pid, char *name);
-void remove_process(int pid);
+void edit_start(int fd);
+char *edit_line(int fd);
+int edit_pending(void);
+extern int last_status; // exit status of the last command, what $? expands to
+struct sequence *parse_line(char *line);
+struct sequence *parse_line_partial(char *line, int *incomplete);
+struct redirect **here_documents(int *count);
+extern int substitution_status; // exit status of the last $(...) run, -1 if none
+char *expand_parameters(const char *word);
+char *command_output(char *command);
+char **expand_words(struct simple_command *cmd, int *tokens);
+int expand_wildcard_token(char *token, char ***expanded_tokens, int start_index, int *capacity);
+int expand_braces(char *word, char ***words);
 
-int open_input_file(void);
-int open_output_file(void);
+/* A variable as it was before a command's own assignments, NAME=value cmd */
+struct saved_variable
+{
+  char *name; // NULL ends the list
+  char *value; // NULL if it was not set
+  int exported;
+};
+
+void vars_init(void);
+const char *var_lookup(const char *name, size_t len);
+const char *var_get(const char *name);
+void var_set(const char *name, const char *value, int export);
+void var_unset(const char *name);
+char **var_environ(void);
+int count_assignments(struct simple_command *cmd);
+void assign_words(char **words, int count, struct saved_variable **saved);
+void restore_assignments(struct saved_variable *saved);
+int export_builtin(char **cmd_tokens);
+int unset_builtin(char **cmd_tokens);
+
+/* A path reached while expanding a wildcard: as the user wrote it, and absolute */
+struct glob_path
+{
+  char *shown;
+  char *abs;
+};
+
+struct glob_pattern; // one compiled path component
+
+int glob_cached(const char *pattern, char ***matches);
+struct glob_pattern *glob_compile(const char *s, size_t len);
+int glob_match(const struct glob_pattern *pat, const char *name);
+struct glob_pattern *glob_compile_string(const char *s);
+int glob_walk(const struct glob_path *roots, int num_roots, const struct glob_pattern *pat, int dirs_only,
+              struct glob_path **found);
+int execute_command(char **cmd_tokens, struct redirect *redirects, int background);
+
+int run_pipeline(struct pipeline *pl);
+int launch_pipeline(struct pipeline *pl, int in_fd, int out_fd, pid_t *pids, int *job_id);
+extern int pipe_size;
+int set_pipe_size(const char *value);
+int make_pipe(int fds[2]);
+int handle_piping_and_redirect(struct pipeline *pl);
+int handle_normal_command(struct simple_command *cmd, int background);
+
+extern int interrupted; // Ctrl-C: the rest of the command tree is skipped
+int check_interrupt(void);
+int run_sequence(struct sequence *seq);
+int run_command(struct command *cmd);
+pid_t fork_subshell(struct command *cmd, pid_t pgid, int in_fd, int out_fd);
+pid_t fork_sequence(struct sequence *seq, pid_t pgid, int in_fd, int out_fd);
+
+int open_input_file(char *file);
+int open_output_file(char *file, enum redirect_type type);
+int open_here_document(struct redirect *redir);
+int apply_redirects(struct redirect *redirects);
 
 void change_prompt(char *new_prompt);
-int cd(char **cmd_tokens, char *cwd, char *base_dir);
+int cd(char **cmd_tokens, char **cwd, char *base_dir);
 void update_cwd_relative(char *cwd);
-void pwd(char **cmd_tokens);
+int pwd(char **cmd_tokens);
+int set_option(char **cmd_tokens);
+
+#define BUILTIN_OWN_REDIRECTS 1 // the builtin applies the command's redirections itself
+#define BUILTIN_PURE 2          // only prints through stdout and changes no shell state: $(...) runs it in the shell
+
+struct builtin
+{
+  const char *name;
+  int (*run)(char **cmd_tokens, struct redirect *redirects); // returns the exit status
+  int flags;
+};
+
+const struct builtin *find_builtin(const char *name);
+int run_builtin(const struct builtin *b, char **cmd_tokens, struct redirect *redirects);
+
+int echo_builtin(char **cmd_tokens);
+int printf_builtin(char **cmd_tokens);
+int test_builtin(char **cmd_tokens);
+int bracket_builtin(char **cmd_tokens);
+int true_builtin(char **cmd_tokens);
+int false_builtin(char **cmd_tokens);
+
+extern int history_size;
+
+void history_open(void);
 void add_to_history(char *cmd);
-void print_history(void);
+void print_history(char **cmd_tokens);
 char *find_command_by_prefix(char *prefix);
+int set_history_size(const char *value);
+const char *history_entry(int i, int *len);
+int history_window(int *first);
+void search_index_add(int entry);
+int history_search(const char *query, int *results, int max);
+
+/* -------------------------------------------------------------------*/
+
+struct usage
+{
+  int procs;                // processes accounted
+  double real, user, sys;   // seconds
+  long maxrss;              // KiB, the largest of the processes
+  long nvcsw, nivcsw;       // voluntary and involuntary context switches
+  long minflt, majflt;      // page faults without and with I/O
+};
+
+double now_seconds(void);
+void account_process(int pid, const struct rusage *ru);
+int time_pipeline(struct pipeline *pl);
+int jobstats_builtin(char **cmd_tokens);
+
+extern int profiling;
+int start_relay(int in, int gap);
+void profile_start(void);
+void profile_stop(void);
+void profile_report(struct pipeline *pl);
+
+int parallel_builtin(char **cmd_tokens, struct redirect *redirects);
+int cat_builtin(char **cmd_tokens, struct redirect *redirects);
+int launch_fed_pipeline(struct pipeline *pl, pid_t *pids, int *job_id);
+void parallel_reaped(int slot, int pid, int status);
 
 /* -------------------------------------------------------------------*/
 
@@ -49,27 +362,76 @@ struct process_info
   int pid, pgid;
   char *name;
   int active;
+  int job_id;
+  int pidfd;     // watched by the event loop, -1 if not
+  int stopped;   // stopped by a signal, until continued
+  int next_free; // free list link while the slot is unused
+  int next_in_job; // next process of the same job, -1 for the last
+  double started; // launch time, for the wall time reported on exit
 };
 
 typedef struct process_info process_info;
-process_info table[MAX_BUF_LEN];
 
-char base_dir[MAX_BUF_LEN];
-char *pipe_cmds[MAX_BUF_LEN];
-char cwd[MAX_BUF_LEN];
-extern char prompt[MAX_BUF_LEN];
-char history[MAX_HISTORY][MAX_BUF_LEN];
+struct job
+{
+  int id;     // key of the job in the table, 0 while the slot is free
+  int number; // job number shown to the user, 0 until it is put in the background or stops
+  pid_t pgid;
+  char *name;
+  int live; // processes not reaped yet
+  int parallel_slot; // slot of the running `parallel` that started it, -1 otherwise
+  int first_proc; // process table slot of its first process, -1 once all are reaped
+  pid_t last_pid; // last stage of the pipeline, whose status is the job's
+  int status;     // wait status of the last stage, once reaped
+  int background; // started with '&' or resumed with bg: reported and queued for wait when done
+  int stopped;    // some process is stopped
+  int list_prev, list_next; // neighbours in the list of stopped or of running numbered jobs, latest first
+  int next_free;
+};
+
+/* An ended background job, kept until `wait` collects it */
+struct done_job
+{
+  int id;
+  int number;
+  pid_t last_pid;
+  int status;
+};
+
+int add_job(char *name);
+struct job *find_job(int job_id);
+int number_job(struct job *job);
+struct job *find_job_number(int number);
+void add_process(int pid, int job_id, char *name);
+process_info *find_process(int pid);
+void remove_process(int pid);
+process_info *process_at(int slot);
+void set_exit_status(int pid, int status);
+void set_stopped(int pid, int stopped);
+void touch_job(struct job *job);
+void set_job_background(struct job *job, int background);
+struct job *current_job(int previous);
+int list_jobs(struct job **list);
+int live_job_count(void);
+int running_background_jobs(void);
+int take_done_job(int job_id, int number, pid_t pid, struct done_job *done);
+void clear_done_jobs(void);
+void finish_process(int pid, int status, const struct rusage *ru);
+int exit_code(int status);
+int wait_foreground(struct job *job);
 
-pid_t my_pid, my_pgid, fgpid;
+int jobs_builtin(char **cmd_tokens);
+int fg_builtin(char **cmd_tokens);
+int bg_builtin(char **cmd_tokens);
+int kill_builtin(char **cmd_tokens);
+int wait_builtin(char **cmd_tokens);
 
-char *in_file;
-char *out_file;
+extern char *base_dir;
+extern char *cwd;
+extern char *prompt;
 
-char **input_redirect_cmds;
-char **output_redirect_cmds;
+extern pid_t my_pid, my_pgid, fgpid;
 
-int job_num;
-int shell, shell_pgid;
-int output_redi_type, pipe_num;
-int piping, input_redi, output_redi;
-int is_background, input_idx, output_idx;
+extern int shell, shell_pgid;
+extern int interactive; // reading commands from a terminal, with a prompt
+extern int job_control; // interactive on a terminal: jobs get their own process group and the terminal
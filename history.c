@@ -0,0 +1,394 @@
+#include "header.h"
+#include <sys/file.h>
+
+/*
+ * Command history, kept in an append-only file ($HISTFILE, or ~/.shell_history)
+ * shared by every interactive shell. Each entry is one line. A command is written
+ * with a single O_APPEND write under flock(), so concurrent shells never interleave
+ * their entries. At startup the file is only opened; it is read and split into
+ * entries the first time history is used, so starting the shell costs the same
+ * whatever the size of the history. It is read into memory rather than mapped,
+ * since another shell may shrink it in place (compact_history_file()).
+ *
+ * `!prefix` is answered from a prefix index: the distinct entries sorted by text,
+ * each with the number of its latest use, and a max-tree over that array. All
+ * entries starting with a prefix are one range of the sorted array, found with
+ * two binary searches, and the tree gives the latest entry in the range in
+ * O(log n). Commands added since the index was built are checked first, newest
+ * to oldest; the index is rebuilt once there are more than HISTORY_TAIL_MAX.
+ */
+
+struct hist_entry
+{
+  const char *text; // in history_text or a heap copy, not null-terminated
+  int len;
+};
+
+static int history_fd = -1;
+static char *history_text; // the file as it was when first read, never freed: entries point into it
+static int history_loaded;
+
+static struct hist_entry *entries;
+static int num_entries, entries_capacity;
+
+static int *sorted;    // entry numbers of distinct texts, sorted by text
+static int num_sorted;
+static int *max_tree;  // max_tree[num_sorted + i] = sorted[i], inner nodes hold the max of their children
+static int indexed;    // entries [0, indexed) are covered by the index
+static int index_valid;
+static char *history_path;
+
+int history_size = HISTORY_SIZE;
+
+/*
+- Open the history file for appending; what it holds is read on first use.
+- $HISTSIZE sets the number of commands kept, like `set histsize=N`.
+- Without a usable file the history lives in memory for this session only.
+*/
+void history_open(void)
+{
+  const char *size = getenv("HISTSIZE");
+  if (size != NULL)
+    set_history_size(size);
+
+  const char *path = getenv("HISTFILE");
+  char *home_path = NULL;
+  if (path == NULL || *path == '\0')
+  {
+    const char *home = getenv("HOME");
+    if (home == NULL)
+      return;
+    home_path = malloc(strlen(home) + sizeof("/.shell_history"));
+    sprintf(home_path, "%s/.shell_history", home);
+    path = home_path;
+  }
+
+  history_path = home_path ? home_path : strdup(path);
+  history_fd = open(history_path, O_RDWR | O_APPEND | O_CREAT | O_CLOEXEC, 0600);
+}
+
+static void add_entry(const char *text, int len)
+{
+  if (num_entries == entries_capacity)
+  {
+    entries_capacity = entries_capacity ? entries_capacity * 2 : 1024;
+    entries = realloc(entries, sizeof(struct hist_entry) * entries_capacity);
+    if (entries == NULL)
+    {
+      perror("history");
+      exit(EXIT_FAILURE);
+    }
+  }
+  entries[num_entries].text = text;
+  entries[num_entries].len = len;
+  num_entries++;
+}
+
+/* First entry inside the configured history size */
+static int first_entry(void)
+{
+  return num_entries > history_size ? num_entries - history_size : 0;
+}
+
+/*
+- Rewrite the file with only the entries inside the history size, once it holds
+  more than twice as many, so the file cannot grow without bound.
+- The file is rewritten in place under the lock and then truncated: it stays the
+  inode every shell has open, so their appends keep landing in it, and entries
+  other shells appended since startup are kept, as they are read again here.
+- No shell maps the file, so shrinking it cannot pull pages from under another
+  shell's entries.
+*/
+static void compact_history_file(void)
+{
+  flock(history_fd, LOCK_EX);
+  struct stat st;
+  char *text = NULL;
+  if (fstat(history_fd, &st) == 0 && st.st_size > 0 && (text = malloc(st.st_size)) != NULL)
+  {
+    size_t len = 0;
+    ssize_t n;
+    while (len < (size_t)st.st_size && (n = pread(history_fd, text + len, st.st_size - len, len)) > 0)
+      len += n;
+
+    // the last history_size lines start after the line ending before them
+    size_t keep = len;
+    long lines = 0;
+    while (keep > 0 && (text[keep - 1] != '\n' || keep == len || ++lines < history_size))
+      keep--;
+
+    // pwrite() on an O_APPEND descriptor would append, so drop the flag meanwhile
+    int flags = fcntl(history_fd, F_GETFL);
+    if (keep > 0 && fcntl(history_fd, F_SETFL, flags & ~O_APPEND) == 0)
+    {
+      size_t done = 0;
+      while (done < len - keep && (n = pwrite(history_fd, text + keep + done, len - keep - done, done)) > 0)
+        done += n;
+      if (done == len - keep && ftruncate(history_fd, done) < 0)
+        perror("history");
+      fcntl(history_fd, F_SETFL, flags);
+    }
+  }
+  free(text);
+  flock(history_fd, LOCK_UN);
+}
+
+/*
+   Reads the whole file under a shared lock, so no compaction is halfway through it,
+   and returns its length; history_text is NULL if there is nothing to read.
+*/
+static size_t read_history_file(void)
+{
+  struct stat st;
+  size_t len = 0;
+  flock(history_fd, LOCK_SH);
+  if (fstat(history_fd, &st) == 0 && st.st_size > 0 && (history_text = malloc(st.st_size)) != NULL)
+  {
+    ssize_t n;
+    while (len < (size_t)st.st_size && (n = pread(history_fd, history_text + len, st.st_size - len, len)) > 0)
+      len += n;
+  }
+  flock(history_fd, LOCK_UN);
+  return len;
+}
+
+/*
+   Splits the file into entries, the first time history is needed.
+*/
+static void history_load(void)
+{
+  if (history_loaded)
+    return;
+  history_loaded = 1;
+
+  size_t len = history_fd >= 0 ? read_history_file() : 0;
+  const char *p = history_text, *end = history_text + len;
+  while (p < end)
+  {
+    const char *newline = memchr(p, '\n', end - p);
+    const char *stop = newline ? newline : end;
+    if (stop > p)
+      add_entry(p, stop - p);
+    p = stop + 1;
+  }
+
+  if (history_fd >= 0 && num_entries / 2 > history_size)
+    compact_history_file();
+}
+
+static int compare_text(const char *a, int a_len, const char *b, int b_len)
+{
+  int cmp = memcmp(a, b, a_len < b_len ? a_len : b_len);
+  return cmp ? cmp : a_len - b_len;
+}
+
+/* Sorts by text, the latest use of a text first */
+static int compare_entries(const void *x, const void *y)
+{
+  int a = *(const int *)x, b = *(const int *)y;
+  int cmp = compare_text(entries[a].text, entries[a].len, entries[b].text, entries[b].len);
+  return cmp ? cmp : b - a;
+}
+
+/*
+- Build the prefix index over every entry inside the history size.
+- Equal texts keep only their latest entry, then the max-tree is filled bottom-up.
+*/
+static void build_index(void)
+{
+  int first = first_entry();
+  int n = num_entries - first;
+
+  free(sorted);
+  free(max_tree);
+  sorted = malloc(sizeof(int) * (n ? n : 1));
+  max_tree = malloc(sizeof(int) * 2 * (n ? n : 1));
+  if (sorted == NULL || max_tree == NULL)
+  {
+    perror("history");
+    exit(EXIT_FAILURE);
+  }
+
+  for (int i = 0; i < n; i++)
+    sorted[i] = first + i;
+  qsort(sorted, n, sizeof(int), compare_entries);
+
+  num_sorted = 0;
+  for (int i = 0; i < n; i++)
+  {
+    struct hist_entry *e = &entries[sorted[i]];
+    if (num_sorted > 0)
+    {
+      struct hist_entry *prev = &entries[sorted[num_sorted - 1]];
+      if (compare_text(prev->text, prev->len, e->text, e->len) == 0)
+        continue;
+    }
+    sorted[num_sorted++] = sorted[i];
+  }
+
+  for (int i = 0; i < num_sorted; i++)
+    max_tree[num_sorted + i] = sorted[i];
+  for (int i = num_sorted - 1; i > 0; i--)
+    max_tree[i] = max_tree[2 * i] > max_tree[2 * i + 1] ? max_tree[2 * i] : max_tree[2 * i + 1];
+  indexed = num_entries;
+  index_valid = 1;
+}
+
+/* Latest entry number among sorted[lo, hi), or -1 for an empty range */
+static int range_max(int lo, int hi)
+{
+  int best = -1;
+  for (lo += num_sorted, hi += num_sorted; lo < hi; lo /= 2, hi /= 2)
+  {
+    if (lo & 1)
+    {
+      if (max_tree[lo] > best)
+        best = max_tree[lo];
+      lo++;
+    }
+    if (hi & 1)
+    {
+      hi--;
+      if (max_tree[hi] > best)
+        best = max_tree[hi];
+    }
+  }
+  return best;
+}
+
+/*
+   Compares an entry's first bytes with the prefix: 0 if the entry starts with it.
+*/
+static int compare_prefix(int entry, const char *prefix, int prefix_len)
+{
+  struct hist_entry *e = &entries[entry];
+  int n = e->len < prefix_len ? e->len : prefix_len;
+  int cmp = memcmp(e->text, prefix, n);
+  if (cmp != 0 || e->len >= prefix_len)
+    return cmp;
+  return -1; // a shorter entry that matches so far sorts before the prefix
+}
+
+/*
+- Append the command to the history file with one write under an exclusive lock,
+  and to the entries of this session.
+- Newlines would split the entry in the file, so they are stored as blanks.
+*/
+void add_to_history(char *cmd)
+{
+  history_load();
+
+  int len = strlen(cmd);
+  char *text = malloc(len + 1);
+  if (text == NULL)
+    return;
+  for (int i = 0; i < len; i++)
+    text[i] = cmd[i] == '\n' ? ' ' : cmd[i];
+  text[len] = '\n';
+  add_entry(text, len);
+  search_index_add(num_entries - 1);
+
+  if (history_fd >= 0)
+  {
+    flock(history_fd, LOCK_EX);
+    if (write(history_fd, text, len + 1) < 0)
+      perror("history");
+    flock(history_fd, LOCK_UN);
+  }
+}
+
+/*
+   Returns the text of entry i (not null-terminated) and sets its length.
+*/
+const char *history_entry(int i, int *len)
+{
+  *len = entries[i].len;
+  return entries[i].text;
+}
+
+/*
+   Returns the number of entries and sets the first one inside the history size.
+*/
+int history_window(int *first)
+{
+  history_load();
+  *first = first_entry();
+  return num_entries;
+}
+
+/*
+   Prints the last `count` commands, oldest first, numbered from the start of the history.
+*/
+void print_history(char **cmd_tokens)
+{
+  int count = MAX_HISTORY;
+  if (cmd_tokens[1] != NULL)
+    count = atoi(cmd_tokens[1]);
+
+  history_load();
+  int first = first_entry();
+  int start = num_entries - count > first ? num_entries - count : first;
+
+  printf("\nCommand History:\n");
+  for (int i = start; i < num_entries; i++)
+    printf("%d: %.*s\n", i + 1, entries[i].len, entries[i].text);
+}
+
+/*
+- Find the most recent command starting with the given prefix.
+- Commands added since the index was built are checked newest first, then the index.
+- Return a copy in the line arena, or NULL if no command matches.
+*/
+char *find_command_by_prefix(char *prefix)
+{
+  int prefix_len = strlen(prefix);
+
+  history_load();
+  if (!index_valid || num_entries - indexed > HISTORY_TAIL_MAX)
+    build_index();
+  int first = first_entry();
+
+  for (int i = num_entries - 1; i >= indexed && i >= first; i--)
+    if (compare_prefix(i, prefix, prefix_len) == 0)
+      return arena_strndup(&line_arena, entries[i].text, entries[i].len);
+
+  // sorted[lo, hi) are the distinct entries starting with the prefix
+  int lo = 0, hi = num_sorted;
+  while (lo < hi)
+  {
+    int mid = lo + (hi - lo) / 2;
+    if (compare_prefix(sorted[mid], prefix, prefix_len) < 0)
+      lo = mid + 1;
+    else
+      hi = mid;
+  }
+  int range_start = lo;
+  hi = num_sorted;
+  while (lo < hi)
+  {
+    int mid = lo + (hi - lo) / 2;
+    if (compare_prefix(sorted[mid], prefix, prefix_len) <= 0)
+      lo = mid + 1;
+    else
+      hi = mid;
+  }
+
+  int found = range_max(range_start, lo);
+  if (found < first)
+    return NULL;
+  return arena_strndup(&line_arena, entries[found].text, entries[found].len);
+}
+
+/*
+   Sets how many commands are kept for `history` and `!prefix`, from `set histsize=N`.
+*/
+int set_history_size(const char *value)
+{
+  char *end;
+  long size = strtol(value, &end, 10);
+  if (*value == '\0' || *end != '\0' || size <= 0 || size > INT_MAX)
+    return -1;
+  history_size = (int)size;
+  index_valid = 0; // the index covers the old window
+  return 0;
+}
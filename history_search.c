@@ -0,0 +1,363 @@
+#include "header.h"
+#include <math.h>
+#include <stdint.h>
+
+/*
+ * Substring search over the history for Ctrl-R. A trigram index maps every three
+ * case-folded bytes to the ascending list of entries containing them. A query of
+ * three bytes or more intersects the lists of its trigrams from the newest entry
+ * back (a leapfrog join, galloping through each list), checks each entry they all
+ * hold with a substring compare, and stops after SEARCH_CANDIDATES distinct
+ * commands, so one keystroke costs about the same however long the history is.
+ * Shorter queries scan the newest entries directly.
+ *
+ * Candidates are ranked by how often the command was run and how long ago it was
+ * last run. The index is built on the first search and then kept up to date by
+ * add_to_history(), one entry at a time.
+ */
+
+#define SEARCH_CANDIDATES 64
+#define SEARCH_TRIGRAMS 32 // trigrams of a long query that take part in the join
+
+struct posting
+{
+  uint32_t trigram; // folded bytes + 1, 0 for an empty bucket
+  int *ids;         // entry numbers, ascending
+  int len, cap;
+};
+
+/* One distinct command text, represented by any of its entries */
+struct text_count
+{
+  int entry; // -1 for an empty bucket
+  int count;
+  int seen;  // search generation that already took this text
+};
+
+static struct posting *postings;
+static size_t postings_capacity, num_postings;
+static struct text_count *texts;
+static size_t texts_capacity, num_texts;
+static int index_built, indexed_upto, generation;
+
+static unsigned char fold_table[256]; // ASCII lower case, filled when the index is built
+
+static inline unsigned char fold(unsigned char c)
+{
+  return fold_table[c];
+}
+
+static uint32_t trigram_at(const char *s)
+{
+  return ((uint32_t)fold(s[0]) << 16 | (uint32_t)fold(s[1]) << 8 | fold(s[2])) + 1;
+}
+
+static size_t hash_u32(uint32_t key, size_t capacity)
+{
+  return (key * 2654435761u) & (capacity - 1);
+}
+
+static void *table_alloc(size_t count, size_t size)
+{
+  void *table = calloc(count, size);
+  if (table == NULL)
+  {
+    perror("history search");
+    exit(EXIT_FAILURE);
+  }
+  return table;
+}
+
+static struct posting *find_posting(uint32_t trigram, int create)
+{
+  if (create && (num_postings + 1) * 2 > postings_capacity)
+  {
+    struct posting *old = postings;
+    size_t old_capacity = postings_capacity;
+    postings_capacity = old_capacity ? old_capacity * 2 : 4096;
+    postings = table_alloc(postings_capacity, sizeof(struct posting));
+    for (size_t i = 0; i < old_capacity; i++)
+      if (old[i].trigram != 0)
+      {
+        size_t j = hash_u32(old[i].trigram, postings_capacity);
+        while (postings[j].trigram != 0)
+          j = (j + 1) & (postings_capacity - 1);
+        postings[j] = old[i];
+      }
+    free(old);
+  }
+  if (postings_capacity == 0)
+    return NULL;
+
+  size_t i = hash_u32(trigram, postings_capacity);
+  while (postings[i].trigram != 0 && postings[i].trigram != trigram)
+    i = (i + 1) & (postings_capacity - 1);
+  if (postings[i].trigram == 0)
+  {
+    if (!create)
+      return NULL;
+    postings[i].trigram = trigram;
+    num_postings++;
+  }
+  return &postings[i];
+}
+
+static size_t hash_text(const char *text, int len)
+{
+  size_t h = 2166136261u; // FNV-1a
+  for (int i = 0; i < len; i++)
+    h = (h ^ (unsigned char)text[i]) * 16777619u;
+  return h;
+}
+
+/* The bucket of the entry's text, empty if the text has not been seen */
+static struct text_count *find_text(int entry)
+{
+  int len;
+  const char *text = history_entry(entry, &len);
+  size_t i = hash_text(text, len) & (texts_capacity - 1);
+  while (texts[i].entry >= 0)
+  {
+    int other_len;
+    const char *other = history_entry(texts[i].entry, &other_len);
+    if (other_len == len && memcmp(other, text, len) == 0)
+      break;
+    i = (i + 1) & (texts_capacity - 1);
+  }
+  return &texts[i];
+}
+
+static void count_text(int entry)
+{
+  if ((num_texts + 1) * 2 > texts_capacity)
+  {
+    struct text_count *old = texts;
+    size_t old_capacity = texts_capacity;
+    texts_capacity = old_capacity ? old_capacity * 2 : 4096;
+    texts = table_alloc(texts_capacity, sizeof(struct text_count));
+    for (size_t i = 0; i < texts_capacity; i++)
+      texts[i].entry = -1;
+    for (size_t i = 0; i < old_capacity; i++)
+      if (old[i].entry >= 0)
+        *find_text(old[i].entry) = old[i];
+    free(old);
+  }
+
+  struct text_count *t = find_text(entry);
+  if (t->entry < 0)
+  {
+    t->entry = entry;
+    num_texts++;
+  }
+  t->count++;
+}
+
+/*
+   Adds one entry to the trigram lists and the command counts.
+*/
+static void index_entry(int entry)
+{
+  int len;
+  const char *text = history_entry(entry, &len);
+  for (int i = 0; i + 3 <= len; i++)
+  {
+    struct posting *p = find_posting(trigram_at(text + i), 1);
+    if (p->len > 0 && p->ids[p->len - 1] == entry)
+      continue; // trigram repeated within the entry
+    if (p->len == p->cap)
+    {
+      p->cap = p->cap ? p->cap * 2 : 4;
+      p->ids = realloc(p->ids, sizeof(int) * p->cap);
+      if (p->ids == NULL)
+      {
+        perror("history search");
+        exit(EXIT_FAILURE);
+      }
+    }
+    p->ids[p->len++] = entry;
+  }
+  count_text(entry);
+  indexed_upto = entry + 1;
+}
+
+/*
+   Keeps a built index current with a command just added to the history.
+*/
+void search_index_add(int entry)
+{
+  if (index_built)
+    index_entry(entry);
+}
+
+static void build_search_index(void)
+{
+  int first, count = history_window(&first);
+  for (int c = 0; c < 256; c++)
+    fold_table[c] = (c >= 'A' && c <= 'Z') ? c - 'A' + 'a' : c;
+  index_built = 1;
+  for (int i = first; i < count; i++)
+    index_entry(i);
+}
+
+/* Case-insensitive substring test on a text that is not null-terminated */
+static int contains_folded(const char *text, int len, const char *query, int query_len)
+{
+  for (int i = 0; i + query_len <= len; i++)
+  {
+    int j = 0;
+    while (j < query_len && fold(text[i + j]) == fold(query[j]))
+      j++;
+    if (j == query_len)
+      return 1;
+  }
+  return 0;
+}
+
+/*
+   Returns the position of the latest entry not after target in a posting list,
+   searching back from pos by galloping, or -1 if there is none.
+*/
+static int seek_back(struct posting *p, int pos, int target)
+{
+  if (pos < 0 || p->ids[pos] <= target)
+    return pos;
+
+  // ids[pos] > target: widen the step until it lands at or before target
+  int step = 1, high = pos;
+  while (pos - step >= 0 && p->ids[pos - step] > target)
+  {
+    high = pos - step;
+    step *= 2;
+  }
+  int low = pos - step < 0 ? -1 : pos - step; // ids[low] <= target, or before the list
+
+  // ids[high] > target: binary search (low, high)
+  while (high - low > 1)
+  {
+    int mid = low + (high - low) / 2;
+    if (p->ids[mid] <= target)
+      low = mid;
+    else
+      high = mid;
+  }
+  return low;
+}
+
+struct candidate
+{
+  int entry;
+  double score;
+};
+
+static int compare_candidates(const void *x, const void *y)
+{
+  const struct candidate *a = x, *b = y;
+  if (a->score != b->score)
+    return a->score < b->score ? 1 : -1;
+  return b->entry - a->entry;
+}
+
+/*
+   Takes a matching entry as a candidate unless its text already is one.
+   Entries are visited newest first, so each text is taken at its latest use.
+*/
+static int take_candidate(struct candidate *found, int num_found, int entry, int newest)
+{
+  struct text_count *t = find_text(entry);
+  if (t->entry < 0 || t->seen == generation)
+    return num_found;
+  t->seen = generation;
+
+  // frequent commands rise, old ones sink: each doubling of either weighs the same
+  double age = newest - entry;
+  found[num_found].entry = entry;
+  found[num_found].score = log2(1 + t->count) - log2(1 + age / 32);
+  return num_found + 1;
+}
+
+/*
+- Find history entries containing the query, ignoring case.
+- Store up to max entry numbers in results, best first, and return how many.
+*/
+int history_search(const char *query, int *results, int max)
+{
+  int query_len = strlen(query);
+  int first, count = history_window(&first);
+  if (query_len == 0 || count == 0)
+    return 0;
+
+  if (!index_built)
+    build_search_index();
+  for (int i = indexed_upto; i < count; i++)
+    index_entry(i);
+  generation++;
+
+  struct candidate found[SEARCH_CANDIDATES];
+  int num_found = 0;
+  int len;
+  const char *text;
+
+  if (query_len < 3)
+  {
+    for (int i = count - 1; i >= first && num_found < SEARCH_CANDIDATES; i--)
+    {
+      text = history_entry(i, &len);
+      if (contains_folded(text, len, query, query_len))
+        num_found = take_candidate(found, num_found, i, count - 1);
+    }
+  }
+  else
+  {
+    // every match holds every trigram of the query: intersect their lists
+    struct posting *lists[SEARCH_TRIGRAMS];
+    int pos[SEARCH_TRIGRAMS], num_lists = 0;
+    for (int i = 0; i + 3 <= query_len && num_lists < SEARCH_TRIGRAMS; i++)
+    {
+      struct posting *p = find_posting(trigram_at(query + i), 0);
+      if (p == NULL)
+        return 0;
+      int dup = 0;
+      for (int j = 0; j < num_lists; j++)
+        dup |= (lists[j] == p);
+      if (!dup)
+      {
+        pos[num_lists] = p->len - 1;
+        lists[num_lists++] = p;
+      }
+    }
+
+    // leapfrog join from the newest entry down: each list in turn skips to the
+    // latest entry not after the current target, until all of them agree
+    int target = count - 1, agreed = 0;
+    for (int i = 0; num_found < SEARCH_CANDIDATES && target >= first; i = (i + 1) % num_lists)
+    {
+      int at = seek_back(lists[i], pos[i], target);
+      if (at < 0)
+        break;
+      pos[i] = at;
+      if (lists[i]->ids[at] < target)
+      {
+        target = lists[i]->ids[at];
+        agreed = 1;
+      }
+      else if (++agreed < num_lists)
+        continue;
+
+      if (agreed == num_lists && target >= first)
+      {
+        text = history_entry(target, &len);
+        if (contains_folded(text, len, query, query_len))
+          num_found = take_candidate(found, num_found, target, count - 1);
+        target--;
+        agreed = 0;
+      }
+    }
+  }
+
+  qsort(found, num_found, sizeof(struct candidate), compare_candidates);
+  if (num_found > max)
+    num_found = max;
+  for (int i = 0; i < num_found; i++)
+    results[i] = found[i].entry;
+  return num_found;
+}
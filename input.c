@@ -0,0 +1,184 @@
+#include "header.h"
+#include <sys/mman.h>
+
+/*
+ * Where command lines come from: the terminal, a script file, commands piped on
+ * stdin, or the string given to -c. Input is read in large blocks with read(2)
+ * and split into lines in the buffer, so a script costs one system call per
+ * block, not one stdio call per line. The buffer doubles whenever a line does
+ * not fit, so lines of any length are read whole; script files are mapped
+ * instead of read. Lines typed on a terminal go through the line editor.
+ */
+
+static int input_fd = -1;   // -1 once the source has no more data to read
+static char *input_buf;     // bytes read but not yet returned as lines
+static size_t input_start, input_end, input_cap;
+static size_t input_scanned; // bytes after input_start known to hold no newline
+static int input_edit;       // a terminal read through the line editor
+
+/*
+   Reads command lines from fd, which is stdin or a script that cannot be mapped.
+*/
+void input_open(int fd)
+{
+  input_fd = fd;
+  input_cap = INPUT_BLOCK_SIZE;
+  input_buf = malloc(input_cap);
+  if (input_buf == NULL)
+  {
+    perror("input");
+    exit(EXIT_FAILURE);
+  }
+  input_start = input_end = input_scanned = 0;
+}
+
+/*
+   Reads command lines typed on a terminal, through the line editor.
+*/
+void input_open_terminal(int fd)
+{
+  input_open(fd);
+  input_edit = 1;
+}
+
+/*
+   Called once the prompt is shown: the line editor takes the terminal from here.
+*/
+void input_start_line(void)
+{
+  if (input_edit && input_fd >= 0)
+    edit_start(input_fd);
+}
+
+/*
+   Reads command lines from a script file. A non-empty regular file is mapped
+   and split in place, so it is never copied into the buffer or grown.
+*/
+void input_open_script(int fd)
+{
+  struct stat st;
+  if (fstat(fd, &st) == 0 && S_ISREG(st.st_mode) && st.st_size > 0)
+  {
+    void *map = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    if (map != MAP_FAILED)
+    {
+      close(fd);
+      input_fd = -1;
+      input_buf = map;
+      input_start = input_scanned = 0;
+      input_end = input_cap = st.st_size;
+      return;
+    }
+  }
+  input_open(fd);
+}
+
+/*
+   Reads command lines from a string, for -c. Nothing is read from any file.
+*/
+void input_open_string(const char *cmds)
+{
+  input_fd = -1;
+  input_buf = strdup(cmds);
+  input_start = input_scanned = 0;
+  input_end = input_cap = strlen(cmds);
+}
+
+int input_source_fd(void)
+{
+  return input_fd;
+}
+
+/*
+   Returns the next newline at or after input_start, or NULL, scanning only
+   bytes not already searched by an earlier call.
+*/
+static char *find_newline(void)
+{
+  char *start = input_buf + input_start;
+  char *newline = memchr(start + input_scanned, '\n', input_end - input_start - input_scanned);
+  input_scanned = newline ? 0 : input_end - input_start;
+  return newline;
+}
+
+/*
+   Returns 1 if a whole line is already waiting in the input buffer,
+   so the caller must not block on the input before reading it.
+*/
+int input_buffered(void)
+{
+  if (input_edit)
+    return edit_pending();
+  if (input_fd < 0 && input_end > input_start)
+    return 1;
+  return find_newline() != NULL;
+}
+
+/*
+- Return the next line from the input buffer, reading another block when no full line is buffered.
+- The buffer is doubled when the partial line fills it, so a line is never split.
+- Check for signal interruptions and retry reading if necessary.
+- Return the line, copied into the line arena, or NULL at the end of the input.
+*/
+char *read_command_line(void)
+{
+  if (input_edit)
+  {
+    char *line = input_fd >= 0 ? edit_line(input_fd) : NULL;
+    if (line == NULL)
+      input_fd = -1;
+    return line;
+  }
+
+  while (1)
+  {
+    char *start = input_buf + input_start;
+    size_t avail = input_end - input_start;
+    char *newline = find_newline();
+
+    if (newline != NULL)
+    {
+      size_t len = (size_t)(newline - start) + 1;
+      input_start += len;
+      return arena_strndup(&line_arena, start, len);
+    }
+
+    ssize_t n = 0;
+    if (input_fd >= 0)
+    {
+      // move the partial line to the front, make room, and read a block after it
+      memmove(input_buf, start, avail);
+      start = input_buf;
+      input_start = 0;
+      input_end = avail;
+      if (input_cap - input_end < INPUT_BLOCK_SIZE / 2)
+      {
+        char *grown = realloc(input_buf, input_cap * 2);
+        if (grown == NULL)
+        {
+          perror("input");
+          exit(EXIT_FAILURE);
+        }
+        input_buf = start = grown;
+        input_cap *= 2;
+      }
+      n = read(input_fd, input_buf + input_end, input_cap - input_end);
+    }
+
+    if (n > 0)
+      input_end += n;
+    else if (n < 0 && errno == EINTR)
+      continue; // signal interruption, read again
+    else
+    {
+      if (n < 0)
+        perror("Error reading input");
+      input_fd = -1;
+      if (avail == 0)
+        return NULL;
+      input_start = input_end; // last line without a newline
+      input_scanned = 0;
+      return arena_strndup(&line_arena, start, avail);
+    }
+  }
+}
@@ -0,0 +1,484 @@
+#include "header.h"
+#include <ctype.h>
+#include <strings.h>
+
+/*
+ * Job control builtins over the job table: jobs, fg, bg, kill and wait.
+ *
+ * A job is named by %n (the job number `jobs` shows), %+ or %% (the current job),
+ * %- (the one before), %name (the job whose command starts with name) or %?text
+ * (the one containing text). The current job is the latest one stopped, or else
+ * the latest started.
+ *
+ * Background jobs that end are kept in a queue until waited for, so `wait -n`
+ * returns the status of a job that ended before it was called, and a pool of
+ * workers can start a new job each time one ends:
+ *
+ *   while ...; do  wait -n; worker &  done
+ *
+ * wait sleeps on the SIGCHLD events of the event loop and returns 130 on Ctrl-C.
+ */
+
+struct signal_name
+{
+  const char *name;
+  int number;
+};
+
+static const struct signal_name signal_names[] = {
+    {"HUP", SIGHUP},   {"INT", SIGINT},   {"QUIT", SIGQUIT}, {"ILL", SIGILL},   {"TRAP", SIGTRAP},
+    {"ABRT", SIGABRT}, {"BUS", SIGBUS},   {"FPE", SIGFPE},   {"KILL", SIGKILL}, {"USR1", SIGUSR1},
+    {"SEGV", SIGSEGV}, {"USR2", SIGUSR2}, {"PIPE", SIGPIPE}, {"ALRM", SIGALRM}, {"TERM", SIGTERM},
+    {"CHLD", SIGCHLD}, {"CONT", SIGCONT}, {"STOP", SIGSTOP}, {"TSTP", SIGTSTP}, {"TTIN", SIGTTIN},
+    {"TTOU", SIGTTOU}, {"URG", SIGURG},   {"XCPU", SIGXCPU}, {"XFSZ", SIGXFSZ}, {"WINCH", SIGWINCH},
+};
+
+#define NUM_SIGNAL_NAMES (int)(sizeof(signal_names) / sizeof(signal_names[0]))
+
+/*
+   Turns a wait status into a command's exit code: 128 plus the signal number for
+   a process killed or stopped by a signal.
+*/
+int exit_code(int status)
+{
+  if (WIFEXITED(status))
+    return WEXITSTATUS(status);
+  if (WIFSTOPPED(status))
+    return 128 + WSTOPSIG(status);
+  return 128 + WTERMSIG(status);
+}
+
+/*
+- Find the job named by a job spec (the current job if spec is NULL).
+- Print an error prefixed with the builtin's name and return NULL if there is none.
+*/
+static struct job *find_job_spec(const char *spec, const char *builtin)
+{
+  struct job *job = NULL;
+  if (spec == NULL || strcmp(spec, "%") == 0 || strcmp(spec, "%%") == 0 || strcmp(spec, "%+") == 0)
+    job = current_job(0);
+  else if (strcmp(spec, "%-") == 0)
+    job = current_job(1);
+  else if (spec[0] == '%' && isdigit((unsigned char)spec[1]))
+  {
+    job = find_job_number(atoi(spec + 1));
+    if (job != NULL && job->parallel_slot >= 0)
+      job = NULL;
+  }
+  else if (spec[0] == '%')
+  {
+    // %name matches a prefix of the command, %?text any part of it; it must name one job
+    int substring = (spec[1] == '?');
+    const char *text = spec + 1 + substring;
+    struct job **list = arena_alloc(&line_arena, sizeof(struct job *) * (live_job_count() + 1));
+    int count = list_jobs(list);
+    for (int i = 0; i < count; i++)
+    {
+      const char *name = list[i]->name;
+      if (substring ? strstr(name, text) == NULL : strncmp(name, text, strlen(text)) != 0)
+        continue;
+      if (job != NULL)
+      {
+        fprintf(stderr, "%s: %s: ambiguous job spec\n", builtin, spec);
+        return NULL;
+      }
+      job = list[i];
+    }
+  }
+  else
+  {
+    fprintf(stderr, "%s: %s: not a job spec\n", builtin, spec);
+    return NULL;
+  }
+
+  if (job == NULL)
+    fprintf(stderr, spec ? "%s: %s: no such job\n" : "%s: no current job\n", builtin, spec);
+  return job;
+}
+
+/* '+' for the current job, '-' for the previous one */
+static char job_mark(struct job *job)
+{
+  if (job == current_job(0))
+    return '+';
+  if (job == current_job(1))
+    return '-';
+  return ' ';
+}
+
+/*
+   Sends a signal to every process of a job: to its process group when it has one
+   of its own, else to each process, since they share the shell's group.
+*/
+static int signal_job(struct job *job, int signum)
+{
+  if (job_control && job->pgid > 0)
+    return kill(-job->pgid, signum);
+
+  int result = -1;
+  for (process_info *p = process_at(job->first_proc); p != NULL; p = process_at(p->next_in_job))
+    if (kill(p->pid, signum) == 0)
+      result = 0;
+  return result;
+}
+
+/* Sends SIGCONT to a job and clears its stopped marks */
+static void continue_job(struct job *job)
+{
+  if (job->stopped)
+    signal_job(job, SIGCONT);
+  for (process_info *p = process_at(job->first_proc); p != NULL; p = process_at(p->next_in_job))
+    if (p->stopped)
+      set_stopped(p->pid, 0);
+}
+
+/*
+- Give the terminal to a job and wait until all of its processes end or it stops,
+  then take the terminal back.
+- A job that stops stays in the table and is announced with its id.
+- Return the exit code of its last stage.
+*/
+int wait_foreground(struct job *job)
+{
+  int job_id = job->id;
+  pid_t last_pid = job->last_pid;
+
+  // reaping removes processes from the job's list, so take the pids first
+  int count = 0;
+  for (process_info *p = process_at(job->first_proc); p != NULL; p = process_at(p->next_in_job))
+    count++;
+  pid_t *pids = arena_alloc(&line_arena, sizeof(pid_t) * (count + 1));
+  count = 0;
+  for (process_info *p = process_at(job->first_proc); p != NULL; p = process_at(p->next_in_job))
+    pids[count++] = p->pid;
+
+  if (job_control)
+    tcsetpgrp(shell, job->pgid);
+  fgpid = job->pgid;
+
+  int status, code = 0, stopped = 0;
+  for (int i = 0; i < count; i++)
+  {
+    struct rusage ru;
+    pid_t reaped;
+    while ((reaped = wait4(pids[i], &status, WUNTRACED, &ru)) < 0 && errno == EINTR)
+      ;
+    if (reaped <= 0)
+    {
+      // not a child any more: no status to report, as for a command that could not run
+      remove_process(pids[i]);
+      if (pids[i] == last_pid)
+        code = 127;
+      continue;
+    }
+
+    if (WIFSTOPPED(status))
+    {
+      set_stopped(pids[i], 1);
+      stopped = 1;
+    }
+    else
+      finish_process(pids[i], status, &ru);
+    if (pids[i] == last_pid)
+      code = exit_code(status);
+  }
+
+  if (job_control)
+    tcsetpgrp(shell, my_pgid);
+  fgpid = 0;
+
+  job = find_job(job_id);
+  if (stopped && job != NULL)
+  {
+    set_job_background(job, 1); // it is now one of the shell's jobs: `wait` covers it and its end is reported
+    fprintf(stderr, "\n[%d]+  Stopped                 %s\n", number_job(job), job->name);
+  }
+  return code;
+}
+
+/*
+   jobs [-l | -p]: lists the jobs, with their process group under -l, or only the
+   process group under -p.
+*/
+int jobs_builtin(char **cmd_tokens)
+{
+  int long_format = 0, pids_only = 0;
+  for (int i = 1; cmd_tokens[i] != NULL; i++)
+  {
+    if (strcmp(cmd_tokens[i], "-l") == 0)
+      long_format = 1;
+    else if (strcmp(cmd_tokens[i], "-p") == 0)
+      pids_only = 1;
+    else
+    {
+      fprintf(stderr, "jobs: usage: jobs [-l | -p]\n");
+      return 2;
+    }
+  }
+
+  // collect anything that ended meanwhile, so only live jobs are listed
+  reap_children();
+  report_jobs();
+
+  struct job **list = arena_alloc(&line_arena, sizeof(struct job *) * (live_job_count() + 1));
+  int count = list_jobs(list);
+  for (int i = 0; i < count; i++)
+  {
+    struct job *job = list[i];
+    const char *state = job->stopped ? "Stopped" : "Running";
+    if (pids_only)
+      printf("%d\n", job->pgid);
+    else if (long_format)
+      printf("[%d]%c %d %-24s%s%s\n", job->number, job_mark(job), job->pgid, state, job->name,
+             job->stopped ? "" : " &");
+    else
+      printf("[%d]%c  %-24s%s%s\n", job->number, job_mark(job), state, job->name, job->stopped ? "" : " &");
+  }
+  fflush(stdout);
+  return 0;
+}
+
+/*
+   fg [job]: continues a job in the foreground and waits for it.
+*/
+int fg_builtin(char **cmd_tokens)
+{
+  struct job *job = find_job_spec(cmd_tokens[1], "fg");
+  if (job == NULL)
+    return 1;
+
+  printf("%s\n", job->name);
+  fflush(stdout);
+  set_job_background(job, 0);
+  continue_job(job);
+  return wait_foreground(job);
+}
+
+/*
+   bg [job...]: continues stopped jobs in the background.
+*/
+int bg_builtin(char **cmd_tokens)
+{
+  int result = 0;
+  for (int i = 1; i == 1 || cmd_tokens[i] != NULL; i++)
+  {
+    struct job *job = find_job_spec(cmd_tokens[i], "bg");
+    if (job == NULL)
+    {
+      result = 1;
+      if (cmd_tokens[i] == NULL)
+        break;
+      continue;
+    }
+
+    set_job_background(job, 1);
+    continue_job(job);
+    touch_job(job);
+    printf("[%d]%c %s &\n", job->number, job_mark(job), job->name);
+    for (process_info *p = process_at(job->first_proc); p != NULL; p = process_at(p->next_in_job))
+      if (p->pidfd < 0)
+        watch_process(p->pid);
+    if (cmd_tokens[i] == NULL)
+      break;
+  }
+  fflush(stdout);
+  return result;
+}
+
+/* Parses a signal given as a number or a name, with or without SIG; -1 if unknown */
+static int parse_signal(const char *s)
+{
+  if (isdigit((unsigned char)s[0]))
+  {
+    char *end;
+    long n = strtol(s, &end, 10);
+    return (*end == '\0' && n >= 0 && n < NSIG) ? (int)n : -1;
+  }
+  if (strncasecmp(s, "SIG", 3) == 0)
+    s += 3;
+  for (int i = 0; i < NUM_SIGNAL_NAMES; i++)
+    if (strcasecmp(s, signal_names[i].name) == 0)
+      return signal_names[i].number;
+  return -1;
+}
+
+static void list_signals(void)
+{
+  for (int i = 0; i < NUM_SIGNAL_NAMES; i++)
+    printf("%2d) SIG%s%c", signal_names[i].number, signal_names[i].name,
+           (i % 5 == 4 || i == NUM_SIGNAL_NAMES - 1) ? '\n' : '\t');
+  fflush(stdout);
+}
+
+/*
+- kill [-s sig | -n num | -sig] job|pid...: signal jobs or processes, SIGTERM by default.
+- kill -l lists the signal names.
+- A stopped job is continued after the signal, so it can act on it.
+*/
+int kill_builtin(char **cmd_tokens)
+{
+  int signum = SIGTERM, i = 1;
+  const char *arg = cmd_tokens[1];
+
+  if (arg != NULL && strcmp(arg, "-l") == 0)
+  {
+    list_signals();
+    return 0;
+  }
+  if (arg != NULL && (strcmp(arg, "-s") == 0 || strcmp(arg, "-n") == 0) && cmd_tokens[2] != NULL)
+  {
+    signum = parse_signal(cmd_tokens[2]);
+    arg = cmd_tokens[2];
+    i = 3;
+  }
+  else if (arg != NULL && arg[0] == '-' && arg[1] != '\0')
+  {
+    signum = parse_signal(arg + 1);
+    i = 2;
+  }
+  if (signum < 0)
+  {
+    fprintf(stderr, "kill: %s: invalid signal specification\n", arg);
+    return 1;
+  }
+  if (cmd_tokens[i] == NULL)
+  {
+    fprintf(stderr, "kill: usage: kill [-s sig | -n num | -sig] pid | jobspec ... or kill -l\n");
+    return 2;
+  }
+
+  int result = 0;
+  for (; cmd_tokens[i] != NULL; i++)
+  {
+    const char *target = cmd_tokens[i];
+    if (target[0] == '%')
+    {
+      struct job *job = find_job_spec(target, "kill");
+      if (job == NULL)
+        result = 1;
+      else if (signal_job(job, signum) < 0)
+      {
+        fprintf(stderr, "kill: %s: %s\n", target, strerror(errno));
+        result = 1;
+      }
+      else if (job->stopped && signum != SIGCONT && signum != SIGSTOP && signum != SIGTSTP &&
+               signum != SIGTTIN && signum != SIGTTOU && signum != 0)
+        continue_job(job);
+      continue;
+    }
+
+    char *end;
+    long pid = strtol(target, &end, 10);
+    if (*end != '\0' || end == target)
+    {
+      fprintf(stderr, "kill: %s: arguments must be process or job IDs\n", target);
+      result = 1;
+    }
+    else if (kill((pid_t)pid, signum) < 0)
+    {
+      fprintf(stderr, "kill: (%ld) - %s\n", pid, strerror(errno));
+      result = 1;
+    }
+  }
+  return result;
+}
+
+/*
+- Wait for one job given by a job spec or a pid, which may have ended already.
+- Return its exit code, 127 if it is not a job of this shell, 130 on Ctrl-C.
+*/
+static int wait_for_one(const char *target)
+{
+  int job_id = 0, number = 0;
+  pid_t pid = 0;
+  struct done_job done;
+
+  if (target[0] == '%' && isdigit((unsigned char)target[1]) && find_job_number(atoi(target + 1)) == NULL)
+  {
+    number = atoi(target + 1); // may be an ended job still queued
+    if (number <= 0)
+    {
+      fprintf(stderr, "wait: %s: no such job\n", target);
+      return 127;
+    }
+  }
+  else if (target[0] == '%')
+  {
+    struct job *job = find_job_spec(target, "wait");
+    if (job == NULL)
+      return 127;
+    job_id = job->id;
+  }
+  else
+  {
+    char *end;
+    pid = strtol(target, &end, 10);
+    if (*end != '\0' || end == target || pid <= 0)
+    {
+      fprintf(stderr, "wait: `%s': not a pid or valid job spec\n", target);
+      return 2;
+    }
+    process_info *proc = find_process(pid);
+    if (proc != NULL)
+    {
+      job_id = proc->job_id;
+      pid = 0;
+    }
+  }
+
+  while (1)
+  {
+    if (take_done_job(job_id, number, pid, &done))
+      return exit_code(done.status);
+    struct job *job = job_id ? find_job(job_id) : NULL;
+    if (job == NULL || !job->background)
+      break;
+    if (job->stopped)
+      return 128 + SIGTSTP; // it would never end by itself
+    if (wait_child_event())
+      return 128 + SIGINT;
+  }
+
+  if (pid != 0)
+    fprintf(stderr, "wait: pid %d is not a child of this shell\n", pid);
+  else
+    fprintf(stderr, "wait: %s: no such job\n", target);
+  return 127;
+}
+
+/*
+- wait: wait for every background job, then forget the ended ones; return 0.
+- wait job|pid...: wait for each of them; return the exit code of the last.
+- wait -n: wait for the next background job to end, or take one that already
+  ended and was not waited for yet; return its exit code, 127 if there is none.
+*/
+int wait_builtin(char **cmd_tokens)
+{
+  if (cmd_tokens[1] != NULL && strcmp(cmd_tokens[1], "-n") == 0)
+  {
+    struct done_job done;
+    while (1)
+    {
+      if (take_done_job(0, 0, 0, &done))
+        return exit_code(done.status);
+      if (running_background_jobs() == 0)
+        return 127;
+      if (wait_child_event())
+        return 128 + SIGINT;
+    }
+  }
+
+  if (cmd_tokens[1] == NULL)
+  {
+    while (running_background_jobs() > 0)
+      if (wait_child_event())
+        return 128 + SIGINT;
+    clear_done_jobs();
+    return 0;
+  }
+
+  int code = 0;
+  for (int i = 1; cmd_tokens[i] != NULL; i++)
+    code = wait_for_one(cmd_tokens[i]);
+  return code;
+}
@@ -0,0 +1,502 @@
+#include "header.h"
+
+/*
+ * Job table. A job is one pipeline (or single command); each of its processes has
+ * a slot in the process table. Both tables grow on demand and recycle freed slots
+ * through a free list, and pids, job ids and job numbers are found through hash
+ * maps, so adding, looking up and reaping cost O(1) however many jobs the session
+ * has started.
+ *
+ * Every job has an id, its key in the table, but only one put in the background
+ * or stopped gets a number, the one `jobs` shows and %n names: a command run in
+ * the foreground uses none up, so numbers stay 1, 2, 3... for the jobs the user
+ * actually sees.
+ */
+
+/* Open-addressing map from a positive int key (pid or job id) to a slot index */
+struct int_map
+{
+  int *keys; // 0 marks an empty bucket
+  int *values;
+  size_t capacity, count;
+};
+
+static process_info *procs;
+static int procs_capacity, procs_free = -1;
+static struct job *jobs;
+static int jobs_capacity, jobs_free = -1;
+static struct int_map pid_map, job_map, number_map;
+
+static int next_job_id = 1;
+static int next_job_number = 1;
+static int live_jobs, numbered_jobs;
+static int running_background; // jobs with background set and not stopped, which `wait` waits for
+
+/* Numbered jobs, latest started, stopped or resumed first: %+ and %- are the first two, stopped ones first */
+static int stopped_head = -1, running_head = -1;
+
+/* Background jobs that ended, for `wait` and `wait -n`, oldest first */
+static struct done_job done_jobs[JOB_DONE_MAX];
+static int done_start, num_done_jobs;
+
+static size_t map_bucket(struct int_map *m, int key)
+{
+  return ((unsigned int)key * 2654435761u) & (m->capacity - 1);
+}
+
+static int map_get(struct int_map *m, int key)
+{
+  if (m->capacity == 0)
+    return -1;
+  for (size_t i = map_bucket(m, key);; i = (i + 1) & (m->capacity - 1))
+  {
+    if (m->keys[i] == key)
+      return m->values[i];
+    if (m->keys[i] == 0)
+      return -1;
+  }
+}
+
+static void map_put(struct int_map *m, int key, int value);
+
+/*
+   Rehashes into a table twice the size, keeping the load factor at or below one half.
+*/
+static void map_grow(struct int_map *m)
+{
+  struct int_map old = *m;
+  m->capacity = old.capacity ? old.capacity * 2 : 64;
+  m->count = 0;
+  m->keys = calloc(m->capacity, sizeof(int));
+  m->values = malloc(sizeof(int) * m->capacity);
+  if (m->keys == NULL || m->values == NULL)
+  {
+    perror("job table");
+    exit(EXIT_FAILURE);
+  }
+
+  for (size_t i = 0; i < old.capacity; i++)
+    if (old.keys[i] != 0)
+      map_put(m, old.keys[i], old.values[i]);
+  free(old.keys);
+  free(old.values);
+}
+
+static void map_put(struct int_map *m, int key, int value)
+{
+  if ((m->count + 1) * 2 > m->capacity)
+    map_grow(m);
+
+  size_t i = map_bucket(m, key);
+  while (m->keys[i] != 0 && m->keys[i] != key)
+    i = (i + 1) & (m->capacity - 1);
+  if (m->keys[i] == 0)
+    m->count++;
+  m->keys[i] = key;
+  m->values[i] = value;
+}
+
+/*
+   Removes key with backward-shift deletion, so probing never needs tombstones.
+*/
+static void map_remove(struct int_map *m, int key)
+{
+  if (m->capacity == 0)
+    return;
+
+  size_t mask = m->capacity - 1;
+  size_t i = map_bucket(m, key);
+  while (m->keys[i] != key)
+  {
+    if (m->keys[i] == 0)
+      return;
+    i = (i + 1) & mask;
+  }
+
+  size_t hole = i;
+  for (size_t j = (i + 1) & mask; m->keys[j] != 0; j = (j + 1) & mask)
+  {
+    size_t home = map_bucket(m, m->keys[j]);
+    // move j back into the hole unless its home lies cyclically in (hole, j]
+    if (((j - home) & mask) >= ((j - hole) & mask))
+    {
+      m->keys[hole] = m->keys[j];
+      m->values[hole] = m->values[j];
+      hole = j;
+    }
+  }
+  m->keys[hole] = 0;
+  m->count--;
+}
+
+/*
+   Doubles a slot array and threads the new slots onto its free list.
+*/
+static void *grow_slots(void *slots, int *capacity, size_t elem_size, size_t next_offset, int *free_list)
+{
+  int old = *capacity;
+  int grown = old ? old * 2 : 64;
+  char *bigger = realloc(slots, elem_size * grown);
+  if (bigger == NULL)
+  {
+    perror("job table");
+    exit(EXIT_FAILURE);
+  }
+
+  for (int i = grown - 1; i >= old; i--)
+  {
+    memset(bigger + elem_size * i, 0, elem_size);
+    *(int *)(bigger + elem_size * i + next_offset) = *free_list;
+    *free_list = i;
+  }
+  *capacity = grown;
+  return bigger;
+}
+
+/*
+- Start a new job for a pipeline or command and give it the next job id.
+- Ids are never reused while an ended job can still be waited for by its id.
+- Return the job id.
+*/
+int add_job(char *name)
+{
+  if (jobs_free < 0)
+    jobs = grow_slots(jobs, &jobs_capacity, sizeof(struct job), offsetof(struct job, next_free), &jobs_free);
+
+  int slot = jobs_free;
+  struct job *job = &jobs[slot];
+  jobs_free = job->next_free;
+
+  live_jobs++;
+
+  job->id = next_job_id;
+  next_job_id = next_job_id == INT_MAX ? 1 : next_job_id + 1;
+  job->number = 0;
+  job->pgid = 0;
+  size_t len = strlen(name);
+  while (len > 0 && (name[len - 1] == '&' || name[len - 1] == ' ' || name[len - 1] == '\t'))
+    len--; // `jobs` adds " &" itself while the job runs
+  job->name = strndup(name, len);
+  job->live = 0;
+  job->parallel_slot = -1;
+  job->first_proc = -1;
+  job->last_pid = 0;
+  job->status = 0;
+  job->background = 0;
+  job->stopped = 0;
+  job->list_prev = job->list_next = -1;
+  job->next_free = -1;
+  map_put(&job_map, job->id, slot);
+  return job->id;
+}
+
+static int running_in_background(struct job *job)
+{
+  return job->background && !job->stopped;
+}
+
+/* Takes a numbered job out of its list, the stopped or the running one as it is now */
+static void unlink_job(struct job *job)
+{
+  int *head = job->stopped ? &stopped_head : &running_head;
+  if (job->list_prev >= 0)
+    jobs[job->list_prev].list_next = job->list_next;
+  else
+    *head = job->list_next;
+  if (job->list_next >= 0)
+    jobs[job->list_next].list_prev = job->list_prev;
+  job->list_prev = job->list_next = -1;
+}
+
+/* Puts a numbered job first in its list, making it the current job of its kind */
+static void push_job(struct job *job)
+{
+  int *head = job->stopped ? &stopped_head : &running_head;
+  int slot = job - jobs;
+  job->list_prev = -1;
+  job->list_next = *head;
+  if (*head >= 0)
+    jobs[*head].list_prev = slot;
+  *head = slot;
+}
+
+static void remove_job(struct job *job)
+{
+  if (running_in_background(job))
+    running_background--;
+  if (job->background)
+  {
+    // the oldest entry makes room once the queue is full
+    int slot = (done_start + num_done_jobs) % JOB_DONE_MAX;
+    if (num_done_jobs == JOB_DONE_MAX)
+      done_start = (done_start + 1) % JOB_DONE_MAX;
+    else
+      num_done_jobs++;
+    done_jobs[slot].id = job->id;
+    done_jobs[slot].number = job->number;
+    done_jobs[slot].last_pid = job->last_pid;
+    done_jobs[slot].status = job->status;
+  }
+  map_remove(&job_map, job->id);
+  if (job->number != 0)
+  {
+    unlink_job(job);
+    map_remove(&number_map, job->number);
+    numbered_jobs--;
+  }
+  free(job->name);
+  job->name = NULL;
+  job->id = 0;
+  job->number = 0;
+  job->next_free = jobs_free;
+  jobs_free = job - jobs;
+  live_jobs--;
+}
+
+struct job *find_job(int job_id)
+{
+  int slot = map_get(&job_map, job_id);
+  return slot < 0 ? NULL : &jobs[slot];
+}
+
+/*
+- Give a job put in the background or stopped the next job number, if it has none.
+- Numbers restart at 1 once no numbered job is left, as in sh.
+- Return the job's number.
+*/
+int number_job(struct job *job)
+{
+  if (job->number != 0)
+    return job->number;
+  if (numbered_jobs == 0)
+    next_job_number = 1;
+  numbered_jobs++;
+  job->number = next_job_number++;
+  map_put(&number_map, job->number, job - jobs);
+  push_job(job);
+  return job->number;
+}
+
+/* The live job shown as [number], NULL if there is none */
+struct job *find_job_number(int number)
+{
+  int slot = number > 0 ? map_get(&number_map, number) : -1;
+  return slot < 0 ? NULL : &jobs[slot];
+}
+
+/*
+Adds a process of job `job_id` to the process table with its pid, name, and marks it as active.
+The first process added sets the job's process group.
+*/
+void add_process(int pid, int job_id, char *name)
+{
+  struct job *job = find_job(job_id);
+
+  if (procs_free < 0)
+    procs = grow_slots(procs, &procs_capacity, sizeof(process_info), offsetof(process_info, next_free), &procs_free);
+
+  int slot = procs_free;
+  process_info *proc = &procs[slot];
+  procs_free = proc->next_free;
+
+  proc->pid = pid;
+  proc->name = strdup(name);
+  proc->active = 1;
+  proc->job_id = job_id;
+  proc->pidfd = -1;
+  proc->stopped = 0;
+  proc->next_free = -1;
+  proc->next_in_job = -1;
+  proc->started = now_seconds();
+  if (job != NULL)
+  {
+    if (job->pgid == 0)
+      job->pgid = pid;
+    proc->pgid = job->pgid;
+    job->live++;
+    job->last_pid = pid; // processes are added in pipeline order
+
+    // append to the job's list, so its processes are visited in pipeline order
+    int *link = &job->first_proc;
+    while (*link >= 0)
+      link = &procs[*link].next_in_job;
+    *link = slot;
+  }
+  map_put(&pid_map, pid, slot);
+}
+
+process_info *find_process(int pid)
+{
+  int slot = map_get(&pid_map, pid);
+  return slot < 0 ? NULL : &procs[slot];
+}
+
+/*
+Removes a reaped process from the table by its pid and recycles its slot.
+The job goes away with its last process.
+*/
+void remove_process(int pid)
+{
+  int slot = map_get(&pid_map, pid);
+  if (slot < 0)
+    return;
+
+  process_info *proc = &procs[slot];
+  struct job *job = find_job(proc->job_id);
+  if (job != NULL)
+  {
+    int *link = &job->first_proc;
+    while (*link >= 0 && *link != slot)
+      link = &procs[*link].next_in_job;
+    if (*link == slot)
+      *link = proc->next_in_job;
+    if (--job->live == 0)
+      remove_job(job);
+  }
+
+  map_remove(&pid_map, pid);
+  free(proc->name);
+  proc->name = NULL;
+  proc->active = 0;
+  proc->next_free = procs_free;
+  procs_free = slot;
+}
+
+/*
+   Returns the process in a slot of the process table, following job->first_proc
+   and next_in_job, or NULL for -1.
+*/
+process_info *process_at(int slot)
+{
+  return slot < 0 ? NULL : &procs[slot];
+}
+
+/*
+   Records the exit status of a reaped process, before remove_process().
+   The status of a job is that of its last stage.
+*/
+void set_exit_status(int pid, int status)
+{
+  process_info *proc = find_process(pid);
+  struct job *job = proc ? find_job(proc->job_id) : NULL;
+  if (job != NULL && job->last_pid == pid)
+    job->status = status;
+}
+
+/*
+   Marks a process, and so its job, as stopped or continued; the job becomes the
+   current one of the stopped or of the running jobs.
+*/
+void set_stopped(int pid, int stopped)
+{
+  process_info *proc = find_process(pid);
+  if (proc == NULL)
+    return;
+  proc->stopped = stopped;
+  struct job *job = find_job(proc->job_id);
+  if (job == NULL)
+    return;
+  int was_running = running_in_background(job);
+  if (job->number != 0)
+    unlink_job(job);
+  job->stopped = 0;
+  for (process_info *p = process_at(job->first_proc); p != NULL; p = process_at(p->next_in_job))
+    job->stopped |= p->stopped;
+  if (job->number != 0)
+    push_job(job);
+  running_background += running_in_background(job) - was_running;
+}
+
+/* Moves a job to the front for %+, as `bg` does */
+void touch_job(struct job *job)
+{
+  if (job->number != 0)
+  {
+    unlink_job(job);
+    push_job(job);
+  }
+}
+
+/* Sets whether a job is one of the shell's background jobs, keeping count of those running */
+void set_job_background(struct job *job, int background)
+{
+  int was_running = running_in_background(job);
+  job->background = background;
+  running_background += running_in_background(job) - was_running;
+}
+
+/*
+- Return the current job (%+) or, with previous set, the one before it (%-).
+- A stopped job comes before a running one, then the latest started, stopped or resumed:
+  the heads of the two lists.
+*/
+struct job *current_job(int previous)
+{
+  int first = stopped_head >= 0 ? stopped_head : running_head;
+  if (first < 0 || !previous)
+    return first < 0 ? NULL : &jobs[first];
+  int second = jobs[first].list_next;
+  if (second < 0 && first == stopped_head)
+    second = running_head;
+  return second < 0 ? NULL : &jobs[second];
+}
+
+/*
+   Fills list with every live numbered job, by job number, and returns how many
+   there are. list must have room for live_job_count() jobs.
+*/
+int list_jobs(struct job **list)
+{
+  int count = 0;
+  for (int i = 0; i < jobs_capacity; i++)
+    if (jobs[i].number != 0 && jobs[i].parallel_slot < 0)
+      list[count++] = &jobs[i];
+  for (int i = 1; i < count; i++)
+    for (int j = i; j > 0 && list[j - 1]->number > list[j]->number; j--)
+    {
+      struct job *tmp = list[j];
+      list[j] = list[j - 1];
+      list[j - 1] = tmp;
+    }
+  return count;
+}
+
+int live_job_count(void)
+{
+  return live_jobs;
+}
+
+/* Number of background jobs still running, which `wait` waits for */
+int running_background_jobs(void)
+{
+  return running_background;
+}
+
+/*
+- Take the oldest ended background job matching job_id, number and pid (0 for any)
+  from the queue of ended jobs, into *done.
+- Return 0 if none is queued.
+*/
+int take_done_job(int job_id, int number, pid_t pid, struct done_job *done)
+{
+  for (int n = 0; n < num_done_jobs; n++)
+  {
+    int slot = (done_start + n) % JOB_DONE_MAX;
+    if ((job_id != 0 && done_jobs[slot].id != job_id) || (number != 0 && done_jobs[slot].number != number) ||
+        (pid != 0 && done_jobs[slot].last_pid != pid))
+      continue;
+    *done = done_jobs[slot];
+    // close the gap, keeping the order
+    for (int m = n; m + 1 < num_done_jobs; m++)
+      done_jobs[(done_start + m) % JOB_DONE_MAX] = done_jobs[(done_start + m + 1) % JOB_DONE_MAX];
+    num_done_jobs--;
+    return 1;
+  }
+  return 0;
+}
+
+/* Forgets every ended job, once `wait` has waited for all of them */
+void clear_done_jobs(void)
+{
+  num_done_jobs = 0;
+}
@@ -0,0 +1,248 @@
+#include "header.h"
+#include <spawn.h>
+
+extern char **environ;
+
+/*
+ * Starts the process for one simple command, either with posix_spawn (the default)
+ * or with the classic fork + exec. Both backends give the child the same setup:
+ * its process group, default signal handlers, pipe ends on stdin/stdout and then
+ * the command's own redirections, and the exported shell variables as its
+ * environment (var_environ(), rebuilt only when one of them changed). Switch with
+ * `set launch=fork` / `set launch=spawn`.
+ */
+
+enum launch_mode launch_mode = LAUNCH_SPAWN;
+
+/* Signals the shell ignores or catches, which children get back at their defaults */
+static const int child_default_signals[] = {SIGINT, SIGQUIT, SIGTSTP, SIGTTIN, SIGTTOU, SIGCHLD};
+
+/*
+- Child side of the fork backend: join the process group, restore signals,
+  connect pipe ends and redirections, then exec. Never returns.
+*/
+static void exec_child(struct launch *spec)
+{
+  if (job_control)
+  {
+    setpgid(0, spec->pgid); // 0 leads a new group with the child's own pid
+
+    // Assign terminal control to process if it's not running in the background
+    if (spec->foreground)
+      tcsetpgrp(shell, getpgrp());
+  }
+
+  // Restore default signal handlers in the child process and unblock what the shell blocks
+  sigset_t empty;
+  sigemptyset(&empty);
+  for (size_t i = 0; i < sizeof(child_default_signals) / sizeof(child_default_signals[0]); i++)
+    signal(child_default_signals[i], SIG_DFL);
+  sigprocmask(SIG_SETMASK, &empty, NULL);
+
+  if (spec->in_fd >= 0)
+  {
+    dup2(spec->in_fd, STDIN_FILENO);
+    close(spec->in_fd);
+  }
+  if (spec->out_fd >= 0)
+  {
+    dup2(spec->out_fd, STDOUT_FILENO);
+    close(spec->out_fd);
+  }
+  if (spec->close_fd >= 0)
+    close(spec->close_fd);
+
+  if (apply_redirects(spec->redirects) < 0) // Handle input/output redirect
+    _exit(-1);
+
+  // A command made only of redirections just creates/truncates its files
+  if (spec->argv[0] == NULL)
+    _exit(0);
+
+  environ = var_environ(); // also the PATH execvp searches
+  if (spec->path == NULL)
+    errno = ENOENT;
+  else
+  {
+    execv(spec->path, spec->argv);
+    if (errno == ENOENT) // the remembered path went away, search PATH again
+      execvp(spec->argv[0], spec->argv);
+  }
+  perror("Error executing command!\n");
+  _exit(-1);
+}
+
+static pid_t fork_process(struct launch *spec)
+{
+  pid_t pid = fork();
+  if (pid < 0)
+  {
+    perror("Child Process not created\n");
+    return -1;
+  }
+  if (pid == 0)
+    exec_child(spec);
+  return pid;
+}
+
+/*
+- posix_spawn backend: express the same child setup as spawn attributes
+  (process group, default signals, empty mask) and file actions
+  (pipe dup2/close, then the redirections in source order, a here-document
+  as a dup2 of the file the shell made for it).
+- The C library can use vfork/CLONE_VM, so no page tables are copied.
+- The executable comes from the PATH cache, so there is a single execve.
+- Spawn errors, including a failed open or exec, are reported here since no child is left behind.
+*/
+static pid_t spawn_process(struct launch *spec)
+{
+  posix_spawnattr_t attr;
+  posix_spawn_file_actions_t actions;
+  sigset_t defaults, empty;
+  pid_t pid = -1;
+
+  sigemptyset(&defaults);
+  for (size_t i = 0; i < sizeof(child_default_signals) / sizeof(child_default_signals[0]); i++)
+    sigaddset(&defaults, child_default_signals[i]);
+  sigemptyset(&empty);
+
+  posix_spawnattr_init(&attr);
+  posix_spawnattr_setflags(&attr, (job_control ? POSIX_SPAWN_SETPGROUP : 0) | POSIX_SPAWN_SETSIGDEF | POSIX_SPAWN_SETSIGMASK);
+  posix_spawnattr_setpgroup(&attr, spec->pgid);
+  posix_spawnattr_setsigdefault(&attr, &defaults);
+  posix_spawnattr_setsigmask(&attr, &empty);
+
+  posix_spawn_file_actions_init(&actions);
+#ifdef __GLIBC__
+#if __GLIBC_PREREQ(2, 35)
+  // Hand over the terminal before exec, as the fork backend does
+  if (spec->foreground && job_control)
+    posix_spawn_file_actions_addtcsetpgrp_np(&actions, shell);
+#endif
+#endif
+  if (spec->in_fd >= 0)
+  {
+    posix_spawn_file_actions_adddup2(&actions, spec->in_fd, STDIN_FILENO);
+    posix_spawn_file_actions_addclose(&actions, spec->in_fd);
+  }
+  if (spec->out_fd >= 0)
+  {
+    posix_spawn_file_actions_adddup2(&actions, spec->out_fd, STDOUT_FILENO);
+    posix_spawn_file_actions_addclose(&actions, spec->out_fd);
+  }
+  if (spec->close_fd >= 0)
+    posix_spawn_file_actions_addclose(&actions, spec->close_fd);
+
+  // here-documents are files the shell makes and the child gets as its stdin
+  int *here_fds = NULL, num_here = 0, here_failed = 0;
+  for (struct redirect *redir = spec->redirects; redir != NULL; redir = redir->next)
+  {
+    if (redir->type == REDIR_HERE_DOC || redir->type == REDIR_HERE_STRING)
+    {
+      int fd = open_here_document(redir);
+      if (fd < 0)
+      {
+        here_failed = 1;
+        break;
+      }
+      here_fds = arena_realloc(&line_arena, here_fds, sizeof(int) * num_here, sizeof(int) * (num_here + 1));
+      here_fds[num_here++] = fd;
+      posix_spawn_file_actions_adddup2(&actions, fd, STDIN_FILENO);
+    }
+    else if (redir->type == REDIR_INPUT)
+      posix_spawn_file_actions_addopen(&actions, STDIN_FILENO, redir->file, O_RDONLY, 0);
+    else if (redir->type == REDIR_APPEND)
+      posix_spawn_file_actions_addopen(&actions, STDOUT_FILENO, redir->file, O_CREAT | O_WRONLY | O_APPEND, S_IRWXU);
+    else
+      posix_spawn_file_actions_addopen(&actions, STDOUT_FILENO, redir->file, O_CREAT | O_WRONLY | O_TRUNC, S_IRWXU);
+  }
+
+  int err = here_failed ? 0 : ENOENT; // a failed here-document is already reported
+  if (spec->path != NULL && !here_failed)
+  {
+    err = posix_spawn(&pid, spec->path, &actions, &attr, spec->argv, var_environ());
+
+    // the remembered path went away: forget it and search PATH once more
+    if (err == ENOENT && spec->path != spec->argv[0])
+    {
+      path_forget(spec->argv[0]);
+      spec->path = path_lookup(spec->argv[0]);
+      if (spec->path != NULL)
+        err = posix_spawn(&pid, spec->path, &actions, &attr, spec->argv, var_environ());
+    }
+  }
+
+  if (err != 0)
+  {
+    // name the input file when that is what failed to open
+    const char *what = spec->argv[0];
+    for (struct redirect *redir = spec->redirects; redir != NULL; redir = redir->next)
+      if (redir->type == REDIR_INPUT && access(redir->file, R_OK) < 0)
+      {
+        what = redir->file;
+        break;
+      }
+    fprintf(stderr, "Error executing command!: %s: %s\n", what, strerror(err));
+    pid = -1;
+  }
+  for (int i = 0; i < num_here; i++)
+    close(here_fds[i]);
+
+  posix_spawn_file_actions_destroy(&actions);
+  posix_spawnattr_destroy(&attr);
+  return pid;
+}
+
+/*
+- Start one process for spec with the selected backend.
+- Resolve the command through the PATH cache here in the parent, so both backends
+  exec the remembered path and the cache survives the child.
+- A command with no words (redirections only) always goes through fork.
+- The forked child cannot tell the shell that a remembered path went away, so for
+  fork the path is checked here first and dropped from the cache if it is gone, as
+  spawn_process() does after a failed spawn.
+- With job control the parent also sets the process group, so it is in place whichever side runs first.
+- Flush stdout first, so builtin output stays ahead of the child's and is not copied by fork.
+- Return the child's pid, or -1 if it could not be started.
+*/
+pid_t launch_process(struct launch *spec)
+{
+  pid_t pid;
+  fflush(stdout);
+  spec->path = spec->argv[0] ? path_lookup(spec->argv[0]) : NULL;
+
+  if (launch_mode == LAUNCH_SPAWN && spec->argv[0] != NULL)
+    pid = spawn_process(spec);
+  else
+  {
+    if (spec->path != NULL && spec->path != spec->argv[0] && access(spec->path, X_OK) < 0 && errno == ENOENT)
+    {
+      path_forget(spec->argv[0]);
+      spec->path = path_lookup(spec->argv[0]);
+    }
+    pid = fork_process(spec);
+  }
+
+  if (pid > 0 && job_control)
+    setpgid(pid, spec->pgid ? spec->pgid : pid);
+  return pid;
+}
+
+/*
+   Parses the value of `set launch=...`. Returns 0 on success, -1 for an unknown backend.
+*/
+int set_launch_mode(const char *value)
+{
+  if (strcmp(value, "spawn") == 0)
+    launch_mode = LAUNCH_SPAWN;
+  else if (strcmp(value, "fork") == 0)
+    launch_mode = LAUNCH_FORK;
+  else
+    return -1;
+  return 0;
+}
+
+const char *launch_mode_name(void)
+{
+  return launch_mode == LAUNCH_SPAWN ? "spawn" : "fork";
+}
@@ -0,0 +1,280 @@
+#include "header.h"
+#include <termios.h>
+
+/*
+ * Line editing on the terminal. While a line is typed the terminal is in raw mode
+ * and keys are handled here: typing and Backspace edit the line, Ctrl-U clears it,
+ * Ctrl-C starts over on a fresh prompt, Ctrl-D on an empty line ends the input,
+ * and Ctrl-R starts an incremental search of the history. The terminal is put back
+ * as it was before the line is run.
+ *
+ * In search mode every key updates the query and the best match is shown at once.
+ * Ctrl-R again steps to the next match, Enter runs the match, Ctrl-G or Ctrl-C
+ * return to the line as it was, and any other key keeps the match for editing.
+ */
+
+#define KEY_CTRL(c) ((c) & 0x1f)
+#define KEY_BACKSPACE 127
+#define KEY_ESC 27
+#define SEARCH_RESULTS 64
+
+static char pending[256]; // bytes read from the terminal, not handled yet
+static int pending_start, pending_end;
+
+struct edit_buffer
+{
+  char *text;
+  size_t len, cap;
+};
+
+static struct edit_buffer line, query;
+static struct termios saved_termios;
+static int raw_mode;
+
+static void buffer_add(struct edit_buffer *b, const char *s, size_t n)
+{
+  if (b->len + n + 1 > b->cap)
+  {
+    size_t cap = b->cap ? b->cap * 2 : 256;
+    while (cap < b->len + n + 1)
+      cap *= 2;
+    char *grown = realloc(b->text, cap);
+    if (grown == NULL)
+      return;
+    b->text = grown;
+    b->cap = cap;
+  }
+  memcpy(b->text + b->len, s, n);
+  b->len += n;
+  b->text[b->len] = '\0';
+}
+
+static void buffer_set(struct edit_buffer *b, const char *s, size_t n)
+{
+  b->len = 0;
+  buffer_add(b, s, n);
+}
+
+/* Removes the last character, with its UTF-8 continuation bytes */
+static void buffer_backspace(struct edit_buffer *b)
+{
+  while (b->len > 0 && ((unsigned char)b->text[--b->len] & 0xc0) == 0x80)
+    ;
+  if (b->text != NULL)
+    b->text[b->len] = '\0';
+}
+
+/*
+   Returns 1 if keys are waiting that the event loop cannot see on the terminal.
+*/
+int edit_pending(void)
+{
+  return pending_start < pending_end;
+}
+
+/* Next byte typed, or -1 at the end of the input */
+static int read_key(int fd)
+{
+  while (pending_start == pending_end)
+  {
+    ssize_t n = read(fd, pending, sizeof(pending));
+    if (n < 0 && errno == EINTR)
+      continue;
+    if (n <= 0)
+      return -1;
+    pending_start = 0;
+    pending_end = n;
+  }
+  return (unsigned char)pending[pending_start++];
+}
+
+/* Skips the rest of an escape sequence such as an arrow key */
+static void skip_escape(int fd)
+{
+  int c = read_key(fd);
+  if (c != '[' && c != 'O')
+    return;
+  while ((c = read_key(fd)) >= 0 && !(c >= 0x40 && c <= 0x7e))
+    ;
+}
+
+static void redraw(const char *head, const char *text, size_t len)
+{
+  printf("\r%s%.*s\x1b[K", head, (int)len, text);
+  fflush(stdout);
+}
+
+static void redraw_line(void)
+{
+  printf("\r%s ", prompt);
+  redraw("", line.text ? line.text : "", line.len);
+}
+
+static void redraw_search(int found, const char *match, int match_len)
+{
+  printf("\r(%sreverse-i-search)`%s': ", found ? "" : "failed ", query.text ? query.text : "");
+  redraw("", match, match_len);
+}
+
+/*
+- Incremental history search, entered with Ctrl-R.
+- Return 1 if Enter ran the match (it is then in `line`), 0 to go on editing, -1 at the end of the input.
+*/
+static int search_history(int fd)
+{
+  int results[SEARCH_RESULTS];
+  int num_results = 0, selected = 0;
+  struct edit_buffer saved = {0};
+  const char *match = "";
+  int match_len = 0;
+
+  buffer_set(&saved, line.text ? line.text : "", line.len);
+  buffer_set(&query, "", 0);
+  redraw_search(1, match, match_len);
+
+  while (1)
+  {
+    int c = read_key(fd), changed = 0;
+    if (c < 0)
+    {
+      free(saved.text);
+      return -1;
+    }
+
+    if (c == KEY_CTRL('R'))
+    {
+      if (selected + 1 < num_results)
+        selected++;
+    }
+    else if (c == KEY_BACKSPACE || c == KEY_CTRL('H'))
+    {
+      buffer_backspace(&query);
+      changed = 1;
+    }
+    else if (c == KEY_CTRL('G') || c == KEY_CTRL('C'))
+    {
+      buffer_set(&line, saved.text, saved.len);
+      free(saved.text);
+      redraw_line();
+      return 0;
+    }
+    else if (c == '\r' || c == '\n' || c < 32 || c == KEY_ESC)
+    {
+      // leave search mode with the match on the line
+      buffer_set(&line, match, match_len);
+      free(saved.text);
+      if (c == KEY_ESC)
+        skip_escape(fd);
+      redraw_line();
+      return c == '\r' || c == '\n';
+    }
+    else
+    {
+      char ch = (char)c;
+      buffer_add(&query, &ch, 1);
+      changed = 1;
+    }
+
+    if (changed)
+    {
+      num_results = history_search(query.text, results, SEARCH_RESULTS);
+      selected = 0;
+    }
+    if (num_results > 0)
+      match = history_entry(results[selected], &match_len);
+    redraw_search(num_results > 0 || query.len == 0, match, match_len);
+  }
+}
+
+/*
+- Put the terminal in raw mode, once the prompt is shown, so no key typed
+  while the shell waits for input is handled by the terminal itself.
+*/
+void edit_start(int fd)
+{
+  struct termios raw;
+  if (raw_mode || tcgetattr(fd, &saved_termios) < 0)
+    return;
+  raw = saved_termios;
+  raw.c_lflag &= ~(ICANON | ECHO | ISIG | IEXTEN);
+  raw.c_iflag &= ~(IXON | ICRNL);
+  raw.c_cc[VMIN] = 1;
+  raw.c_cc[VTIME] = 0;
+  if (tcsetattr(fd, TCSADRAIN, &raw) == 0)
+    raw_mode = 1;
+}
+
+static void edit_end(int fd)
+{
+  if (raw_mode)
+    tcsetattr(fd, TCSADRAIN, &saved_termios);
+  raw_mode = 0;
+}
+
+/*
+- Read one line from the terminal in raw mode, handling editing keys and Ctrl-R.
+- The prompt has already been printed.
+- Return the line with its newline, copied into the line arena, or NULL at the end of the input.
+*/
+char *edit_line(int fd)
+{
+  edit_start(fd);
+
+  buffer_set(&line, "", 0);
+  int done = 0;
+  while (!done)
+  {
+    int c = read_key(fd);
+    if (c < 0 || (c == KEY_CTRL('D') && line.len == 0))
+    {
+      done = -1;
+      break;
+    }
+
+    switch (c)
+    {
+    case '\r':
+    case '\n':
+      done = 1;
+      break;
+    case KEY_CTRL('C'):
+      // start over on a fresh prompt, as Ctrl-C at the prompt always did
+      buffer_set(&line, "", 0);
+      printf("\n");
+      redraw_line();
+      break;
+    case KEY_BACKSPACE:
+    case KEY_CTRL('H'):
+      buffer_backspace(&line);
+      redraw_line();
+      break;
+    case KEY_CTRL('U'):
+      buffer_set(&line, "", 0);
+      redraw_line();
+      break;
+    case KEY_CTRL('R'):
+      done = search_history(fd);
+      break;
+    case KEY_ESC:
+      skip_escape(fd);
+      break;
+    default:
+      if (c >= 32)
+      {
+        char ch = (char)c;
+        buffer_add(&line, &ch, 1);
+        printf("%c", ch);
+        fflush(stdout);
+      }
+    }
+  }
+
+  edit_end(fd); // commands run with the terminal as it was
+  if (done < 0)
+    return NULL;
+
+  printf("\n");
+  fflush(stdout);
+  buffer_add(&line, "\n", 1);
+  return arena_strndup(&line_arena, line.text, line.len);
+}
@@ -0,0 +1,454 @@
+#include "header.h"
+#ifdef __linux__
+#include <sys/mman.h>
+#endif
+
+/*
+ * The `parallel` builtin runs one job per input, keeping at most N of them running.
+ *
+ *   parallel [-j N] [-k] [-u] [--halt-on-error] [command [arg...]] [::: input...]
+ *
+ * The inputs are the words after `:::`, or else the lines of stdin (usually `< file`).
+ * With a command, each input replaces every `{}` in it, or is added as its last word;
+ * without one, each input is a whole command line, pipes and `;` included.
+ *
+ * Jobs are launched by the shell itself like background pipelines and take their
+ * place in the job table; the shell then sleeps on the SIGCHLD events of the event
+ * loop until one ends, so no helper process is forked per slot. The output of each
+ * job is collected in an anonymous file and printed whole when the job ends; -k
+ * prints the outputs in input order instead, and -u lets jobs write straight to
+ * stdout. Every failed job is reported on stderr, and --halt-on-error starts no new
+ * job after the first failure. Ctrl-C interrupts the running jobs.
+ *
+ * Each slot builds and launches its job in an arena of its own, made the line
+ * arena meanwhile and reset when the job ends, and -k holds at most a window of
+ * outputs: memory stays flat however many inputs there are.
+ */
+
+struct runner_slot
+{
+  int input;            // number of the input being run, -1 while the slot is free
+  char *text;           // the job's command line
+  struct sequence *seq; // its commands, run one after the other
+  int next_command;
+  pid_t *pids;          // processes of the current command
+  int num_pids, live;   // how many, and how many are not reaped yet
+  pid_t last_pid;       // last stage, whose status is the job's
+  int status;
+  int out_fd;           // collected output, -1 when jobs write straight out
+  struct arena arena;   // the job's text, commands and pids, reset when it ends
+};
+
+/* A finished job waiting for the earlier ones with -k */
+struct held_output
+{
+  int done;
+  int fd, status;
+  char *text; // malloc'd, for the report of a failed job only
+};
+
+static struct runner_slot *slots;
+static int *done_slots, num_done; // slots whose pipeline has no process left
+
+/*
+   Called by the reaper for each process of a job started by `parallel`.
+*/
+void parallel_reaped(int slot, int pid, int status)
+{
+  struct runner_slot *s = &slots[slot];
+  if (pid == s->last_pid)
+    s->status = status;
+  if (--s->live == 0)
+    done_slots[num_done++] = slot;
+}
+
+/* An anonymous file to collect a job's output in, or -1 */
+static int capture_file(void)
+{
+  int fd = -1;
+#ifdef __linux__
+  fd = memfd_create("parallel", MFD_CLOEXEC);
+#endif
+  if (fd < 0)
+  {
+    char path[] = "/tmp/parallel.XXXXXX";
+    fd = mkstemp(path);
+    if (fd >= 0)
+    {
+      unlink(path);
+      fcntl(fd, F_SETFD, FD_CLOEXEC);
+    }
+  }
+  return fd;
+}
+
+/*
+   Copies a job's collected output to out_fd and closes it, then reports the job if it failed.
+*/
+static void print_output(int fd, int status, const char *text, int out_fd)
+{
+  if (fd >= 0)
+  {
+    char buf[65536];
+    ssize_t n;
+    lseek(fd, 0, SEEK_SET);
+    while ((n = read(fd, buf, sizeof(buf))) > 0)
+      if (write(out_fd, buf, n) < 0)
+        break;
+    close(fd);
+  }
+  if (status != 0)
+  {
+    if (WIFSIGNALED(status))
+      fprintf(stderr, "parallel: %s: killed by signal %d\n", text, WTERMSIG(status));
+    else
+      fprintf(stderr, "parallel: %s: exit status %d\n", text, exit_code(status));
+  }
+}
+
+/*
+   Makes a slot's arena the line arena, for what its job allocates while it is
+   built or launched; a second call puts the line arena back.
+*/
+static void swap_arena(struct runner_slot *s)
+{
+  struct arena line = line_arena;
+  line_arena = s->arena;
+  s->arena = line;
+}
+
+/*
+- Launch the next command of the job in slot i: a pipeline directly, anything else
+  (an and-or list, a compound command) in a copy of the shell.
+- Return 1 if processes are running, 0 once the job has no command left.
+*/
+static int run_next_command(int i, int in_fd, int out_fd)
+{
+  struct runner_slot *s = &slots[i];
+  swap_arena(s);
+  int started = 0;
+  while (!started && s->seq != NULL && s->next_command < s->seq->num_commands)
+  {
+    struct command *cmd = &s->seq->commands[s->next_command++];
+    int job_id = 0;
+    int out = s->out_fd >= 0 ? s->out_fd : out_fd;
+    int num_stages = cmd->type == CMD_PIPELINE ? cmd->pipeline->num_cmds : 1;
+    s->pids = arena_alloc(&line_arena, sizeof(pid_t) * num_stages);
+    s->status = W_EXITCODE(127, 0); // stays so if the last stage could not start
+    if (cmd->type == CMD_PIPELINE)
+    {
+      cmd->pipeline->background = 1; // never given the terminal
+      s->num_pids = launch_pipeline(cmd->pipeline, in_fd, out, s->pids, &job_id);
+    }
+    else
+    {
+      s->pids[0] = fork_subshell(cmd, 0, in_fd, out);
+      s->num_pids = s->pids[0] > 0;
+      if (s->num_pids > 0)
+      {
+        job_id = add_job(cmd->text);
+        add_process(s->pids[0], job_id, cmd->text);
+      }
+    }
+    if (s->num_pids == 0)
+      continue;
+
+    find_job(job_id)->parallel_slot = i;
+    s->live = s->num_pids;
+    s->last_pid = s->num_pids == num_stages ? s->pids[s->num_pids - 1] : -1;
+    started = 1;
+  }
+  swap_arena(s);
+  return started;
+}
+
+/* Builds the command line of one input from the command words, or takes the input as is */
+static char *job_text(char **command, int num_words, const char *input)
+{
+  if (num_words == 0)
+    return arena_strdup(&line_arena, input);
+
+  size_t input_len = strlen(input), len = 0;
+  int placed = 0;
+  for (int i = 0; i < num_words; i++)
+    for (const char *p = command[i]; *p; p++)
+      len += (p[0] == '{' && p[1] == '}') ? (placed = 1, input_len) : 1;
+  len += num_words + input_len + 1;
+
+  char *text = arena_alloc(&line_arena, len + 1), *out = text;
+  for (int i = 0; i < num_words; i++)
+  {
+    for (const char *p = command[i]; *p; p++)
+      if (p[0] == '{' && p[1] == '}')
+      {
+        memcpy(out, input, input_len);
+        out += input_len;
+        p++;
+      }
+      else
+        *out++ = *p;
+    *out++ = ' ';
+  }
+  if (!placed)
+  {
+    memcpy(out, input, input_len);
+    out += input_len;
+  }
+  *out = '\0';
+  return text;
+}
+
+/* Reads the next non-empty line of the inputs, valid until the next call, or returns NULL */
+static char *read_input(FILE *in)
+{
+  static char *line;
+  static size_t cap;
+  ssize_t n;
+  while ((n = getline(&line, &cap, in)) >= 0)
+  {
+    while (n > 0 && (line[n - 1] == '\n' || line[n - 1] == '\r'))
+      line[--n] = '\0';
+    if (n > 0)
+      return line;
+  }
+  return NULL;
+}
+
+/*
+- Open where inputs come from when they are read (the `<` file, a here-document,
+  or a copy of stdin)
+  and where the outputs go (the `>` or `>>` file, or stdout).
+- Return -1 after reporting a file that cannot be opened.
+*/
+static int open_streams(struct redirect *redirects, int read_inputs, FILE **in, int *out_fd)
+{
+  const char *failed = NULL;
+  for (struct redirect *r = redirects; r != NULL && failed == NULL; r = r->next)
+  {
+    if (r->type == REDIR_INPUT)
+    {
+      if (*in != NULL)
+        fclose(*in);
+      if ((*in = fopen(r->file, "re")) == NULL)
+        failed = r->file;
+    }
+    else if (r->type == REDIR_HERE_DOC || r->type == REDIR_HERE_STRING)
+    {
+      if (*in != NULL)
+        fclose(*in);
+      *in = NULL;
+      int fd = open_here_document(r); // reports its own errors
+      if (fd < 0)
+        failed = "";
+      else if ((*in = fdopen(fd, "r")) == NULL)
+      {
+        close(fd);
+        failed = "here-document";
+      }
+    }
+    else
+    {
+      if (*out_fd != STDOUT_FILENO)
+        close(*out_fd);
+      *out_fd = open(r->file, O_CREAT | O_WRONLY | O_CLOEXEC | (r->type == REDIR_APPEND ? O_APPEND : O_TRUNC), S_IRWXU);
+      if (*out_fd < 0)
+      {
+        *out_fd = STDOUT_FILENO;
+        failed = r->file;
+      }
+    }
+  }
+
+  if (failed == NULL && read_inputs && *in == NULL)
+  {
+    int fd = dup(STDIN_FILENO);
+    if (fd < 0 || (*in = fdopen(fd, "r")) == NULL)
+      failed = "parallel";
+  }
+
+  if (failed == NULL)
+    return 0;
+  if (failed[0] != '\0')
+    perror(failed);
+  if (*in != NULL)
+    fclose(*in);
+  *in = NULL;
+  if (*out_fd != STDOUT_FILENO)
+    close(*out_fd);
+  *out_fd = STDOUT_FILENO;
+  return -1;
+}
+
+static int parse_jobs(const char *value)
+{
+  char *end;
+  long n = strtol(value, &end, 10);
+  if (*value == '\0' || *end != '\0' || n < 1 || n > 65536)
+    return -1;
+  return (int)n;
+}
+
+static int usage_error(void)
+{
+  fprintf(stderr, "parallel: usage: parallel [-j N] [-k] [-u] [--halt-on-error] [command [arg...]] [::: input...]\n");
+  return 1;
+}
+
+/*
+- `parallel`: run one job per input with at most N running (-j, one per core by default).
+- A `<` redirection gives the inputs, a `>` or `>>` one takes the output.
+- Return the number of failed jobs, at most 101.
+*/
+int parallel_builtin(char **cmd_tokens, struct redirect *redirects)
+{
+  long cores = sysconf(_SC_NPROCESSORS_ONLN);
+  int max_jobs = cores > 0 ? (int)cores : 1;
+  int ordered = 0, ungrouped = 0, halt = 0;
+  int i = 1;
+
+  for (; cmd_tokens[i] != NULL && cmd_tokens[i][0] == '-'; i++)
+  {
+    char *opt = cmd_tokens[i];
+    if (strcmp(opt, "-k") == 0)
+      ordered = 1;
+    else if (strcmp(opt, "-u") == 0)
+      ungrouped = 1;
+    else if (strcmp(opt, "--halt-on-error") == 0)
+      halt = 1;
+    else if (strncmp(opt, "-j", 2) == 0)
+    {
+      char *value = opt[2] ? opt + 2 : cmd_tokens[++i];
+      if (value == NULL || (max_jobs = parse_jobs(value)) < 0)
+        return usage_error();
+    }
+    else if (strcmp(opt, "--") == 0)
+    {
+      i++;
+      break;
+    }
+    else
+      return usage_error();
+  }
+
+  char **command = &cmd_tokens[i];
+  int num_words = 0;
+  while (command[num_words] != NULL && strcmp(command[num_words], ":::") != 0)
+    num_words++;
+  char **args = command[num_words] ? &command[num_words + 1] : NULL;
+
+  // inputs from `:::`, else from the `<` file or stdin; output to the `>` file or stdout
+  FILE *in = NULL;
+  int out_fd = STDOUT_FILENO, jobs_stdin = -1;
+  if (open_streams(redirects, args == NULL, &in, &out_fd) < 0)
+    return 1;
+  if (args == NULL)
+    jobs_stdin = open("/dev/null", O_RDONLY | O_CLOEXEC); // the inputs are not the jobs' to read
+
+  fflush(stdout);
+  slots = malloc(sizeof(struct runner_slot) * max_jobs);
+  done_slots = malloc(sizeof(int) * max_jobs);
+  int *free_slots = malloc(sizeof(int) * max_jobs);
+  int num_free = max_jobs;
+  num_done = 0;
+  for (int s = 0; s < max_jobs; s++)
+  {
+    slots[s].input = -1;
+    slots[s].arena = (struct arena){0};
+    slots[s].arena.block_size = PARALLEL_ARENA_BLOCK;
+    free_slots[s] = max_jobs - 1 - s;
+  }
+
+  // -k: the outputs of inputs [next_print, next_input), a window of at most held_window
+  int held_window = max_jobs + PARALLEL_HELD_MAX, next_print = 0;
+  struct held_output *held = ordered ? calloc(held_window, sizeof(struct held_output)) : NULL;
+  int next_input = 0, running = 0, failed = 0, stop = 0, inputs_left = 1;
+
+  while (1)
+  {
+    // fill the free slots; -k also waits once too many outputs are held back
+    while (!stop && inputs_left && num_free > 0 && (!ordered || next_input - next_print < held_window))
+    {
+      char *input = args ? *args : read_input(in);
+      if (input == NULL)
+      {
+        inputs_left = 0;
+        break;
+      }
+      if (args)
+        args++;
+
+      int s = free_slots[--num_free];
+      struct runner_slot *slot = &slots[s];
+      slot->input = next_input++;
+      swap_arena(slot);
+      slot->text = job_text(command, num_words, input);
+      slot->seq = parse_line(arena_strdup(&line_arena, slot->text));
+      swap_arena(slot);
+      slot->next_command = 0;
+      slot->status = slot->seq ? 0 : W_EXITCODE(2, 0); // a syntax error fails the job
+      slot->out_fd = ungrouped ? -1 : capture_file();
+      running++;
+      if (!run_next_command(s, jobs_stdin, out_fd))
+        done_slots[num_done++] = s;
+    }
+
+    if (num_done == 0)
+    {
+      if (running == 0)
+        break;
+      if (wait_child_event())
+      {
+        // Ctrl-C: interrupt what runs, start nothing more
+        stop = 1;
+        for (int s = 0; s < max_jobs; s++)
+          for (int p = 0; slots[s].input >= 0 && slots[s].live > 0 && p < slots[s].num_pids; p++)
+            kill(slots[s].pids[p], SIGINT);
+      }
+      continue;
+    }
+
+    // a pipeline ended: run the job's next one, or finish the job
+    int s = done_slots[--num_done];
+    struct runner_slot *slot = &slots[s];
+    if (!stop && run_next_command(s, jobs_stdin, out_fd))
+      continue;
+
+    running--;
+    if (slot->status != 0)
+    {
+      failed++;
+      stop |= halt;
+    }
+    if (!ordered)
+      print_output(slot->out_fd, slot->status, slot->text, out_fd);
+    else
+    {
+      char *text = slot->status != 0 ? strdup(slot->text) : NULL; // the slot's arena is reset below
+      held[slot->input % held_window] = (struct held_output){1, slot->out_fd, slot->status, text};
+      for (struct held_output *h; (h = &held[next_print % held_window])->done; next_print++)
+      {
+        print_output(h->fd, h->status, h->text ? h->text : "", out_fd);
+        free(h->text);
+        h->done = 0;
+      }
+    }
+    arena_reset(&slot->arena);
+    slot->input = -1;
+    free_slots[num_free++] = s;
+  }
+
+  for (int s = 0; s < max_jobs; s++)
+    arena_free(&slots[s].arena);
+  free(held);
+  free(free_slots);
+  free(slots);
+  free(done_slots);
+  slots = NULL;
+  if (jobs_stdin >= 0)
+    close(jobs_stdin);
+  if (in != NULL)
+    fclose(in);
+  if (out_fd != STDOUT_FILENO)
+    close(out_fd);
+  return failed > 101 ? 101 : failed;
+}
@@ -1,372 +1,938 @@
 #include "header.h"
+#include <ctype.h>
+
+/* Character classes for the lexer, so each byte is classified with one lookup */
+enum
+{
+  CH_WORD = 0,
+  CH_BLANK,
+  CH_OPERATOR,
+  CH_END
+};
+
+static const unsigned char char_class[256] = {
+    ['\0'] = CH_END,
+    [' '] = CH_BLANK,
+    ['\t'] = CH_BLANK,
+    ['\n'] = CH_BLANK,
+    [';'] = CH_OPERATOR,
+    ['&'] = CH_OPERATOR,
+    ['|'] = CH_OPERATOR,
+    ['<'] = CH_OPERATOR,
+    ['>'] = CH_OPERATOR,
+};
 
 /*
-- Allocate memory for the command string.
-- Read input from standard input using fgets.
-- Check for signal interruptions and retry reading if necessary.
-- Handle errors by freeing memory and exiting if reading fails.
-- Return the command string.
+- Return the length of the command substitution at s, `$(...)` with its nested
+  parentheses or `...` between backquotes, or 0 if the line ends inside it.
 */
-char *read_command_line(void)
+static size_t substitution_length(const char *s)
 {
-  char *cmd = malloc(sizeof(char) * MAX_BUF_LEN);
+  if (s[0] == '`')
+  {
+    const char *end = strchr(s + 1, '`');
+    return end != NULL ? (size_t)(end - s) + 1 : 0;
+  }
+  int depth = 0;
+  for (size_t i = 1; s[i] != '\0'; i++)
+  {
+    if (s[i] == '(')
+      depth++;
+    else if (s[i] == ')' && --depth == 0)
+      return i + 1;
+  }
+  return 0;
+}
+
+static int unterminated; // the line ended inside a command substitution
 
-  int again = 1;
-  char *linept; // pointer to the line buffer
+/*
+- Scan the command line once, left to right, emitting a token per word or operator.
+- A command substitution is part of its word, blanks and operators included.
+- Word bytes are copied into a single buffer as they are scanned, so the line itself
+  stays intact for the source text of each pipeline.
+- The token array is the newest arena allocation while lexing and grows in place.
+- Return the token array, always terminated by a TOK_END token.
+*/
+static struct token *lex_line(const char *line, int *num_tokens)
+{
+  size_t len = strlen(line);
+  char *out = arena_alloc(&line_arena, len + 1); // words plus their terminators never exceed the line
+  int capacity = 16, count = 0;
+  struct token *tokens = arena_alloc(&line_arena, sizeof(struct token) * capacity);
+  int i = 0;
 
-  while (again)
+  while (1)
   {
-    again = 0;
-    linept = fgets(cmd, MAX_BUF_LEN, stdin);
-    if (linept == NULL)
+    while (char_class[(unsigned char)line[i]] == CH_BLANK)
+      i++;
+
+    if (count == capacity)
+    {
+      tokens = arena_realloc(&line_arena, tokens, sizeof(struct token) * capacity,
+                             sizeof(struct token) * capacity * 2);
+      capacity *= 2;
+    }
+
+    struct token *tok = &tokens[count++];
+    tok->start = i;
+    tok->word = NULL;
+
+    switch (char_class[(unsigned char)line[i]])
     {
-      if (errno == EINTR)
+    case CH_END:
+      tok->type = TOK_END;
+      tok->end = i;
+      *num_tokens = count;
+      return tokens;
+
+    case CH_OPERATOR:
+      if (line[i] == ';' && line[i + 1] == ';')
       {
-        again = 1; // signal interruption, read again
+        tok->type = TOK_DSEMI;
+        i++;
+      }
+      else if (line[i] == ';')
+        tok->type = TOK_SEMI;
+      else if (line[i] == '&' && line[i + 1] == '&')
+      {
+        tok->type = TOK_AND_IF;
+        i++;
+      }
+      else if (line[i] == '&')
+        tok->type = TOK_AMP;
+      else if (line[i] == '|' && line[i + 1] == '|')
+      {
+        tok->type = TOK_OR_IF;
+        i++;
+      }
+      else if (line[i] == '|')
+        tok->type = TOK_PIPE;
+      else if (line[i] == '<' && line[i + 1] == '<' && line[i + 2] == '<')
+      {
+        tok->type = TOK_TLESS;
+        i += 2;
+      }
+      else if (line[i] == '<' && line[i + 1] == '<')
+      {
+        tok->type = line[i + 2] == '-' ? TOK_DLESSDASH : TOK_DLESS;
+        i += tok->type == TOK_DLESSDASH ? 2 : 1;
+      }
+      else if (line[i] == '<')
+        tok->type = TOK_LESS;
+      else if (line[i + 1] == '>')
+      {
+        tok->type = TOK_DGREAT;
+        i++;
       }
       else
+        tok->type = TOK_GREAT;
+      i++;
+      break;
+
+    default:
+      tok->type = TOK_WORD;
+      tok->word = out;
+      while (char_class[(unsigned char)line[i]] == CH_WORD)
       {
-        free(cmd);
-        perror("Error reading input");
-        exit(EXIT_FAILURE);
+        size_t n = 1;
+        if ((line[i] == '$' && line[i + 1] == '(') || line[i] == '`')
+        {
+          n = substitution_length(line + i);
+          if (n == 0)
+          {
+            unterminated = 1;
+            n = strlen(line + i);
+          }
+        }
+        memcpy(out, line + i, n);
+        out += n;
+        i += n;
       }
+      *out++ = '\0';
+      break;
     }
+    tok->end = i;
+  }
+}
+
+static const char *token_text(struct token *tok)
+{
+  switch (tok->type)
+  {
+  case TOK_WORD:
+    return tok->word;
+  case TOK_SEMI:
+    return ";";
+  case TOK_AMP:
+    return "&";
+  case TOK_PIPE:
+    return "|";
+  case TOK_LESS:
+    return "<";
+  case TOK_GREAT:
+    return ">";
+  case TOK_DGREAT:
+    return ">>";
+  case TOK_DLESS:
+    return "<<";
+  case TOK_DLESSDASH:
+    return "<<-";
+  case TOK_TLESS:
+    return "<<<";
+  case TOK_AND_IF:
+    return "&&";
+  case TOK_OR_IF:
+    return "||";
+  case TOK_DSEMI:
+    return ";;";
+  default:
+    return "newline";
   }
-  return cmd;
+}
+
+static int partial;    // parsing for parse_line_partial(): more lines can follow
+static int incomplete; // the line ended inside a command that more lines would finish
+
+static int syntax_error(struct token *tok)
+{
+  fprintf(stderr, "syntax error near unexpected token `%s'\n", token_text(tok));
+  return -1;
 }
 
 /*
-- parse command input
-- Initialize command count and tokenize the command input into command lines by semicolons (;)
-- For each semicolon-separated token/command, further tokenize by ampersands (&)
-- Allocate memory and append '&' back to indicate background when handle execute command
-- Store each command in the cmds array and increment the command count.
-- Return the total count of parsed commands.
+   A command cut short by the end of the line. When more lines can follow, the
+   caller is asked for them instead of an error being reported.
 */
-int parse_command_line(char *cmdline, char **cmds)
+static int unexpected_end(struct token *tok)
 {
-  int num_cmds = 0;
-  char *semicolon_saveptr;
-  char *ampersand_saveptr;
-  char *semicolon_token = strtok_r(cmdline, ";", &semicolon_saveptr);
-
-  while (semicolon_token != NULL)
+  if (tok->type == TOK_END && partial)
   {
-    char *ampersand_token = strtok_r(semicolon_token, "&", &ampersand_saveptr);
+    incomplete = 1;
+    return -1;
+  }
+  return syntax_error(tok);
+}
 
-    while (ampersand_token != NULL)
-    {
-      char *next_ampersand_token = strtok_r(NULL, "&", &ampersand_saveptr);
-      size_t len = strlen(ampersand_token);
+static int is_redirect_token(enum token_type type)
+{
+  return type == TOK_LESS || type == TOK_GREAT || type == TOK_DGREAT || type == TOK_DLESS ||
+         type == TOK_DLESSDASH || type == TOK_TLESS;
+}
 
-      if (next_ampersand_token != NULL)
-      {
-        char *temp_cmd = malloc(len + 2); // +2 for '&' and '\0'
-        if (temp_cmd == NULL)
-        {
-          fprintf(stderr, "Memory allocation failed\n");
-          return num_cmds;
-        }
-        strcpy(temp_cmd, ampersand_token);
-        temp_cmd[len] = '&';
-        temp_cmd[len + 1] = '\0';
-        cmds[num_cmds++] = temp_cmd;
-      }
-      else
-      {
-        cmds[num_cmds++] = ampersand_token;
-      }
-      ampersand_token = next_ampersand_token;
-    }
-    semicolon_token = strtok_r(NULL, ";", &semicolon_saveptr);
+static struct redirect **heredocs; // here-documents of the line, in order
+static int num_heredocs, heredocs_capacity;
+
+/*
+- Make a here-document redirection: the delimiter, unquoted, and whether the
+  lines are expanded (not when it was quoted, as in <<'EOF').
+- Remember it, so its lines can be read once the command line is parsed.
+*/
+static void add_here_document(struct redirect *redir, char *word, int strip_tabs)
+{
+  size_t len = strlen(word);
+  redir->type = REDIR_HERE_DOC;
+  redir->here_flags = strip_tabs ? HERE_STRIP_TABS : 0;
+  redir->file = word;
+  if (len >= 2 && (word[0] == '\'' || word[0] == '"') && word[len - 1] == word[0])
+  {
+    redir->file = arena_strndup(&line_arena, word + 1, len - 2);
+    redir->here_flags |= HERE_LITERAL;
+  }
+
+  if (num_heredocs == heredocs_capacity)
+  {
+    int grown = heredocs_capacity ? heredocs_capacity * 2 : 4;
+    heredocs = arena_realloc(&line_arena, heredocs, sizeof(struct redirect *) * heredocs_capacity,
+                             sizeof(struct redirect *) * grown);
+    heredocs_capacity = grown;
   }
-  return num_cmds;
+  heredocs[num_heredocs++] = redir;
 }
 
 /*
-- Tokenize the command string and store tokens in cmd_tokens.
-- Return the count of parsed tokens.
+   Returns the here-document redirections of the line parsed last, in the order of
+   the line: their lines follow it in the same order.
 */
+struct redirect **here_documents(int *count)
+{
+  *count = num_heredocs;
+  return heredocs;
+}
 
-int parse_command(char *cmd, char **cmd_tokens)
+static int is_word(struct token *tok, const char *word)
 {
-  int tok = 0;
-  char *token = strtok(cmd, CMD_DELIMS);
+  return tok->type == TOK_WORD && strcmp(tok->word, word) == 0;
+}
+
+/* Reserved words that end or continue a compound command: they cannot start a command */
+static int is_closing_word(struct token *tok)
+{
+  static const char *words[] = {"then", "elif", "else", "fi", "do", "done", "esac", NULL};
+  if (tok->type != TOK_WORD)
+    return 0;
+  for (int i = 0; words[i] != NULL; i++)
+    if (strcmp(tok->word, words[i]) == 0)
+      return 1;
+  return 0;
+}
+
+static int is_name(const char *s)
+{
+  if (!isalpha((unsigned char)*s) && *s != '_')
+    return 0;
+  while (isalnum((unsigned char)*s) || *s == '_')
+    s++;
+  return *s == '\0';
+}
+
+/* Skips ';', which also stands for the line breaks of a command continued over several lines */
+static int skip_separators(struct token *tokens, int pos)
+{
+  while (tokens[pos].type == TOK_SEMI)
+    pos++;
+  return pos;
+}
+
+/* Return the position after the reserved word expected at pos, or -1 */
+static int expect_word(struct token *tokens, int pos, const char *word)
+{
+  if (!is_word(&tokens[pos], word))
+    return unexpected_end(&tokens[pos]);
+  return pos + 1;
+}
+
+static struct command *new_command(enum command_type type)
+{
+  struct command *cmd = arena_alloc(&line_arena, sizeof(struct command));
+  memset(cmd, 0, sizeof(*cmd));
+  cmd->type = type;
+  return cmd;
+}
+
+/*
+- Parse one simple command: words and redirections up to '|', ';', '&' or the end.
+- argv is sized by counting the command's words ahead in the token array.
+- Redirections are kept in source order so later ones win, as in sh.
+- Return the index of the first token after the command, or -1 on a syntax error.
+*/
+static int parse_simple_command(struct token *tokens, int pos, struct simple_command *cmd)
+{
+  int argc = 0;
+  for (int i = pos; tokens[i].type == TOK_WORD || is_redirect_token(tokens[i].type); i++)
+  {
+    if (tokens[i].type == TOK_WORD)
+      argc++;
+    else if (tokens[i + 1].type == TOK_WORD)
+      i++; // the file name belongs to the redirection
+  }
+
+  cmd->argc = 0;
+  cmd->argv = arena_alloc(&line_arena, sizeof(char *) * (argc + 1));
+  cmd->redirects = NULL;
+  struct redirect **tail = &cmd->redirects;
 
-  while (token != NULL)
+  while (tokens[pos].type == TOK_WORD || is_redirect_token(tokens[pos].type))
   {
-    if (strchr(token, '*') || strchr(token, '?'))
+    if (tokens[pos].type == TOK_WORD)
     {
-      int expanded_count = expand_wildcard_token(token, cmd_tokens, tok);
-      tok += expanded_count; // Update tok based on the number of expanded tokens
+      cmd->argv[cmd->argc++] = tokens[pos++].word;
+      continue;
     }
+
+    if (tokens[pos + 1].type != TOK_WORD)
+      return syntax_error(&tokens[pos + 1]);
+
+    struct redirect *redir = arena_alloc(&line_arena, sizeof(struct redirect));
+    redir->file = tokens[pos + 1].word;
+    redir->text = NULL;
+    redir->here_flags = 0;
+    redir->next = NULL;
+    if (tokens[pos].type == TOK_LESS)
+      redir->type = REDIR_INPUT;
+    else if (tokens[pos].type == TOK_GREAT)
+      redir->type = REDIR_OUTPUT;
+    else if (tokens[pos].type == TOK_DGREAT)
+      redir->type = REDIR_APPEND;
+    else if (tokens[pos].type == TOK_TLESS)
+      redir->type = REDIR_HERE_STRING;
     else
+      add_here_document(redir, tokens[pos + 1].word, tokens[pos].type == TOK_DLESSDASH);
+    *tail = redir;
+    tail = &redir->next;
+    pos += 2;
+  }
+  cmd->argv[cmd->argc] = NULL;
+
+  if (cmd->argc == 0 && cmd->redirects == NULL)
+    return unexpected_end(&tokens[pos]);
+  return pos;
+}
+
+/*
+- Parse commands joined by '|' into one pipeline, sized by counting the pipes ahead.
+- A '|' at the end of a line carries the pipeline on to the next one.
+- The source text is kept for history and job names.
+- Return the index of the first token after the pipeline, or -1 on a syntax error.
+*/
+static int parse_pipeline(const char *line, struct token *tokens, int pos, struct pipeline *pl)
+{
+  int num_cmds = 1;
+  for (int i = pos; tokens[i].type == TOK_WORD || tokens[i].type == TOK_PIPE || is_redirect_token(tokens[i].type); i++)
+    if (tokens[i].type == TOK_PIPE)
     {
-      if (tok < MAX_BUF_LEN - 1) // Add the token as is
-        cmd_tokens[tok++] = strdup(token);
+      num_cmds++;
+      i = skip_separators(tokens, i + 1) - 1;
     }
-    token = strtok(NULL, CMD_DELIMS);
+
+  int start = tokens[pos].start;
+  pl->num_cmds = num_cmds;
+  pl->cmds = arena_alloc(&line_arena, sizeof(struct simple_command) * num_cmds);
+  pl->background = 0;
+
+  for (int i = 0; i < num_cmds; i++)
+  {
+    if (i > 0)
+      pos = skip_separators(tokens, pos + 1); // skip '|'
+    pos = parse_simple_command(tokens, pos, &pl->cmds[i]);
+    if (pos < 0)
+      return -1;
   }
 
-  return tok;
+  pl->text = arena_strndup(&line_arena, line + start, tokens[pos - 1].end - start);
+  return pos;
 }
 
-// Utility function to expand a token with wildcards using glob
-int expand_wildcard_token(char *token, char **expanded_tokens, int start_index)
+static int parse_list(const char *line, struct token *tokens, int pos, struct sequence **list);
+
+/* do list done, the body of for, while and until */
+static int parse_do_group(const char *line, struct token *tokens, int pos, struct sequence **body)
 {
-  glob_t glob_result;
-  memset(&glob_result, 0, sizeof(glob_result));
+  pos = expect_word(tokens, pos, "do");
+  if (pos >= 0)
+    pos = parse_list(line, tokens, pos, body);
+  if (pos >= 0)
+    pos = expect_word(tokens, pos, "done");
+  return pos;
+}
 
-  int return_value = glob(token, GLOB_TILDE, NULL, &glob_result);
-  int count = 0;
+/*
+- Parse if list then list [elif list then list]... [else list] fi, from the `if`
+  or `elif` at pos. An elif is a nested if in the else branch and takes the fi.
+- Return the index of the first token after the fi, or -1.
+*/
+static int parse_if(const char *line, struct token *tokens, int pos, struct command *cmd)
+{
+  cmd->type = CMD_IF;
+  pos = parse_list(line, tokens, pos + 1, &cmd->cond);
+  if (pos >= 0)
+    pos = expect_word(tokens, pos, "then");
+  if (pos >= 0)
+    pos = parse_list(line, tokens, pos, &cmd->body);
+  if (pos < 0)
+    return -1;
 
-  if (return_value == 0)
-  // Matches found, add each to the expanded_tokens array
+  if (is_word(&tokens[pos], "elif"))
   {
-    for (size_t i = 0; i < glob_result.gl_pathc; ++i)
-    {
-      if (start_index + count < MAX_BUF_LEN - 1)
-      {
-        expanded_tokens[start_index + count] = strdup(glob_result.gl_pathv[i]);
-        count++;
-      }
-      else
-      {
-        fprintf(stderr, "Too many tokens\n");
-        break;
-      }
-    }
+    int start = tokens[pos].start;
+    struct command *elif = new_command(CMD_IF);
+    pos = parse_if(line, tokens, pos, elif);
+    if (pos < 0)
+      return -1;
+    elif->text = arena_strndup(&line_arena, line + start, tokens[pos - 1].end - start);
+    cmd->otherwise = arena_alloc(&line_arena, sizeof(struct sequence));
+    cmd->otherwise->num_commands = 1;
+    cmd->otherwise->commands = elif;
+    return pos;
   }
-  else
+  if (is_word(&tokens[pos], "else"))
   {
-    // If no matches, keep the original token
-    if (start_index + count < MAX_BUF_LEN - 1)
-    {
-      expanded_tokens[start_index + count] = strdup(token);
-      count++;
-    }
+    pos = parse_list(line, tokens, pos + 1, &cmd->otherwise);
+    if (pos < 0)
+      return -1;
   }
-
-  globfree(&glob_result);
-  return count;
+  return expect_word(tokens, pos, "fi");
 }
 
-/**
- * Detects '<' , '>' and '>>' in a command, updating flags and indices for redirection.
- */
-void check_redirect(char *cmd, int *input_redi, int *input_idx, int *output_redi, int *output_redi_type, int *output_idx)
+/* for name [in word...]; do list done */
+static int parse_for(const char *line, struct token *tokens, int pos, struct command *cmd)
 {
-  for (int i = 0; cmd[i]; i++)
+  pos++;
+  if (tokens[pos].type != TOK_WORD || !is_name(tokens[pos].word))
+    return unexpected_end(&tokens[pos]);
+  cmd->type = CMD_FOR;
+  cmd->name = tokens[pos++].word;
+
+  struct simple_command *words = arena_alloc(&line_arena, sizeof(struct simple_command));
+  memset(words, 0, sizeof(*words));
+  cmd->words = words;
+
+  int after = skip_separators(tokens, pos);
+  if (is_word(&tokens[after], "in"))
   {
-    if (cmd[i] == '<')
+    pos = after + 1;
+    while (tokens[pos + words->argc].type == TOK_WORD)
+      words->argc++;
+    words->argv = arena_alloc(&line_arena, sizeof(char *) * (words->argc + 1));
+    for (int i = 0; i < words->argc; i++)
+      words->argv[i] = tokens[pos++].word;
+    words->argv[words->argc] = NULL;
+    after = skip_separators(tokens, pos);
+  }
+  else
+  {
+    words->argv = arena_alloc(&line_arena, sizeof(char *));
+    words->argv[0] = NULL; // no positional parameters to go over
+  }
+  return parse_do_group(line, tokens, after, &cmd->body);
+}
+
+/*
+- Parse the patterns of a case item, `[(]pattern [| pattern]... )`, compiling each
+  one that has no '$' to expand.
+- Return the index of the first token of the item's commands, or -1.
+*/
+static int parse_patterns(struct token *tokens, int pos, struct case_item *item)
+{
+  int count = 0;
+  for (int i = pos; tokens[i].type == TOK_WORD || tokens[i].type == TOK_PIPE; i++)
+    if (tokens[i].type == TOK_WORD)
     {
-      *input_redi = 1;
-      if (*input_idx == 0)
-        *input_idx = i;
+      count++;
+      size_t len = strlen(tokens[i].word);
+      if (len > 0 && tokens[i].word[len - 1] == ')')
+        break;
     }
-    if (cmd[i] == '>')
+  item->patterns = arena_alloc(&line_arena, sizeof(char *) * (count + 1));
+  item->compiled = arena_alloc(&line_arena, sizeof(struct glob_pattern *) * (count + 1));
+  item->num_patterns = 0;
+
+  if (is_word(&tokens[pos], "("))
+    pos++;
+  while (1)
+  {
+    if (tokens[pos].type != TOK_WORD)
+      return unexpected_end(&tokens[pos]);
+    char *word = tokens[pos].word;
+    if (item->num_patterns == 0 && word[0] == '(')
+      word++;
+    size_t len = strlen(word);
+    int closed = len > 0 && word[len - 1] == ')';
+    if (closed)
+      word = arena_strndup(&line_arena, word, len - 1);
+    if (word[0] != '\0')
     {
-      *output_redi = 1;
-      if (*output_redi_type == 0)
-        *output_redi_type = 1;
-      if (*output_idx == 0)
-        *output_idx = i;
+      item->compiled[item->num_patterns] = strpbrk(word, "$`") ? NULL : glob_compile_string(word);
+      item->patterns[item->num_patterns++] = word;
     }
-    if (cmd[i] == '>' && cmd[i + 1] == '>')
+    pos++;
+    if (closed)
+      break;
+    if (tokens[pos].type != TOK_PIPE)
+      return syntax_error(&tokens[pos]);
+    pos++;
+  }
+  if (item->num_patterns == 0)
+    return syntax_error(&tokens[pos - 1]);
+  return pos;
+}
+
+/* case word in [pattern) list ;;]... esac */
+static int parse_case(const char *line, struct token *tokens, int pos, struct command *cmd)
+{
+  pos++;
+  if (tokens[pos].type != TOK_WORD)
+    return unexpected_end(&tokens[pos]);
+  cmd->type = CMD_CASE;
+  cmd->words = arena_alloc(&line_arena, sizeof(struct simple_command));
+  cmd->words->argc = 1;
+  cmd->words->argv = arena_alloc(&line_arena, sizeof(char *) * 2);
+  cmd->words->argv[0] = tokens[pos].word;
+  cmd->words->argv[1] = NULL;
+  cmd->words->redirects = NULL;
+
+  pos = expect_word(tokens, skip_separators(tokens, pos + 1), "in");
+  int capacity = 0;
+  while (pos >= 0)
+  {
+    pos = skip_separators(tokens, pos);
+    if (is_word(&tokens[pos], "esac"))
+      return pos + 1;
+
+    if (cmd->num_items == capacity)
     {
-      *output_redi_type = 2;
+      int grown = capacity ? capacity * 2 : 4;
+      cmd->items = arena_realloc(&line_arena, cmd->items, sizeof(struct case_item) * capacity,
+                                 sizeof(struct case_item) * grown);
+      capacity = grown;
     }
+    struct case_item *item = &cmd->items[cmd->num_items++];
+    pos = parse_patterns(tokens, pos, item);
+    if (pos >= 0)
+      pos = parse_list(line, tokens, pos, &item->body);
+    if (pos >= 0 && tokens[pos].type == TOK_DSEMI)
+      pos++;
+    else if (pos >= 0 && !is_word(&tokens[pos], "esac"))
+      pos = unexpected_end(&tokens[pos]);
   }
+  return -1;
 }
 
 /*
-- Initialize indices and flags for input/output redirection and piping.
-- Iterate through the command string to detect pipes and redirection symbols.
-- Set flags and indices for piping, input, and output redirection.
-- Return 1 if piping is detected, otherwise return -1.
+- Parse one command of an and-or list: a pipeline, a compound command (if, while,
+  until, for, case), or either negated by `!`.
+- A compound command is not a pipeline stage and takes no redirections.
+- Return the index of the first token after it, or -1 on a syntax error.
 */
-int is_piping(char *cmd)
+static int parse_unit(const char *line, struct token *tokens, int pos, struct command *cmd)
 {
-  int i;
-  input_idx = 0;
-  output_idx = 0;
-  output_redi_type = 0;
-  piping = 0;
-  input_redi = 0;
-  output_redi = 0;
+  struct token *tok = &tokens[pos];
+  int start = tok->start;
 
-  check_redirect(cmd, &input_redi, &input_idx, &output_redi, &output_redi_type, &output_idx);
+  if (tok->type == TOK_END)
+    return unexpected_end(tok);
+  if (is_closing_word(tok))
+    return syntax_error(tok);
 
-  for (i = 0; cmd[i]; i++)
+  if (is_word(tok, "!"))
   {
-    if (cmd[i] == '|')
-    {
-      piping = 1;
-      break;
-    }
+    cmd->type = CMD_NOT;
+    cmd->left = new_command(CMD_PIPELINE);
+    pos = parse_unit(line, tokens, pos + 1, cmd->left);
   }
-
-  if (piping)
-    return 1;
+  else if (is_word(tok, "if"))
+    pos = parse_if(line, tokens, pos, cmd);
+  else if (is_word(tok, "while") || is_word(tok, "until"))
+  {
+    cmd->type = is_word(tok, "while") ? CMD_WHILE : CMD_UNTIL;
+    pos = parse_list(line, tokens, pos + 1, &cmd->cond);
+    if (pos >= 0)
+      pos = parse_do_group(line, tokens, pos, &cmd->body);
+  }
+  else if (is_word(tok, "for"))
+    pos = parse_for(line, tokens, pos, cmd);
+  else if (is_word(tok, "case"))
+    pos = parse_case(line, tokens, pos, cmd);
   else
+  {
+    cmd->type = CMD_PIPELINE;
+    cmd->pipeline = arena_alloc(&line_arena, sizeof(struct pipeline));
+    pos = parse_pipeline(line, tokens, pos, cmd->pipeline);
+  }
+  if (pos < 0)
     return -1;
+
+  if (cmd->type != CMD_PIPELINE && cmd->type != CMD_NOT && tokens[pos].type != TOK_SEMI &&
+      tokens[pos].type != TOK_AMP && tokens[pos].type != TOK_AND_IF && tokens[pos].type != TOK_OR_IF &&
+      tokens[pos].type != TOK_DSEMI && tokens[pos].type != TOK_END && !is_closing_word(&tokens[pos]))
+    return syntax_error(&tokens[pos]);
+
+  cmd->text = arena_strndup(&line_arena, line + start, tokens[pos - 1].end - start);
+  return pos;
 }
 
 /*
-- Detect input/output redirection symbols and set flags.
-- Tokenize and set in_file and out_file for both input and output redirection.
-- Handle input redirection by extracting the input file name.
-- Handle output redirection by extracting the output file name.
-- Parse the command normally if no redirection is detected.
-- Return the count of command tokens excluding the redirection file names.
+- Parse an and-or list: commands joined by '&&' and '||', which bind left to
+  right with equal precedence. A trailing '&' runs the whole list in the background.
+- Return the index of the first token after it, or -1 on a syntax error.
 */
-int parse_for_redirect(char *cmd, char **cmd_tokens)
-{
-  input_idx = 0;
-  output_idx = 0;
-  output_redi_type = 0;
-  input_redi = 0;
-  output_redi = 0;
-  in_file = NULL;
-  out_file = NULL;
-  int tok = 0;
+static int parse_and_or(const char *line, struct token *tokens, int pos, struct command *cmd)
+{
+  int start = tokens[pos].start;
+  memset(cmd, 0, sizeof(*cmd));
+  pos = parse_unit(line, tokens, pos, cmd);
 
-  // Detect input/output redirection symbols and set flags.
-  check_redirect(cmd, &input_redi, &input_idx, &output_redi, &output_redi_type, &output_idx);
+  while (pos >= 0 && (tokens[pos].type == TOK_AND_IF || tokens[pos].type == TOK_OR_IF))
+  {
+    struct command *left = new_command(CMD_PIPELINE);
+    *left = *cmd;
+    memset(cmd, 0, sizeof(*cmd));
+    cmd->type = tokens[pos].type == TOK_AND_IF ? CMD_AND : CMD_OR;
+    cmd->left = left;
+    cmd->right = new_command(CMD_PIPELINE);
+    pos = parse_unit(line, tokens, skip_separators(tokens, pos + 1), cmd->right);
+  }
+  if (pos < 0)
+    return -1;
 
-  char *copy = strdup(cmd); // the cmd string to avoid modifying the original
+  cmd->background = (tokens[pos].type == TOK_AMP);
+  if (cmd->type == CMD_PIPELINE)
+    cmd->pipeline->background = cmd->background;
+  int end = cmd->background ? tokens[pos].end : tokens[pos - 1].end;
+  cmd->text = arena_strndup(&line_arena, line + start, end - start); // with any '&', for history
+  return pos;
+}
 
-  // command with both input and output redirection
-  if (input_redi == 1 && output_redi == 1)
+/*
+- Parse commands separated by ';' and '&' into a sequence, up to the end of the
+  line, a ';;', or a reserved word closing the compound command around them.
+- Empty commands between separators are skipped.
+- Return the index of the token that ended the list, or -1 on a syntax error.
+*/
+static int parse_list(const char *line, struct token *tokens, int pos, struct sequence **list)
+{
+  struct sequence *seq = arena_alloc(&line_arena, sizeof(struct sequence));
+  int capacity = 4;
+  seq->num_commands = 0;
+  seq->commands = arena_alloc(&line_arena, sizeof(struct command) * capacity);
+
+  while (1)
   {
-    char *token;
-    token = strtok(copy, " <>\t\n");
-    while (token != NULL)
-    {
-      cmd_tokens[tok++] = strdup(token);
-      token = strtok(NULL, "<> \t\n");
-    }
+    while (tokens[pos].type == TOK_SEMI || tokens[pos].type == TOK_AMP)
+      pos++;
+    if (tokens[pos].type == TOK_END || tokens[pos].type == TOK_DSEMI || is_closing_word(&tokens[pos]))
+      break;
 
-    // check the order of the redirection and assign file names
-    if (input_idx < output_idx)
-    {
-      in_file = strdup(cmd_tokens[tok - 2]);
-      out_file = strdup(cmd_tokens[tok - 1]);
-    }
-    else
+    if (seq->num_commands == capacity)
     {
-      in_file = strdup(cmd_tokens[tok - 1]);
-      out_file = strdup(cmd_tokens[tok - 2]);
+      seq->commands = arena_realloc(&line_arena, seq->commands, sizeof(struct command) * capacity,
+                                    sizeof(struct command) * capacity * 2);
+      capacity *= 2;
     }
-    cmd_tokens[tok - 2] = cmd_tokens[tok - 1] = NULL;
-
-    return tok - 2;
+    pos = parse_and_or(line, tokens, pos, &seq->commands[seq->num_commands]);
+    if (pos < 0)
+      return -1;
+    seq->num_commands++;
   }
+  *list = seq;
+  return pos;
+}
 
-  // command with input redirection
-  if (input_redi == 1)
+static struct sequence *parse(char *line)
+{
+  int num_tokens;
+  unterminated = 0;
+  heredocs = NULL;
+  num_heredocs = heredocs_capacity = 0;
+  struct token *tokens = lex_line(line, &num_tokens);
+  if (unterminated)
   {
-    char *token;
-    char *copy = strdup(cmd);
+    unexpected_end(&tokens[num_tokens - 1]);
+    return NULL;
+  }
 
-    char **input_redirect_cmds = malloc((sizeof(char) * MAX_BUF_LEN) * MAX_BUF_LEN);
+  struct sequence *seq;
+  int pos = parse_list(line, tokens, 0, &seq);
+  if (pos >= 0 && tokens[pos].type != TOK_END)
+    pos = syntax_error(&tokens[pos]); // a closing word or ';;' with nothing to close
+  return pos < 0 ? NULL : seq;
+}
 
-    // Tokenize with '<' and store tokens in input_redirect_cmds array
-    token = strtok(copy, "<");
-    while (token != NULL)
-    {
-      input_redirect_cmds[tok++] = token;
-      token = strtok(NULL, "<");
-    }
+/*
+- Lex the command line and parse it into a sequence of commands separated by ';' and '&'.
+- Return the sequence, allocated in the line arena, or NULL after reporting a syntax error.
+*/
+struct sequence *parse_line(char *line)
+{
+  partial = 0;
+  return parse(line);
+}
 
-    copy = strdup(input_redirect_cmds[tok - 1]);
+/*
+- Parse a line that more lines may follow, as in a script or at the prompt.
+- A line ending inside a compound command, or after '|', '&&' or '||', is not an
+  error: it returns NULL with *more set, and the caller parses it again joined with
+  the next line.
+*/
+struct sequence *parse_line_partial(char *line, int *more)
+{
+  partial = 1;
+  incomplete = 0;
+  struct sequence *seq = parse(line);
+  partial = 0;
+  *more = incomplete;
+  return seq;
+}
 
-    // tokenize to extract the input file name, ignoring other delimiters
-    token = strtok(copy, "> |\t\n");
+/* Grows the argument vector, doubling it, until it holds needed slots */
+static void reserve_tokens(char ***tokens, int *capacity, int needed)
+{
+  if (needed <= *capacity)
+    return;
+  int grown = *capacity * 2;
+  while (grown < needed)
+    grown *= 2;
+  *tokens = arena_realloc(&line_arena, *tokens, sizeof(char *) * *capacity, sizeof(char *) * grown);
+  *capacity = grown;
+}
 
-    // assign file name
-    in_file = strdup(token);
+int last_status;
 
-    tok = 0;
+int substitution_status = -1;
 
-    // Tokenize the first part of the command to extract command tokens and store in cmd_tokens array
-    token = strtok(input_redirect_cmds[0], CMD_DELIMS);
+/*
+- Replace $? with the exit status of the last command, $NAME or ${NAME} with the
+  value of the shell variable NAME, nothing if it is unset, and $(command) or
+  `command` with the output of the command, less its trailing newlines. A '$'
+  before anything else stays as it is.
+- Return a copy of the word in the line arena.
+*/
+char *expand_parameters(const char *word)
+{
+  static char *buf;
+  static size_t buf_cap;
+  size_t len = 0;
+  char status[16];
 
-    while (token != NULL)
+  for (const char *p = word; *p != '\0';)
+  {
+    const char *value = NULL;
+    size_t skip = 1, value_len = 1, n;
+    if (p[0] == '$' && p[1] == '?')
     {
-      cmd_tokens[tok++] = strdup(token);
-      token = strtok(NULL, CMD_DELIMS);
+      snprintf(status, sizeof(status), "%d", last_status);
+      value = status;
+      skip = 2;
     }
+    else if (((p[0] == '$' && p[1] == '(') || p[0] == '`') && (n = substitution_length(p)) > 0)
+    {
+      // the command can expand words of its own, with this buffer: keep what is in it
+      char *done = len > 0 ? arena_strndup(&line_arena, buf, len) : NULL;
+      int open = p[0] == '$' ? 2 : 1;
+      value = command_output(arena_strndup(&line_arena, p + open, n - open - 1));
+      if (len > 0)
+        memcpy(buf, done, len);
+      skip = n;
+    }
+    else if (p[0] == '$' && (isalpha((unsigned char)p[1]) || p[1] == '_' || p[1] == '{'))
+    {
+      int braced = p[1] == '{';
+      const char *name = p + 1 + braced;
+      n = 0;
+      if (isalpha((unsigned char)name[0]) || name[0] == '_')
+        while (isalnum((unsigned char)name[n]) || name[n] == '_')
+          n++;
+      if (braced && (n == 0 || name[n] != '}'))
+        value = p; // not a parameter: ${ } or ${1x} stay as they are
+      else
+      {
+        skip = 1 + braced + n + braced;
+        value = var_lookup(name, n);
+        if (value == NULL)
+          value = "";
+      }
+    }
+    else
+      value = p;
+    if (value != p)
+      value_len = strlen(value);
 
-    cmd_tokens[tok] = NULL; // end of command tokens
-
-    free(input_redirect_cmds);
+    if (len + value_len + 1 > buf_cap)
+    {
+      buf_cap = (len + value_len + 1) * 2;
+      buf = realloc(buf, buf_cap);
+      if (buf == NULL)
+      {
+        perror("expand");
+        exit(EXIT_FAILURE);
+      }
+    }
+    memcpy(buf + len, value, value_len);
+    len += value_len;
+    p += skip;
   }
+  return arena_strndup(&line_arena, buf, len);
+}
 
-  // command with output redirection
-  if (output_redi == 1)
+/*
+- Split an expanded word into fields at blanks, as the values of variables may
+  hold several words.
+- Return the number of fields, 0 if the word was only blanks.
+*/
+static int split_fields(char *word, char ***fields)
+{
+  if (strpbrk(word, CMD_DELIMS) == NULL)
   {
-    char *copy = strdup(cmd);
-    char *token;
-    char **output_redirect_cmds = malloc((sizeof(char) * MAX_BUF_LEN) * MAX_BUF_LEN);
-
-    // Determine the delimiter based on the type of output redirection
-    // Tokenize the using the appropriate delimiter
-    if (output_redi_type == 1)
-      token = strtok(copy, ">");
-    else if (output_redi_type == 2)
-      token = strtok(copy, ">>");
-
-    while (token != NULL)
-    {
-      output_redirect_cmds[tok++] = token; // store tokens in output_redirect_cmds array
+    *fields = arena_alloc(&line_arena, sizeof(char *));
+    (*fields)[0] = word;
+    return word[0] != '\0';
+  }
 
-      // Continue tokenizing based on the redirection type
-      if (output_redi_type == 1)
-        token = strtok(NULL, ">");
-      else if (output_redi_type == 2)
-        token = strtok(NULL, ">>");
-    }
+  int count = 0, capacity = 4;
+  *fields = arena_alloc(&line_arena, sizeof(char *) * capacity);
+  for (char *p = word; *p != '\0';)
+  {
+    p += strspn(p, CMD_DELIMS);
+    size_t n = strcspn(p, CMD_DELIMS);
+    if (n == 0)
+      break;
+    reserve_tokens(fields, &capacity, count + 1);
+    (*fields)[count++] = arena_strndup(&line_arena, p, n);
+    p += n;
+  }
+  return count;
+}
 
-    // Duplicate last token, which contains the input file name
-    copy = strdup(output_redirect_cmds[tok - 1]);
-    token = strtok(copy, "< |\t\n"); // tokenize to extract the input file name, ignoring some delimiters
-    out_file = strdup(token);        // assign file name
+/*
+- Expand the words of a simple command into the argument vector to execute.
+- Parameters ($?, $NAME, ${NAME}) and command substitutions ($(...), `...`) are
+  expanded first and the result split into fields at blanks, then braces, then words containing '*' or '?' are replaced by
+  their glob matches.
+- Runs on every execution, so a parsed command sees the filesystem and the
+  parameters as they are now.
+- Set the count of arguments and return the NULL-terminated array.
+*/
+char **expand_words(struct simple_command *cmd, int *tokens)
+{
+  int tok = 0;
+  int capacity = cmd->argc + 1;
+  char **cmd_tokens = arena_alloc(&line_arena, sizeof(char *) * capacity);
 
-    tok = 0;
-    token = strtok(output_redirect_cmds[0], CMD_DELIMS);
+  for (int i = 0; i < cmd->argc; i++)
+  {
+    char *word = cmd->argv[i];
+    char **fields = &word;
+    int num_fields = 1;
+    if (strchr(word, '$') || strchr(word, '`'))
+      num_fields = split_fields(expand_parameters(word), &fields);
 
-    while (token != NULL)
+    for (int f = 0; f < num_fields; f++)
     {
-      cmd_tokens[tok++] = token;
-      token = strtok(NULL, CMD_DELIMS);
-    }
+      char **words = &fields[f];
+      int num_words = 1;
+      if (strchr(fields[f], '{'))
+        num_words = expand_braces(fields[f], &words);
 
-    free(output_redirect_cmds);
+      for (int w = 0; w < num_words; w++)
+      {
+        char *token = words[w];
+        if (strchr(token, '*') || strchr(token, '?'))
+          tok += expand_wildcard_token(token, &cmd_tokens, tok, &capacity);
+        else
+        {
+          reserve_tokens(&cmd_tokens, &capacity, tok + 2);
+          cmd_tokens[tok++] = token;
+        }
+      }
+    }
   }
-  // no redirection
-  if (input_redi == 0 && output_redi == 0)
-    return parse_command(strdup(cmd), cmd_tokens);
-  else
-    return tok; // Return command token count
+  cmd_tokens[tok] = NULL;
+
+  *tokens = tok;
+  return cmd_tokens;
 }
 
-/*
-- Duplicate the command string to preserve the original.
-- Tokenize the command by the pipe symbol '|'.
-- Store each tokenized command segment in the pipe_cmds array.
-- Set pipe_num to the total number of pipe-separated segments.
-*/
-void parse_for_piping(char *cmd)
+// Utility function to expand a token with wildcards
+// Matches come from the cached directory listings of glob_cache.c.
+// The token array grows in the line arena to fit the matches and a final NULL.
+int expand_wildcard_token(char *token, char ***expanded_tokens, int start_index, int *capacity)
 {
-  char *copy_cmd = strdup(cmd);
-  char *token;
-  int tok = 0;
-  token = strtok(copy_cmd, "|");
-  while (token != NULL)
+  char **matches;
+  int found = glob_cached(token, &matches);
+  int count = found > 0 ? found : 1;
+  reserve_tokens(expanded_tokens, capacity, start_index + count + 1);
+
+  if (found > 0)
+  // Matches found, add each to the expanded_tokens array
   {
-    pipe_cmds[tok++] = token;
-    token = strtok(NULL, "|");
+    for (int i = 0; i < count; ++i)
+      (*expanded_tokens)[start_index + i] = matches[i];
   }
-  pipe_num = tok;
+  else
+  {
+    // If no matches, keep the original token
+    (*expanded_tokens)[start_index] = token;
+  }
+
+  return count;
 }
@@ -1,15 +1,18 @@
 #include "header.h"
+#ifdef __linux__
+#include <sys/mman.h>
+#endif
 
 /*
    Opens the specified input file for reading, duplicates its file descriptor
    to standard input, and returns the file descriptor. Prints an error if opening fails.
 */
-int open_input_file(void)
+int open_input_file(char *file)
 {
-  int fd = open(in_file, O_RDONLY, S_IRWXU); // open in read-only mode
+  int fd = open(file, O_RDONLY, S_IRWXU); // open in read-only mode
   if (fd < 0)
   {
-    perror(in_file);
+    perror(file);
     return fd;
   }
 
@@ -27,20 +30,19 @@ int open_input_file(void)
    Opens the output file for writing (truncate/append), redirects to stdout,
    and returns the file descriptor. Prints error if opening fails.
 */
-int open_output_file(void)
+int open_output_file(char *file, enum redirect_type type)
 {
   int fd;
-  if (output_redi_type == 1)
-    fd = open(out_file, O_CREAT | O_WRONLY | O_TRUNC, S_IRWXU); // Opens for writing if exists, or creating if doesn't.
-  else if (output_redi_type == 2)
-    fd = open(out_file, O_CREAT | O_WRONLY | O_APPEND, S_IRWXU); // Opens for appending if exists, or creating if doesn't.
-  else if (output_redi_type == 2)
+  if (type == REDIR_APPEND)
+    fd = open(file, O_CREAT | O_WRONLY | O_APPEND, S_IRWXU); // Opens for appending if exists, or creating if doesn't.
+  else
+    fd = open(file, O_CREAT | O_WRONLY | O_TRUNC, S_IRWXU); // Opens for writing if exists, or creating if doesn't.
 
-    if (fd < 0)
-    {
-      perror(out_file);
-      return fd;
-    }
+  if (fd < 0)
+  {
+    perror(file);
+    return fd;
+  }
 
   if (dup2(fd, STDOUT_FILENO) < 0) // Duplicate the file descriptor to standard output
   {
@@ -52,3 +54,115 @@ int open_output_file(void)
   close(fd);
   return STDOUT_FILENO;
 }
+
+/*
+- Return the text a here-document or here-string feeds: the lines of the document,
+  or the word and a newline, with parameters and command substitutions expanded
+  (not in a document with a quoted delimiter).
+*/
+static const char *here_text(struct redirect *redir)
+{
+  if (redir->type == REDIR_HERE_STRING)
+  {
+    char *word = expand_parameters(redir->file);
+    size_t len = strlen(word);
+    char *text = arena_alloc(&line_arena, len + 2);
+    memcpy(text, word, len);
+    memcpy(text + len, "\n", 2);
+    return text;
+  }
+  const char *text = redir->text != NULL ? redir->text : "";
+  if ((redir->here_flags & HERE_LITERAL) || strpbrk(text, "$`") == NULL)
+    return text;
+  return expand_parameters(text);
+}
+
+/*
+- Put the text of a here-document or here-string into an anonymous file and
+  return a descriptor of it, open for reading from the start, or -1 after
+  printing an error.
+- On Linux the file is a memfd, sealed once written: nothing reaches a disk or
+  a filesystem, and unlike a pipe the whole text is there before the command
+  starts, so no process has to feed it and a large document cannot block the
+  shell. Elsewhere it is an unlinked temporary file.
+*/
+int open_here_document(struct redirect *redir)
+{
+  const char *text = here_text(redir);
+  size_t len = strlen(text);
+#ifdef __linux__
+  int fd = memfd_create("here-document", MFD_CLOEXEC | MFD_ALLOW_SEALING);
+#else
+  FILE *tmp = tmpfile();
+  int fd = tmp != NULL ? fcntl(fileno(tmp), F_DUPFD_CLOEXEC, 0) : -1;
+  if (tmp != NULL)
+    fclose(tmp);
+#endif
+  if (fd < 0)
+  {
+    perror("here-document");
+    return -1;
+  }
+
+  while (len > 0)
+  {
+    ssize_t n = write(fd, text, len);
+    if (n < 0 && errno == EINTR)
+      continue;
+    if (n < 0)
+    {
+      perror("here-document");
+      close(fd);
+      return -1;
+    }
+    text += n;
+    len -= n;
+  }
+#ifdef __linux__
+  fcntl(fd, F_ADD_SEALS, F_SEAL_SHRINK | F_SEAL_GROW | F_SEAL_WRITE | F_SEAL_SEAL);
+#endif
+  lseek(fd, 0, SEEK_SET);
+  return fd;
+}
+
+/*
+   Makes a here-document or here-string the standard input, and returns it.
+   Prints an error and returns -1 if its file cannot be made.
+*/
+static int open_here_input(struct redirect *redir)
+{
+  int fd = open_here_document(redir);
+  if (fd < 0)
+    return fd;
+
+  if (dup2(fd, STDIN_FILENO) < 0)
+  {
+    perror("dup2 failed");
+    close(fd);
+    return -1;
+  }
+  close(fd);
+  return STDIN_FILENO;
+}
+
+/*
+   Applies a command's redirections in source order, so the last one for a stream wins.
+   Returns 0 on success, -1 as soon as one of the files cannot be opened.
+*/
+int apply_redirects(struct redirect *redirects)
+{
+  for (struct redirect *redir = redirects; redir != NULL; redir = redir->next)
+  {
+    int fd;
+    if (redir->type == REDIR_INPUT)
+      fd = open_input_file(redir->file);
+    else if (redir->type == REDIR_HERE_DOC || redir->type == REDIR_HERE_STRING)
+      fd = open_here_input(redir);
+    else
+      fd = open_output_file(redir->file, redir->type);
+
+    if (fd < 0)
+      return -1;
+  }
+  return 0;
+}
@@ -1,71 +1,229 @@
 #include "header.h"
 
-char prompt[MAX_BUF_LEN] = "%";
+char *prompt;
+char *base_dir;
+char *cwd;
+
+pid_t my_pid, my_pgid, fgpid;
+int shell, shell_pgid;
+int interactive, job_control;
+
+/*
+- Choose where commands come from:
+  `shell -c 'commands'`, `shell script`, or stdin (interactive only on a terminal).
+- Exit with a usage error for a missing -c argument or an unreadable script.
+*/
+static void open_command_input(int argc, char **argv)
+{
+  if (argc > 1 && strcmp(argv[1], "-c") == 0)
+  {
+    if (argc < 3)
+    {
+      fprintf(stderr, "%s: -c: option requires an argument\n", argv[0]);
+      exit(2);
+    }
+    input_open_string(argv[2]);
+    return;
+  }
+
+  if (argc > 1)
+  {
+    int fd = open(argv[1], O_RDONLY | O_CLOEXEC);
+    if (fd < 0)
+    {
+      perror(argv[1]);
+      exit(127);
+    }
+    input_open_script(fd);
+    return;
+  }
+
+  interactive = isatty(STDIN_FILENO);
+  if (interactive && isatty(STDOUT_FILENO))
+    input_open_terminal(STDIN_FILENO); // line editing and Ctrl-R
+  else
+    input_open(STDIN_FILENO);
+}
+
+/* Reads one more line for the command being read, after a "> " prompt when interactive */
+static char *read_more_input(void)
+{
+  if (interactive)
+  {
+    printf("> ");
+    fflush(stdout);
+    input_start_line();
+  }
+  wait_for_input();
+  return read_command_line();
+}
+
+static char **here_texts; // lines of the here-documents of the command line, in order
+static int num_here_texts;
+
+/*
+- Read the lines of a here-document, up to the line holding only its delimiter
+  (leading tabs removed first with <<-).
+- The end of the input ends it too, with a warning.
+- Return the lines, each ended by a newline, in the line arena.
+*/
+static char *read_here_document(struct redirect *doc)
+{
+  static char *buf;
+  static size_t buf_cap;
+  size_t len = 0, delim_len = strlen(doc->file);
+
+  while (1)
+  {
+    char *line = read_more_input();
+    if (line == NULL)
+    {
+      fprintf(stderr, "warning: here-document delimited by end of file (wanted `%s')\n", doc->file);
+      break;
+    }
+    if (doc->here_flags & HERE_STRIP_TABS)
+      line += strspn(line, "\t");
+    size_t n = strlen(line);
+    while (n > 0 && (line[n - 1] == '\n' || line[n - 1] == '\r'))
+      n--;
+    if (n == delim_len && memcmp(line, doc->file, n) == 0)
+      break;
+
+    if (len + n + 2 > buf_cap)
+    {
+      buf_cap = (len + n + 2) * 2;
+      buf = realloc(buf, buf_cap);
+      if (buf == NULL)
+      {
+        perror("here-document");
+        exit(EXIT_FAILURE);
+      }
+    }
+    memcpy(buf + len, line, n);
+    len += n;
+    buf[len++] = '\n';
+  }
+  return arena_strndup(&line_arena, len > 0 ? buf : "", len);
+}
+
+/*
+- Give the here-documents of the line just parsed their lines: the next lines of
+  the input, in the order of the documents.
+- A command continued over more lines is parsed again as a whole: documents read
+  before keep their lines, only the new ones are read.
+*/
+static void read_here_documents(void)
+{
+  int count;
+  struct redirect **docs = here_documents(&count);
+  if (count > num_here_texts)
+  {
+    here_texts = arena_realloc(&line_arena, here_texts, sizeof(char *) * num_here_texts, sizeof(char *) * count);
+    for (int i = num_here_texts; i < count; i++)
+      here_texts[i] = read_here_document(docs[i]);
+    num_here_texts = count;
+  }
+  for (int i = 0; i < count; i++)
+    docs[i]->text = here_texts[i];
+}
 
 /*
- * 1. Init shell and set up
- * 2. Enter infinite shell loop - quit with 'exit'
- *    2.1 Signal handling for child processes and interrupts
- *    2.2 Display shell prompt
+- Read the next line of a command left unfinished by *cmdline, with a "> " prompt
+  when interactive, and parse the two joined with "; ", which keeps the command on
+  one line for history.
+- Return the sequence, or NULL with *more set if it is still unfinished.
+- The end of the input leaves it unfinished for good: a syntax error.
+*/
+static struct sequence *continue_command(char **cmdline, int *more)
+{
+  char *next = read_more_input();
+  if (next == NULL)
+  {
+    fprintf(stderr, "syntax error: unexpected end of file\n");
+    *more = 0;
+    return NULL;
+  }
+
+  size_t len = strlen(*cmdline), next_len = strlen(next);
+  while (len > 0 && ((*cmdline)[len - 1] == '\n' || (*cmdline)[len - 1] == '\r'))
+    len--;
+  char *joined = arena_alloc(&line_arena, len + next_len + 3);
+  memcpy(joined, *cmdline, len);
+  memcpy(joined + len, "; ", 2);
+  memcpy(joined + len + 2, next, next_len + 1);
+  *cmdline = joined;
+  return parse_line_partial(joined, more);
+}
+
+/*
+ * 1. Open the command input (terminal, script, piped stdin or -c), init shell and set up
+ * 2. Enter shell loop - quit with 'exit' or at the end of the input
+ *    2.1 Display shell prompt when interactive
+ *    2.2 Wait for input in the event loop, reaping finished jobs and handling Ctrl+C meanwhile
  *    2.3 Read command input
- *    2.4 Parse command input into command lines
- *    2.5 Add command into history
+ *    2.4 Lex and parse command input into a sequence of commands, reading more lines
+ *        while a compound command or a trailing |, && or || is unfinished, and the
+ *        lines of its here-documents
+ *    2.5 Add each command into history when interactive
  *    2.6 execute each command while managing piping, input/output redirection and background execution.
+ *    2.7 Release the line's memory by resetting the line arena
  */
 
-int main(void)
+int main(int argc, char **argv)
 {
+  open_command_input(argc, argv);
   setup();
+  event_watch_input(input_source_fd());
 
   // Shell loop
   while (1)
   {
-    // signal handling for child processes and interrupts
-    if (signal(SIGCHLD, handle_signal) == SIG_ERR)
-      perror("can't catch SIGCHLD");
-    if (signal(SIGINT, handle_signal) == SIG_ERR)
-      perror("can't catch SIGINT!");
-
     // Display shell prompt
-    printf("%s ", prompt);
+    if (interactive)
+    {
+      printf("%s ", prompt);
+      fflush(stdout);
+      input_start_line();
+    }
 
-    char **cmds = malloc((sizeof(char) * MAX_BUF_LEN) * MAX_BUF_LEN); // array of command lines
+    // Child exits and interrupts are handled here, outside any signal handler
+    wait_for_input();
 
     // read command input consists of one or several command lines
     char *cmdline = read_command_line();
-
-    // parse command input into separate command lines with '&' and/or ';'
-    int num_cmds = parse_command_line(cmdline, cmds);
-
-    for (int i = 0; i < num_cmds; i++)
+    if (cmdline == NULL) // end of input
     {
-      // Add command into history, which is set to 10
-      add_to_history(cmds[i]);
-      is_background = 0, pipe_num = 0;
-
-      char **cmd_tokens = malloc((sizeof(char) * MAX_BUF_LEN) * MAX_BUF_LEN); // array of command tokens
+      if (interactive)
+        printf("\n");
+      break;
+    }
 
-      for (int j = 0; j < MAX_BUF_LEN; j++)
-        cmd_tokens[j] = NULL;
+    // parse command input into commands separated by '&' and/or ';'
+    int more;
+    here_texts = NULL;
+    num_here_texts = 0;
+    struct sequence *seq = parse_line_partial(cmdline, &more);
+    read_here_documents();
+    while (seq == NULL && more)
+    {
+      seq = continue_command(&cmdline, &more);
+      read_here_documents();
+    }
 
-      // If not pipelines, handle command with/without IO redirect
-      if (is_piping(strdup(cmds[i])) == -1)
-      {
-        int tokens;
-        if (input_redi == 1 || output_redi == 1)
-          tokens = parse_for_redirect(strdup(cmds[i]), cmd_tokens);
-        else
-          tokens = parse_command(strdup(cmds[i]), cmd_tokens);
+    for (int i = 0; seq != NULL && i < seq->num_commands; i++)
+    {
+      // Add command into the history file
+      if (interactive)
+        add_to_history(seq->commands[i].text);
 
-        handle_normal_command(tokens, cmd_tokens);
-      }
-      else
-        // Shell pipelines, handle piping and redirection
-        handle_piping_and_redirect(cmds[i]);
+      // Run the command: a pipeline, an and-or list or a compound command
+      run_command(&seq->commands[i]);
     }
 
-    free(cmds);
-    free(cmdline);
+    // All parser and token memory for this line is handed back at once
+    arena_reset(&line_arena);
   }
-  return 0;
+
+  report_jobs();
+  return last_status; // as sh: the status of the last command run
 }
@@ -0,0 +1,148 @@
+#include "header.h"
+
+/*
+ * Command substitution, $(command) and `command`: the command runs and its output,
+ * less the trailing newlines, takes the place of the substitution in the word.
+ *
+ * As in sh, the command runs in a copy of the shell, so that a cd, export or exit
+ * in it leaves the shell alone. The copy writes into a pipe, which the shell drains
+ * with large reads into a buffer that doubles as it fills. A single builtin that
+ * only prints (echo, printf, pwd, test...: BUILTIN_PURE) needs no copy of the
+ * shell: it runs in the shell with stdout pointed at a memory buffer, with no fork
+ * and no pipe, which makes $(pwd) or $(echo ...) as cheap as a function call.
+ *
+ * substitution_status is the exit status of the last substitution, the status of
+ * a command made only of assignments (x=$(cmd)).
+ */
+
+#define SUBST_READ_MIN (64 * 1024) // least room offered to one read() of the output
+
+/*
+- Return the builtin a substitution can run in the shell itself, and its expanded
+  words in *argv: a single simple command, without redirections or assignments,
+  whose first word is the name of a BUILTIN_PURE builtin as written.
+- Return NULL otherwise, with nothing expanded, as the copy of the shell will
+  expand the words again.
+*/
+static const struct builtin *pure_builtin(struct sequence *seq, char ***argv)
+{
+  if (seq->num_commands != 1)
+    return NULL;
+  struct command *cmd = &seq->commands[0];
+  if (cmd->type != CMD_PIPELINE || cmd->background || cmd->pipeline->num_cmds != 1)
+    return NULL;
+  struct simple_command *simple = &cmd->pipeline->cmds[0];
+  if (simple->argc == 0 || simple->redirects != NULL || count_assignments(simple) > 0)
+    return NULL;
+
+  const struct builtin *b = find_builtin(simple->argv[0]);
+  if (b == NULL || !(b->flags & BUILTIN_PURE))
+    return NULL;
+
+  int tokens;
+  *argv = expand_words(simple, &tokens);
+  return tokens > 0 && strcmp((*argv)[0], b->name) == 0 ? b : NULL;
+}
+
+/*
+- Run a pure builtin with its output going to a memory buffer.
+- Return the output in the line arena and set *len, or NULL if no buffer could
+  be opened.
+*/
+static char *run_in_shell(const struct builtin *b, char **argv, size_t *len)
+{
+  char *text = NULL;
+  size_t size = 0;
+  FILE *mem = open_memstream(&text, &size);
+  if (mem == NULL)
+    return NULL;
+
+  FILE *saved = stdout;
+  stdout = mem;
+  substitution_status = run_builtin(b, argv, NULL);
+  stdout = saved;
+  fclose(mem);
+
+  char *out = arena_strndup(&line_arena, text, size);
+  free(text);
+  *len = size;
+  return out;
+}
+
+/*
+- Run a sequence in a copy of the shell and read all it writes on stdout.
+- Return the output in the line arena and set *len.
+*/
+static char *run_in_subshell(struct sequence *seq, size_t *len)
+{
+  int fds[2];
+  *len = 0;
+  if (make_pipe(fds) < 0)
+  {
+    perror("command substitution");
+    substitution_status = 1;
+    return arena_strdup(&line_arena, "");
+  }
+
+  // the copy stays in the shell's process group: Ctrl-C reaches it as the foreground
+  pid_t pid = fork_sequence(seq, my_pgid, -1, fds[1]);
+  close(fds[1]);
+
+  size_t capacity = SUBST_READ_MIN * 2;
+  char *out = arena_alloc(&line_arena, capacity);
+  while (1)
+  {
+    if (capacity - *len < SUBST_READ_MIN)
+    {
+      out = arena_realloc(&line_arena, out, capacity, capacity * 2);
+      capacity *= 2;
+    }
+    ssize_t n = read(fds[0], out + *len, capacity - *len - 1);
+    if (n > 0)
+      *len += n;
+    else if (n == 0 || errno != EINTR)
+      break;
+  }
+  close(fds[0]);
+
+  substitution_status = 1;
+  int status;
+  if (pid > 0)
+  {
+    while (waitpid(pid, &status, 0) < 0 && errno == EINTR)
+      ;
+    substitution_status = exit_code(status);
+  }
+  if (substitution_status == 128 + SIGINT)
+    check_interrupt(); // Ctrl-C: the command the substitution is part of does not run
+  out[*len] = '\0';
+  return out;
+}
+
+/*
+- Run the command of a substitution and return its output without the trailing
+  newlines, in the line arena.
+- Set substitution_status to its exit status, 2 for a syntax error.
+*/
+char *command_output(char *command)
+{
+  struct sequence *seq = parse_line(command);
+  if (seq == NULL)
+  {
+    substitution_status = 2;
+    return arena_strdup(&line_arena, "");
+  }
+
+  char **argv, *out = NULL;
+  size_t len = 0;
+  const struct builtin *b = pure_builtin(seq, &argv);
+  if (b != NULL)
+    out = run_in_shell(b, argv, &len);
+  if (out == NULL)
+    out = run_in_subshell(seq, &len);
+
+  while (len > 0 && out[len - 1] == '\n')
+    len--;
+  out[len] = '\0';
+  return out;
+}
@@ -0,0 +1,200 @@
+#include "header.h"
+#include <sys/resource.h>
+#include <sys/time.h>
+#include <time.h>
+
+/*
+ * Resource accounting. Children are reaped with wait4(), and the rusage of every
+ * finished process is added to the session totals shown by `jobstats`. While a
+ * `time` pipeline runs in the foreground, its processes are also collected one
+ * by one, so `time` can show each stage next to the pipeline total.
+ */
+
+struct stage_usage
+{
+  char *name;
+  int pid;
+  struct usage usage;
+};
+
+static struct usage session_usage;
+static int timing;                  // a `time` pipeline is running
+static struct stage_usage *stages; // its processes, in the line arena
+static int num_stages, stages_capacity;
+
+double now_seconds(void)
+{
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static double timeval_seconds(struct timeval tv)
+{
+  return tv.tv_sec + tv.tv_usec / 1e6;
+}
+
+static void usage_add_rusage(struct usage *u, const struct rusage *ru, double real)
+{
+  long maxrss = ru->ru_maxrss;
+#ifdef __APPLE__
+  maxrss /= 1024; // bytes on macOS, KiB elsewhere
+#endif
+  u->procs++;
+  u->real += real;
+  u->user += timeval_seconds(ru->ru_utime);
+  u->sys += timeval_seconds(ru->ru_stime);
+  if (maxrss > u->maxrss)
+    u->maxrss = maxrss;
+  u->nvcsw += ru->ru_nvcsw;
+  u->nivcsw += ru->ru_nivcsw;
+  u->minflt += ru->ru_minflt;
+  u->majflt += ru->ru_majflt;
+}
+
+/*
+- Account a process that has just been reaped with wait4(), before it leaves the process table.
+- Its wall time runs from launch to reaping.
+*/
+void account_process(int pid, const struct rusage *ru)
+{
+  process_info *proc = find_process(pid);
+  if (proc == NULL)
+    return;
+
+  double real = now_seconds() - proc->started;
+  usage_add_rusage(&session_usage, ru, real);
+
+  if (!timing)
+    return;
+  if (num_stages == stages_capacity)
+  {
+    int grown = stages_capacity ? stages_capacity * 2 : 8;
+    stages = arena_realloc(&line_arena, stages, sizeof(struct stage_usage) * stages_capacity,
+                           sizeof(struct stage_usage) * grown);
+    stages_capacity = grown;
+  }
+  struct stage_usage *stage = &stages[num_stages++];
+  memset(stage, 0, sizeof(*stage));
+  stage->name = arena_strdup(&line_arena, proc->name);
+  stage->pid = pid;
+  usage_add_rusage(&stage->usage, ru, real);
+}
+
+static void print_usage(const char *label, const struct usage *u)
+{
+  fprintf(stderr, "%s real %.3fs  user %.3fs  sys %.3fs  maxrss %ld KiB  ctxsw %ld/%ld  faults %ld/%ld\n",
+          label, u->real, u->user, u->sys, u->maxrss, u->nvcsw, u->nivcsw, u->minflt, u->majflt);
+}
+
+/*
+- Run a pipeline, its keyword taken off, and report its resource usage on stderr.
+- The total line gives the wall time of the whole pipeline and the CPU, memory, context
+  switches (voluntary/involuntary) and page faults (minor/major) of its processes plus
+  the shell's own share, so builtins are timed too. Pipelines also get a line per stage.
+- A background pipeline is started without timing.
+- The `profile` keyword does the same and also measures the data flowing between
+  the stages (see profile.c).
+- Return the exit status of the pipeline.
+*/
+static int run_timed(struct pipeline *pl, int profile)
+{
+  struct simple_command *first = &pl->cmds[0];
+  if (pl->background || (first->argc == 0 && pl->num_cmds == 1 && first->redirects == NULL))
+    return first->argc > 0 || first->redirects != NULL ? run_pipeline(pl) : 0;
+
+  struct rusage self_before, self_after;
+  getrusage(RUSAGE_SELF, &self_before);
+  double start = now_seconds();
+
+  timing = 1;
+  stages = NULL;
+  num_stages = stages_capacity = 0;
+  if (profile && pl->num_cmds > 1)
+    profile_start();
+  int status = run_pipeline(pl);
+  if (profile)
+    profile_stop();
+  timing = 0;
+
+  struct usage total;
+  memset(&total, 0, sizeof(total));
+  for (int i = 0; i < num_stages; i++)
+  {
+    struct usage *s = &stages[i].usage;
+    total.user += s->user;
+    total.sys += s->sys;
+    if (s->maxrss > total.maxrss)
+      total.maxrss = s->maxrss;
+    total.nvcsw += s->nvcsw;
+    total.nivcsw += s->nivcsw;
+    total.minflt += s->minflt;
+    total.majflt += s->majflt;
+  }
+
+  getrusage(RUSAGE_SELF, &self_after);
+  total.user += timeval_seconds(self_after.ru_utime) - timeval_seconds(self_before.ru_utime);
+  total.sys += timeval_seconds(self_after.ru_stime) - timeval_seconds(self_before.ru_stime);
+  total.nvcsw += self_after.ru_nvcsw - self_before.ru_nvcsw;
+  total.nivcsw += self_after.ru_nivcsw - self_before.ru_nivcsw;
+  total.minflt += self_after.ru_minflt - self_before.ru_minflt;
+  total.majflt += self_after.ru_majflt - self_before.ru_majflt;
+  total.real = now_seconds() - start;
+
+  fflush(stdout);
+  print_usage(profile ? "profile:" : "time:", &total);
+  if (pl->num_cmds > 1 && num_stages > 1)
+    for (int i = 0; i < num_stages; i++)
+    {
+      char label[64];
+      snprintf(label, sizeof(label), "  %-12.12s pid %-7d", stages[i].name, stages[i].pid);
+      print_usage(label, &stages[i].usage);
+    }
+  if (profile)
+    profile_report(pl);
+  return status;
+}
+
+/*
+   Runs a pipeline that starts with the `time` or `profile` keyword. The keyword is
+   put back afterwards, for a loop to run the pipeline again.
+*/
+int time_pipeline(struct pipeline *pl)
+{
+  struct simple_command *first = &pl->cmds[0];
+  int profile = strcmp(first->argv[0], "profile") == 0;
+  first->argc--;
+  first->argv++;
+  int status = run_timed(pl, profile);
+  first->argc++;
+  first->argv--;
+  return status;
+}
+
+/*
+- `jobstats` prints the resource usage summed over every process the session has reaped.
+- `jobstats -r` starts the totals again from zero.
+*/
+int jobstats_builtin(char **cmd_tokens)
+{
+  if (cmd_tokens[1] != NULL && strcmp(cmd_tokens[1], "-r") == 0)
+  {
+    memset(&session_usage, 0, sizeof(session_usage));
+    return 0;
+  }
+  if (cmd_tokens[1] != NULL)
+  {
+    fprintf(stderr, "jobstats: usage: jobstats [-r]\n");
+    return 1;
+  }
+
+  const struct usage *u = &session_usage;
+  printf("processes %d\n", u->procs);
+  printf("real      %.3fs\n", u->real);
+  printf("user      %.3fs\n", u->user);
+  printf("sys       %.3fs\n", u->sys);
+  printf("maxrss    %ld KiB\n", u->maxrss);
+  printf("ctxsw     %ld voluntary, %ld involuntary\n", u->nvcsw, u->nivcsw);
+  printf("faults    %ld minor, %ld major\n", u->minflt, u->majflt);
+  return 0;
+}
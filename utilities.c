@@ -0,0 +1,584 @@
+#include "header.h"
+#include <ctype.h>
+
+/*
+ * echo, printf, test and [, true and false: the small utilities scripts run the
+ * most, run in the shell instead of a process of their own. They behave like the
+ * POSIX utilities, with the common extensions of bash's builtins (echo -e, printf
+ * %b, test ==, < and >). Their output goes through stdout, which the shell flushes
+ * after every builtin.
+ */
+
+/*
+- Print the escape sequence at *s to out, just after a backslash, and move *s past it.
+- With echo_style, octal escapes are \0nnn, else \nnn.
+- Return 1 for \c, which ends the output, else 0.
+*/
+static int put_escape(FILE *out, const char **s, int echo_style)
+{
+  const char *p = *s;
+  int c = *p++;
+  switch (c)
+  {
+  case 'a': putc('\a', out); break;
+  case 'b': putc('\b', out); break;
+  case 'e': putc('\033', out); break;
+  case 'f': putc('\f', out); break;
+  case 'n': putc('\n', out); break;
+  case 'r': putc('\r', out); break;
+  case 't': putc('\t', out); break;
+  case 'v': putc('\v', out); break;
+  case '\\': putc('\\', out); break;
+  case 'c':
+    *s = p;
+    return 1;
+  case 'x':
+  {
+    int value = 0, digits = 0;
+    while (digits < 2 && isxdigit((unsigned char)*p))
+    {
+      value = value * 16 + (isdigit((unsigned char)*p) ? *p - '0' : tolower((unsigned char)*p) - 'a' + 10);
+      p++;
+      digits++;
+    }
+    if (digits > 0)
+      putc(value, out);
+    else
+      fputs("\\x", out);
+    break;
+  }
+  case '\0':
+    putc('\\', out);
+    p--; // leave the end of the string
+    break;
+  default:
+    if (c >= '0' && c <= '7' && (c == '0' || !echo_style))
+    {
+      int value = 0, digits = 0;
+      if (!echo_style)
+        p--; // the first digit is part of the number, echo's 0 is not
+      while (digits < 3 && *p >= '0' && *p <= '7')
+      {
+        value = value * 8 + (*p++ - '0');
+        digits++;
+      }
+      putc(value, out);
+    }
+    else
+    {
+      putc('\\', out);
+      putc(c, out);
+    }
+  }
+  *s = p;
+  return 0;
+}
+
+/*
+- Print s to out, interpreting backslash escapes.
+- Return 1 if a \c ended the output, else 0.
+*/
+static int put_escaped(FILE *out, const char *s, int echo_style)
+{
+  while (*s != '\0')
+  {
+    if (*s != '\\')
+    {
+      putc(*s++, out);
+      continue;
+    }
+    s++;
+    if (put_escape(out, &s, echo_style))
+      return 1;
+  }
+  return 0;
+}
+
+/*
+   echo [-neE] [word...]: prints the words separated by spaces. -n leaves out the
+   newline, -e interprets backslash escapes and -E does not (the default).
+   Arguments that are not only made of those letters are words, like "-" or "-x".
+*/
+int echo_builtin(char **cmd_tokens)
+{
+  int newline = 1, escapes = 0, i = 1;
+  for (; cmd_tokens[i] != NULL && cmd_tokens[i][0] == '-' && cmd_tokens[i][1] != '\0'; i++)
+  {
+    if (strspn(cmd_tokens[i] + 1, "neE") != strlen(cmd_tokens[i] + 1))
+      break;
+    for (const char *opt = cmd_tokens[i] + 1; *opt != '\0'; opt++)
+    {
+      if (*opt == 'n')
+        newline = 0;
+      else
+        escapes = *opt == 'e';
+    }
+  }
+
+  for (int first = i; cmd_tokens[i] != NULL; i++)
+  {
+    if (i > first)
+      putchar(' ');
+    if (!escapes)
+      fputs(cmd_tokens[i], stdout);
+    else if (put_escaped(stdout, cmd_tokens[i], 1))
+      return 0;
+  }
+  if (newline)
+    putchar('\n');
+  return 0;
+}
+
+/* -------------------------------------------------------------------*/
+
+/*
+- Convert a printf argument to a number: decimal, 0-prefixed octal, 0x hex, or the
+  code of the character after a leading quote.
+- Print an error and set *status to 1 if the argument is not entirely a number.
+*/
+static long long printf_number(const char *arg, int *status)
+{
+  if (arg == NULL)
+    return 0;
+  if (arg[0] == '\'' || arg[0] == '"')
+    return (unsigned char)arg[1];
+
+  char *end;
+  errno = 0;
+  long long value = strtoll(arg, &end, 0);
+  if (end == arg || *end != '\0' || errno != 0)
+  {
+    fprintf(stderr, "printf: %s: invalid number\n", arg);
+    *status = 1;
+  }
+  return value;
+}
+
+static double printf_float(const char *arg, int *status)
+{
+  if (arg == NULL)
+    return 0;
+  if (arg[0] == '\'' || arg[0] == '"')
+    return (unsigned char)arg[1];
+
+  char *end;
+  double value = strtod(arg, &end);
+  if (end == arg || *end != '\0')
+  {
+    fprintf(stderr, "printf: %s: invalid number\n", arg);
+    *status = 1;
+  }
+  return value;
+}
+
+/* Next argument, NULL once they are used up: conversions then print "" or 0 */
+static const char *next_arg(char ***args)
+{
+  return **args != NULL ? *(*args)++ : NULL;
+}
+
+/*
+   Prints one conversion of the format at *format, just after its '%', and moves
+   *format past it. Flags, width and precision are passed on to the C printf, with
+   a `*` taken from the arguments. Returns 1 after \c in a %b argument, -1 for an
+   invalid conversion, else 0.
+*/
+static int printf_conversion(const char **format, char ***args, int *status)
+{
+  const char *p = *format;
+  char spec[64];
+  int len = 0;
+  spec[len++] = '%';
+
+  while (*p != '\0' && strchr("-+ #0", *p) != NULL && len < 8)
+    spec[len++] = *p++;
+  for (int part = 0; part < 2; part++)
+  {
+    if (part == 1)
+    {
+      if (*p != '.')
+        break;
+      spec[len++] = *p++;
+    }
+    if (*p == '*')
+    {
+      len += snprintf(spec + len, 16, "%d", (int)printf_number(next_arg(args), status));
+      p++;
+    }
+    else
+      while (isdigit((unsigned char)*p) && len < 40)
+        spec[len++] = *p++;
+  }
+
+  char conv = *p;
+  if (conv == '\0' || strchr("diouxXcsbfFeEgGaA", conv) == NULL)
+  {
+    fprintf(stderr, "printf: %%%c: invalid directive\n", conv);
+    *format = conv == '\0' ? p : p + 1;
+    return -1;
+  }
+  *format = p + 1;
+
+  const char *arg = next_arg(args);
+
+  switch (conv)
+  {
+  case 'd':
+  case 'i':
+    spec[len++] = 'l';
+    spec[len++] = 'l';
+    spec[len++] = conv;
+    spec[len] = '\0';
+    printf(spec, printf_number(arg, status));
+    break;
+  case 'o':
+  case 'u':
+  case 'x':
+  case 'X':
+    spec[len++] = 'l';
+    spec[len++] = 'l';
+    spec[len++] = conv;
+    spec[len] = '\0';
+    printf(spec, (unsigned long long)printf_number(arg, status));
+    break;
+  case 'c':
+    if (arg != NULL && arg[0] != '\0')
+    {
+      spec[len++] = 'c';
+      spec[len] = '\0';
+      printf(spec, arg[0]);
+      break;
+    }
+    // no character, only the padding
+    /* fall through */
+  case 's':
+    spec[len++] = 's';
+    spec[len] = '\0';
+    printf(spec, arg != NULL ? arg : "");
+    break;
+  case 'b':
+  {
+    // expand the escapes into a buffer first, so width and precision apply to the result
+    char *text = NULL;
+    size_t size = 0;
+    FILE *mem = open_memstream(&text, &size);
+    int stop = 0;
+    if (mem != NULL)
+    {
+      stop = put_escaped(mem, arg != NULL ? arg : "", 0);
+      fclose(mem);
+      spec[len++] = 's';
+      spec[len] = '\0';
+      printf(spec, text);
+      free(text);
+    }
+    return stop;
+  }
+  default: // floating point
+    spec[len++] = conv;
+    spec[len] = '\0';
+    printf(spec, printf_float(arg, status));
+  }
+  return 0;
+}
+
+/*
+   printf format [argument...]: prints the arguments under control of the format,
+   with the conversions of the C printf (d i o u x X c s f F e E g G a A), %b for an
+   argument with backslash escapes, and %% for a percent sign. The format is reused
+   while arguments are left; missing ones print as "" or 0.
+   Returns 1 if an argument was not a valid number, 2 on a usage error.
+*/
+int printf_builtin(char **cmd_tokens)
+{
+  if (cmd_tokens[1] == NULL)
+  {
+    fprintf(stderr, "printf: usage: printf format [arguments]\n");
+    return 2;
+  }
+
+  char **args = cmd_tokens + 2;
+  int status = 0;
+  do
+  {
+    char **before = args;
+    for (const char *p = cmd_tokens[1]; *p != '\0';)
+    {
+      if (*p == '\\')
+      {
+        p++;
+        if (put_escape(stdout, &p, 0))
+          return status;
+      }
+      else if (*p == '%' && p[1] == '%')
+      {
+        putchar('%');
+        p += 2;
+      }
+      else if (*p == '%')
+      {
+        p++;
+        int r = printf_conversion(&p, &args, &status);
+        if (r == 1)
+          return status;
+        if (r < 0)
+          return 1;
+      }
+      else
+        putchar(*p++);
+    }
+    if (args == before)
+      break; // a format without conversions prints once
+  } while (*args != NULL);
+  return status;
+}
+
+/* -------------------------------------------------------------------*/
+
+/*
+   test expression, or [ expression ]: evaluates the expression with a recursive
+   descent over its arguments:
+
+     expr    := and ('-o' and)*
+     and     := not ('-a' not)*
+     not     := '!' not | primary
+     primary := '(' expr ')' | word binary-op word | unary-op word | word
+
+   A binary operator is tried before a unary one, so `test -n = -n` compares two
+   strings, and an operator with no operand is a plain word, so `test -n` is true.
+*/
+
+struct test_state
+{
+  char **args;
+  int argc, pos;
+  int error; // 2 once the expression is malformed
+  const char *name;
+};
+
+static int test_or(struct test_state *t);
+
+static void test_error(struct test_state *t, const char *what, const char *arg)
+{
+  if (!t->error)
+  {
+    if (arg != NULL)
+      fprintf(stderr, "%s: %s: %s\n", t->name, arg, what);
+    else
+      fprintf(stderr, "%s: %s\n", t->name, what);
+  }
+  t->error = 2;
+}
+
+static long long test_integer(struct test_state *t, const char *arg)
+{
+  char *end;
+  errno = 0;
+  long long value = strtoll(arg, &end, 10);
+  while (isspace((unsigned char)*end))
+    end++;
+  if (end == arg || *end != '\0' || errno != 0)
+    test_error(t, "integer expression expected", arg);
+  return value;
+}
+
+static int is_binary_op(const char *op)
+{
+  static const char *ops[] = {"=", "==", "!=", "<", ">", "-eq", "-ne", "-lt", "-le", "-gt", "-ge", "-nt", "-ot", "-ef", NULL};
+  for (int i = 0; ops[i] != NULL; i++)
+    if (strcmp(op, ops[i]) == 0)
+      return 1;
+  return 0;
+}
+
+static int is_unary_op(const char *op)
+{
+  return op[0] == '-' && op[1] != '\0' && op[2] == '\0' && strchr("bcdefghknprstuwxzLOGS", op[1]) != NULL;
+}
+
+static int test_binary(struct test_state *t, const char *left, const char *op, const char *right)
+{
+  if (strcmp(op, "=") == 0 || strcmp(op, "==") == 0)
+    return strcmp(left, right) == 0;
+  if (strcmp(op, "!=") == 0)
+    return strcmp(left, right) != 0;
+  if (strcmp(op, "<") == 0)
+    return strcmp(left, right) < 0;
+  if (strcmp(op, ">") == 0)
+    return strcmp(left, right) > 0;
+
+  if (strcmp(op, "-nt") == 0 || strcmp(op, "-ot") == 0 || strcmp(op, "-ef") == 0)
+  {
+    struct stat a, b;
+    int has_a = stat(left, &a) == 0, has_b = stat(right, &b) == 0;
+    if (op[1] == 'e')
+      return has_a && has_b && a.st_dev == b.st_dev && a.st_ino == b.st_ino;
+    if (!has_a || !has_b)
+      return op[1] == 'n' ? has_a : has_b;
+    double ta = a.st_mtim.tv_sec + a.st_mtim.tv_nsec / 1e9, tb = b.st_mtim.tv_sec + b.st_mtim.tv_nsec / 1e9;
+    return op[1] == 'n' ? ta > tb : ta < tb;
+  }
+
+  long long l = test_integer(t, left), r = test_integer(t, right);
+  if (strcmp(op, "-eq") == 0)
+    return l == r;
+  if (strcmp(op, "-ne") == 0)
+    return l != r;
+  if (strcmp(op, "-lt") == 0)
+    return l < r;
+  if (strcmp(op, "-le") == 0)
+    return l <= r;
+  if (strcmp(op, "-gt") == 0)
+    return l > r;
+  return l >= r;
+}
+
+static int test_unary(struct test_state *t, char op, const char *arg)
+{
+  struct stat st;
+  switch (op)
+  {
+  case 'n': return arg[0] != '\0';
+  case 'z': return arg[0] == '\0';
+  case 't': return isatty((int)test_integer(t, arg));
+  case 'r': return access(arg, R_OK) == 0;
+  case 'w': return access(arg, W_OK) == 0;
+  case 'x': return access(arg, X_OK) == 0;
+  case 'h':
+  case 'L': return lstat(arg, &st) == 0 && S_ISLNK(st.st_mode);
+  }
+
+  if (stat(arg, &st) != 0)
+    return 0;
+  switch (op)
+  {
+  case 'e': return 1;
+  case 'f': return S_ISREG(st.st_mode);
+  case 'd': return S_ISDIR(st.st_mode);
+  case 'b': return S_ISBLK(st.st_mode);
+  case 'c': return S_ISCHR(st.st_mode);
+  case 'p': return S_ISFIFO(st.st_mode);
+  case 'S': return S_ISSOCK(st.st_mode);
+  case 's': return st.st_size > 0;
+  case 'g': return (st.st_mode & S_ISGID) != 0;
+  case 'u': return (st.st_mode & S_ISUID) != 0;
+  case 'k': return (st.st_mode & S_ISVTX) != 0;
+  case 'O': return st.st_uid == geteuid();
+  case 'G': return st.st_gid == getegid();
+  }
+  return 0;
+}
+
+static int test_primary(struct test_state *t)
+{
+  if (t->pos >= t->argc)
+  {
+    test_error(t, "argument expected", NULL);
+    return 0;
+  }
+
+  const char *arg = t->args[t->pos];
+  if (t->pos + 2 < t->argc && is_binary_op(t->args[t->pos + 1]))
+  {
+    t->pos += 3;
+    return test_binary(t, arg, t->args[t->pos - 2], t->args[t->pos - 1]);
+  }
+  if (strcmp(arg, "(") == 0 && t->pos + 1 < t->argc)
+  {
+    t->pos++;
+    int value = test_or(t);
+    if (t->pos >= t->argc || strcmp(t->args[t->pos], ")") != 0)
+      test_error(t, "`)' expected", NULL);
+    else
+      t->pos++;
+    return value;
+  }
+  if (is_unary_op(arg) && t->pos + 1 < t->argc)
+  {
+    t->pos += 2;
+    return test_unary(t, arg[1], t->args[t->pos - 1]);
+  }
+  t->pos++;
+  return arg[0] != '\0';
+}
+
+static int test_not(struct test_state *t)
+{
+  if (t->pos < t->argc && strcmp(t->args[t->pos], "!") == 0 && t->pos + 1 < t->argc)
+  {
+    t->pos++;
+    return !test_not(t);
+  }
+  return test_primary(t);
+}
+
+static int test_and(struct test_state *t)
+{
+  int value = test_not(t);
+  while (t->pos < t->argc && strcmp(t->args[t->pos], "-a") == 0)
+  {
+    t->pos++;
+    value = test_not(t) && value;
+  }
+  return value;
+}
+
+static int test_or(struct test_state *t)
+{
+  int value = test_and(t);
+  while (t->pos < t->argc && strcmp(t->args[t->pos], "-o") == 0)
+  {
+    t->pos++;
+    value = test_and(t) || value;
+  }
+  return value;
+}
+
+/* Evaluates argc arguments; returns 0 for true, 1 for false, 2 for an error */
+static int run_test(const char *name, char **args, int argc)
+{
+  if (argc == 0)
+    return 1;
+  if (argc == 3 && strcmp(args[0], "(") == 0 && strcmp(args[2], ")") == 0)
+    return args[1][0] == '\0'; // a word in parentheses, even an operator: ( ! )
+
+  struct test_state t = {args, argc, 0, 0, name};
+  int value = test_or(&t);
+  if (!t.error && t.pos < t.argc)
+    test_error(&t, "too many arguments", NULL);
+  return t.error ? 2 : !value;
+}
+
+int test_builtin(char **cmd_tokens)
+{
+  int argc = 0;
+  while (cmd_tokens[argc + 1] != NULL)
+    argc++;
+  return run_test("test", cmd_tokens + 1, argc);
+}
+
+/* [ expression ]: test with a closing bracket */
+int bracket_builtin(char **cmd_tokens)
+{
+  int argc = 0;
+  while (cmd_tokens[argc + 1] != NULL)
+    argc++;
+  if (argc == 0 || strcmp(cmd_tokens[argc], "]") != 0)
+  {
+    fprintf(stderr, "[: missing `]'\n");
+    return 2;
+  }
+  return run_test("[", cmd_tokens + 1, argc - 1);
+}
+
+int true_builtin(char **cmd_tokens)
+{
+  (void)cmd_tokens;
+  return 0;
+}
+
+int false_builtin(char **cmd_tokens)
+{
+  (void)cmd_tokens;
+  return 1;
+}
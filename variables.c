@@ -0,0 +1,399 @@
+#include "header.h"
+#include <ctype.h>
+
+/*
+ * Shell variables, in an open-addressing hash table: linear probing over a
+ * power-of-two array, deleted slots left as tombstones until the next resize.
+ * Each variable is one "NAME=value" string, so the environment of a new process
+ * is just the array of pointers to the exported ones. That array is rebuilt only
+ * after an exported variable changed, and every launch in between hands the same
+ * ready-made array to exec.
+ *
+ * The table starts with the shell's own environment, all of it exported.
+ */
+
+#define VAR_EXPORTED 1
+
+struct variable
+{
+  char *pair; // "NAME=value"; NULL for a free slot, tombstone for a deleted one
+  size_t name_len;
+  unsigned hash;
+  int flags;
+};
+
+static struct variable *table;
+static size_t capacity, used, tombstones;
+static char tombstone[1];
+
+static char **envp;      // exported pairs, NULL-terminated, for exec
+static size_t envp_cap;
+static int envp_stale = 1;
+
+static unsigned hash_name(const char *name, size_t len)
+{
+  unsigned h = 2166136261u; // FNV-1a
+  for (size_t i = 0; i < len; i++)
+    h = (h ^ (unsigned char)name[i]) * 16777619u;
+  return h;
+}
+
+/*
+- Find the slot of a variable, or where to insert it: the first tombstone passed,
+  else the free slot that ended the probe.
+- Set *found to tell which.
+*/
+static size_t probe(const char *name, size_t len, unsigned h, int *found)
+{
+  size_t mask = capacity - 1, i = h & mask, reuse = (size_t)-1;
+  while (1)
+  {
+    struct variable *v = &table[i];
+    if (v->pair == NULL)
+    {
+      *found = 0;
+      return reuse != (size_t)-1 ? reuse : i;
+    }
+    if (v->pair == tombstone)
+    {
+      if (reuse == (size_t)-1)
+        reuse = i;
+    }
+    else if (v->hash == h && v->name_len == len && memcmp(v->pair, name, len) == 0)
+    {
+      *found = 1;
+      return i;
+    }
+    i = (i + 1) & mask;
+  }
+}
+
+/* Rehashes the live variables into a table of new_capacity slots, dropping the tombstones */
+static void resize(size_t new_capacity)
+{
+  struct variable *old = table;
+  size_t old_capacity = capacity;
+
+  table = calloc(new_capacity, sizeof(struct variable));
+  if (table == NULL)
+  {
+    perror("variables");
+    exit(EXIT_FAILURE);
+  }
+  capacity = new_capacity;
+  tombstones = 0;
+
+  for (size_t i = 0; i < old_capacity; i++)
+    if (old[i].pair != NULL && old[i].pair != tombstone)
+    {
+      size_t j = old[i].hash & (capacity - 1);
+      while (table[j].pair != NULL)
+        j = (j + 1) & (capacity - 1);
+      table[j] = old[i];
+    }
+  free(old);
+}
+
+/*
+- Return the value of the variable whose name is the len bytes at name, or NULL
+  if it is not set.
+*/
+const char *var_lookup(const char *name, size_t len)
+{
+  if (used == 0)
+    return NULL;
+  int found;
+  size_t i = probe(name, len, hash_name(name, len), &found);
+  return found ? table[i].pair + len + 1 : NULL;
+}
+
+const char *var_get(const char *name)
+{
+  return var_lookup(name, strlen(name));
+}
+
+/*
+- Set a variable, creating it if needed; export marks it exported, else it keeps
+  the flag it had.
+*/
+void var_set(const char *name, const char *value, int export)
+{
+  if ((used + tombstones + 1) * 4 > capacity * 3)
+    resize(capacity ? (used + 1) * 4 > capacity * 3 ? capacity * 2 : capacity : 64);
+
+  size_t len = strlen(name), value_len = strlen(value);
+  unsigned h = hash_name(name, len);
+  int found;
+  size_t i = probe(name, len, h, &found);
+  struct variable *v = &table[i];
+
+  char *pair = malloc(len + value_len + 2);
+  if (pair == NULL)
+  {
+    perror("variables");
+    exit(EXIT_FAILURE);
+  }
+  memcpy(pair, name, len);
+  pair[len] = '=';
+  memcpy(pair + len + 1, value, value_len + 1);
+
+  if (found)
+    free(v->pair);
+  else
+  {
+    if (v->pair == tombstone)
+      tombstones--;
+    used++;
+    v->flags = 0;
+    v->name_len = len;
+    v->hash = h;
+  }
+  v->pair = pair;
+  if (export)
+    v->flags |= VAR_EXPORTED;
+  if (v->flags & VAR_EXPORTED)
+    envp_stale = 1;
+}
+
+/* Marks a set variable exported; return -1 if it is not set */
+static int var_export(const char *name)
+{
+  size_t len = strlen(name);
+  int found;
+  if (used == 0)
+    return -1;
+  size_t i = probe(name, len, hash_name(name, len), &found);
+  if (!found)
+    return -1;
+  if (!(table[i].flags & VAR_EXPORTED))
+  {
+    table[i].flags |= VAR_EXPORTED;
+    envp_stale = 1;
+  }
+  return 0;
+}
+
+void var_unset(const char *name)
+{
+  size_t len = strlen(name);
+  int found;
+  if (used == 0)
+    return;
+  size_t i = probe(name, len, hash_name(name, len), &found);
+  if (!found)
+    return;
+  if (table[i].flags & VAR_EXPORTED)
+    envp_stale = 1;
+  free(table[i].pair);
+  table[i].pair = tombstone;
+  used--;
+  tombstones++;
+}
+
+/*
+   Returns the environment for a new process: the exported variables as
+   "NAME=value" strings, NULL-terminated. The array is reused until an exported
+   variable changes.
+*/
+char **var_environ(void)
+{
+  if (!envp_stale)
+    return envp;
+
+  size_t count = 0;
+  for (size_t i = 0; i < capacity; i++)
+    if (table[i].pair != NULL && table[i].pair != tombstone && (table[i].flags & VAR_EXPORTED))
+      count++;
+  if (count + 1 > envp_cap)
+  {
+    envp_cap = (count + 1) * 2;
+    envp = realloc(envp, sizeof(char *) * envp_cap);
+    if (envp == NULL)
+    {
+      perror("variables");
+      exit(EXIT_FAILURE);
+    }
+  }
+
+  count = 0;
+  for (size_t i = 0; i < capacity; i++)
+    if (table[i].pair != NULL && table[i].pair != tombstone && (table[i].flags & VAR_EXPORTED))
+      envp[count++] = table[i].pair;
+  envp[count] = NULL;
+  envp_stale = 0;
+  return envp;
+}
+
+/* Imports the shell's environment, exported */
+void vars_init(void)
+{
+  extern char **environ;
+  for (char **e = environ; *e != NULL; e++)
+  {
+    const char *eq = strchr(*e, '=');
+    if (eq == NULL || eq == *e)
+      continue;
+    char *name = strndup(*e, eq - *e);
+    if (name != NULL)
+      var_set(name, eq + 1, 1);
+    free(name);
+  }
+}
+
+/* -------------------------------------------------------------------*/
+
+/* Whether the len bytes at s make a variable name: a letter or '_', then letters, digits and '_' */
+static int is_var_name(const char *s, size_t len)
+{
+  if (len == 0 || (!isalpha((unsigned char)s[0]) && s[0] != '_'))
+    return 0;
+  for (size_t i = 1; i < len; i++)
+    if (!isalnum((unsigned char)s[i]) && s[i] != '_')
+      return 0;
+  return 1;
+}
+
+/* Length of the name of an assignment word NAME=value, 0 if the word is not one */
+static size_t assignment_name(const char *word)
+{
+  const char *eq = strchr(word, '=');
+  return eq != NULL && is_var_name(word, eq - word) ? (size_t)(eq - word) : 0;
+}
+
+/* Counts the assignments NAME=value that start a command */
+int count_assignments(struct simple_command *cmd)
+{
+  int n = 0;
+  while (n < cmd->argc && assignment_name(cmd->argv[n]) > 0)
+    n++;
+  return n;
+}
+
+/*
+   Sets the variables of count assignment words, their values expanded. With
+   saved, the assignments are for one command only: the variables are exported,
+   and what they were is recorded in *saved for restore_assignments().
+*/
+void assign_words(char **words, int count, struct saved_variable **saved)
+{
+  if (saved != NULL)
+    *saved = arena_alloc(&line_arena, sizeof(struct saved_variable) * (count + 1));
+
+  for (int i = 0; i < count; i++)
+  {
+    size_t len = assignment_name(words[i]);
+    char *name = arena_strndup(&line_arena, words[i], len);
+    const char *value = expand_parameters(words[i] + len + 1);
+
+    if (saved != NULL)
+    {
+      struct saved_variable *s = &(*saved)[i];
+      const char *old = var_get(name);
+      s->name = name;
+      s->value = old != NULL ? arena_strdup(&line_arena, old) : NULL;
+      s->exported = 0;
+      if (old != NULL)
+      {
+        int found;
+        size_t slot = probe(name, len, hash_name(name, len), &found);
+        s->exported = table[slot].flags & VAR_EXPORTED;
+      }
+    }
+    var_set(name, value, saved != NULL);
+  }
+  if (saved != NULL)
+    (*saved)[count].name = NULL;
+}
+
+/* Puts back the variables a command's own assignments changed, last first */
+void restore_assignments(struct saved_variable *saved)
+{
+  int count = 0;
+  while (saved[count].name != NULL)
+    count++;
+  while (count-- > 0)
+  {
+    struct saved_variable *s = &saved[count];
+    if (s->value == NULL)
+      var_unset(s->name);
+    else
+    {
+      var_unset(s->name); // drops the export flag the assignment gave it
+      var_set(s->name, s->value, s->exported);
+    }
+  }
+}
+
+static int compare_pairs(const void *a, const void *b)
+{
+  return strcmp(*(char *const *)a, *(char *const *)b);
+}
+
+/* Prints the exported variables sorted, in a form the shell reads back */
+static void print_exported(void)
+{
+  char **pairs = var_environ();
+  size_t count = 0;
+  while (pairs[count] != NULL)
+    count++;
+  char **sorted = arena_alloc(&line_arena, sizeof(char *) * (count + 1));
+  memcpy(sorted, pairs, sizeof(char *) * count);
+  qsort(sorted, count, sizeof(char *), compare_pairs);
+  for (size_t i = 0; i < count; i++)
+    printf("export %s\n", sorted[i]);
+}
+
+/*
+   export [-p] [NAME[=value] ...]: sets and exports the variables, or lists the
+   exported ones. Returns 1 if a name is not valid.
+*/
+int export_builtin(char **cmd_tokens)
+{
+  int i = 1, status = 0;
+  if (cmd_tokens[i] != NULL && strcmp(cmd_tokens[i], "-p") == 0)
+    i++;
+  if (cmd_tokens[i] == NULL)
+  {
+    print_exported();
+    return 0;
+  }
+
+  for (; cmd_tokens[i] != NULL; i++)
+  {
+    char *word = cmd_tokens[i];
+    char *eq = strchr(word, '=');
+    size_t len = eq ? (size_t)(eq - word) : strlen(word);
+    if (!is_var_name(word, len))
+    {
+      fprintf(stderr, "export: `%s': not a valid identifier\n", word);
+      status = 1;
+    }
+    else if (eq != NULL)
+    {
+      char *name = arena_strndup(&line_arena, word, len);
+      var_set(name, eq + 1, 1);
+    }
+    else
+      var_export(word); // an unset name is left unset
+  }
+  return status;
+}
+
+/* unset [-v] NAME ...: removes the variables */
+int unset_builtin(char **cmd_tokens)
+{
+  int i = 1, status = 0;
+  if (cmd_tokens[i] != NULL && strcmp(cmd_tokens[i], "-v") == 0)
+    i++;
+  for (; cmd_tokens[i] != NULL; i++)
+  {
+    if (!is_var_name(cmd_tokens[i], strlen(cmd_tokens[i])))
+    {
+      fprintf(stderr, "unset: `%s': not a valid identifier\n", cmd_tokens[i]);
+      status = 1;
+      continue;
+    }
+    var_unset(cmd_tokens[i]);
+  }
+  return status;
+}